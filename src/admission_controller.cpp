@@ -0,0 +1,154 @@
+#include "admission_controller.hpp"
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        AdmissionController::AdmissionController(
+            AdmissionOptions const &options,
+            std::shared_ptr<MetricsRegistry> metrics)
+            : m_options(options), m_metrics(std::move(metrics))
+        {
+            m_options.Limiter.MaxLimit = m_options.MaxInFlightPerHost;
+        }
+
+        AdmissionController::HostState &AdmissionController::GetHostState(std::string const &host)
+        {
+            auto found = m_hosts.find(host);
+            if (found != m_hosts.end())
+            {
+                return found->second;
+            }
+
+            // Metrics outlive the host state, which is dropped when a host with a fixed limit goes idle
+            auto const labels = MetricsRegistry::Label("host", host);
+            HostState state;
+            if (m_options.Adaptive)
+            {
+                state.Limiter.reset(new ConcurrencyLimiter(m_options.Limiter));
+            }
+            state.InFlightGauge = &m_metrics->GetGauge("admission_in_flight", labels);
+            state.LimitGauge = &m_metrics->GetGauge("admission_limit", labels);
+            state.QueueDepthGauge = &m_metrics->GetGauge("admission_queue_depth", labels);
+            state.QueueTime = &m_metrics->GetHistogram("admission_queue_time_ms", MetricsRegistry::LatencyBoundsMs(), labels);
+            state.Rejected = &m_metrics->GetCounter("admission_rejected_total", labels);
+            auto &inserted = m_hosts.emplace(host, std::move(state)).first->second;
+            inserted.LimitGauge->Set(static_cast<int64_t>(GetLimit(inserted)));
+            return inserted;
+        }
+
+        size_t AdmissionController::GetLimit(HostState const &state) const
+        {
+            return state.Limiter ? state.Limiter->GetLimit() : m_options.MaxInFlightPerHost;
+        }
+
+        AdmissionController::Decision AdmissionController::Acquire(
+            std::string const &host,
+            void const *key,
+            TransferPriority const &priority)
+        {
+            if (!IsEnabled())
+            {
+                return Decision::Admitted;
+            }
+
+            auto &state = GetHostState(host);
+            if (state.InFlight < GetLimit(state) && state.Queue.empty())
+            {
+                ++state.InFlight;
+                state.InFlightGauge->Add(1);
+                state.QueueTime->Record(0);
+                return Decision::Admitted;
+            }
+
+            if (m_options.MaxQueueDepthPerHost != 0 && state.Queue.size() >= m_options.MaxQueueDepthPerHost)
+            {
+                state.Rejected->Add();
+                return Decision::Rejected;
+            }
+
+            QueuePosition const position(-priority.Class, priority.Deadline, m_nextSequence++);
+            state.Queue.emplace(position, Waiter{key, std::chrono::steady_clock::now()});
+            state.QueueDepthGauge->Add(1);
+            m_queued.emplace(key, std::make_pair(host, position));
+            return Decision::Queued;
+        }
+
+        void AdmissionController::OnCompleted(
+            std::string const &host,
+            std::chrono::microseconds latency,
+            bool overloaded)
+        {
+            if (!m_options.Adaptive)
+            {
+                return;
+            }
+
+            auto found = m_hosts.find(host);
+            if (found == m_hosts.end())
+            {
+                return;
+            }
+            auto &state = found->second;
+            state.Limiter->OnSample(latency, overloaded, state.InFlight);
+            state.LimitGauge->Set(static_cast<int64_t>(state.Limiter->GetLimit()));
+        }
+
+        std::vector<void const *> AdmissionController::Release(std::string const &host)
+        {
+            std::vector<void const *> admitted;
+            if (!IsEnabled())
+            {
+                return admitted;
+            }
+
+            auto found = m_hosts.find(host);
+            if (found == m_hosts.end())
+            {
+                return admitted;
+            }
+            auto &state = found->second;
+
+            --state.InFlight;
+            state.InFlightGauge->Add(-1);
+
+            // An adaptive limit may have grown or shrunk since the slot was taken
+            auto const now = std::chrono::steady_clock::now();
+            while (!state.Queue.empty() && state.InFlight < GetLimit(state))
+            {
+                auto next = state.Queue.begin();
+                auto const waiter = next->second;
+                state.Queue.erase(next);
+                state.QueueDepthGauge->Add(-1);
+                m_queued.erase(waiter.Key);
+                state.QueueTime->Record(std::chrono::duration<double, std::milli>(now - waiter.EnqueuedAt).count());
+
+                ++state.InFlight;
+                state.InFlightGauge->Add(1);
+                admitted.push_back(waiter.Key);
+            }
+
+            // The learned limit of an adaptive host is kept for its next burst
+            if (state.InFlight == 0 && !state.Limiter)
+            {
+                m_hosts.erase(found);
+            }
+            return admitted;
+        }
+
+        bool AdmissionController::Withdraw(void const *key)
+        {
+            auto found = m_queued.find(key);
+            if (found == m_queued.end())
+            {
+                return false;
+            }
+
+            auto &state = m_hosts.at(found->second.first);
+            state.Queue.erase(found->second.second);
+            state.QueueDepthGauge->Add(-1);
+            m_queued.erase(found);
+            return true;
+        }
+    }
+}
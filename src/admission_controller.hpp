@@ -0,0 +1,122 @@
+/**
+ * Per-host bound on in-flight requests with a priority wait queue
+ */
+
+#pragma once
+
+#include "concurrency_limiter.hpp"
+#include "metrics.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct AdmissionOptions
+        {
+            // Zero disables admission control unless it is adaptive, where it means no upper bound
+            size_t MaxInFlightPerHost = 0;
+            // Zero means an unbounded queue
+            size_t MaxQueueDepthPerHost = 0;
+            // Lets a ConcurrencyLimiter move each host's limit below MaxInFlightPerHost
+            bool Adaptive = false;
+            ConcurrencyLimiterOptions Limiter;
+        };
+
+        /**
+         * Where a transfer goes in the queues it waits in
+         */
+        struct TransferPriority
+        {
+            // Higher classes run first; below zero is background work, above zero is latency sensitive
+            int Class = 0;
+            // Earliest first within a class, max() when the request has none
+            std::chrono::steady_clock::time_point Deadline = std::chrono::steady_clock::time_point::max();
+        };
+
+        /**
+         * Decides which requests may start. Up to the per-host limit requests start right away; the rest
+         * wait in a queue ordered by priority class (higher first), then earliest deadline, then
+         * arrival, and each completion admits the next one. When a host's queue is full new requests are
+         * rejected immediately, so overload degrades into fast failures instead of ever-growing latency.
+         *
+         * With adaptive admission every host gets its own ConcurrencyLimiter, fed from completed
+         * requests, and the in-flight limit follows it.
+         *
+         * Requests are identified by an opaque key. The controller is not thread safe, only the engine's
+         * event loop thread calls it.
+         */
+        class AdmissionController final
+        {
+        public:
+            enum class Decision
+            {
+                Admitted,
+                Queued,
+                Rejected,
+            };
+
+            AdmissionController(AdmissionOptions const &options, std::shared_ptr<MetricsRegistry> metrics);
+
+            Decision Acquire(std::string const &host, void const *key, TransferPriority const &priority);
+
+            /**
+             * Reports the latency of a request that finished while holding a slot, and whether the
+             * server signalled overload. Only used by adaptive admission.
+             */
+            void OnCompleted(std::string const &host, std::chrono::microseconds latency, bool overloaded);
+
+            /**
+             * Frees the slot held by a finished request and admits as many queued requests of the same
+             * host as the limit now allows, returning their keys.
+             */
+            std::vector<void const *> Release(std::string const &host);
+
+            /**
+             * Removes a still-queued request. Returns false when @p key is not queued.
+             */
+            bool Withdraw(void const *key);
+
+        private:
+            // Higher class first, then earliest deadline first, then first come first served
+            using QueuePosition = std::tuple<int, std::chrono::steady_clock::time_point, uint64_t>;
+
+            struct Waiter
+            {
+                void const *Key;
+                std::chrono::steady_clock::time_point EnqueuedAt;
+            };
+
+            struct HostState
+            {
+                size_t InFlight = 0;
+                std::map<QueuePosition, Waiter> Queue;
+                std::unique_ptr<ConcurrencyLimiter> Limiter;
+                Gauge *InFlightGauge;
+                Gauge *LimitGauge;
+                Gauge *QueueDepthGauge;
+                Histogram *QueueTime;
+                Counter *Rejected;
+            };
+
+            AdmissionOptions m_options;
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            std::unordered_map<std::string, HostState> m_hosts;
+            std::unordered_map<void const *, std::pair<std::string, QueuePosition>> m_queued;
+            uint64_t m_nextSequence = 0;
+
+            bool IsEnabled() const { return m_options.MaxInFlightPerHost != 0 || m_options.Adaptive; }
+            HostState &GetHostState(std::string const &host);
+            size_t GetLimit(HostState const &state) const;
+        };
+    }
+}
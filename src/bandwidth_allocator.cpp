@@ -0,0 +1,262 @@
+#include "bandwidth_allocator.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr static const std::chrono::milliseconds RebalanceInterval(100);
+    // Weight of the newest interval in the measured rates
+    constexpr static const double Smoothing = 0.5;
+    // A tenant using less than this part of its share is not limited by it
+    constexpr static const double SaturationRatio = 0.8;
+    // Room a tenant below its share gets to grow into before the next rebalance
+    constexpr static const double Headroom = 1.5;
+
+    struct Claim
+    {
+        double Weight;
+        // What the tenant is expected to use, infinite when its share holds it back
+        double Demand;
+        // Never more than this, infinite without a cap
+        double Cap;
+        double Share = 0;
+    };
+
+    // Max-min fair split of capacity by weight, no claim getting more than limit(claim). Starts from the
+    // current shares and returns what is left over.
+    template <class Limit> double WaterFill(std::vector<Claim *> claims, double capacity, Limit limit)
+    {
+        while (capacity > 0)
+        {
+            claims.erase(
+                std::remove_if(claims.begin(), claims.end(), [&limit](Claim *claim)
+                               { return claim->Share >= limit(*claim); }),
+                claims.end());
+            if (claims.empty())
+            {
+                break;
+            }
+
+            double totalWeight = 0;
+            for (auto claim : claims)
+            {
+                totalWeight += claim->Weight;
+            }
+            auto const unit = capacity / totalWeight;
+
+            // Claims that fit below the even split are settled first, their leftover goes to the rest
+            bool settled = false;
+            for (auto claim : claims)
+            {
+                auto const room = limit(*claim) - claim->Share;
+                if (room <= claim->Weight * unit)
+                {
+                    claim->Share += room;
+                    capacity -= room;
+                    settled = true;
+                }
+            }
+            if (!settled)
+            {
+                for (auto claim : claims)
+                {
+                    claim->Share += claim->Weight * unit;
+                }
+                capacity = 0;
+            }
+        }
+        return capacity;
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        std::string BandwidthAllocator::GetTenantLabel(std::string const &tenant) { return tenant.empty() ? "default" : tenant; }
+
+        BandwidthAllocator::BandwidthAllocator(BandwidthOptions options, std::shared_ptr<MetricsRegistry> metrics)
+            : m_options(std::move(options)), m_metrics(std::move(metrics)), m_lastRebalance(Clock::now())
+        {
+        }
+
+        BandwidthAllocator::Tenant &BandwidthAllocator::GetTenant(std::string const &name)
+        {
+            auto found = m_tenants.find(name);
+            if (found != m_tenants.end())
+            {
+                return found->second;
+            }
+
+            auto const labels = MetricsRegistry::Label("tenant", GetTenantLabel(name));
+            Tenant tenant;
+            auto weight = m_options.Weights.find(name);
+            if (weight != m_options.Weights.end() && weight->second > 0)
+            {
+                tenant.Weight = weight->second;
+            }
+            auto maxRate = m_options.MaxRates.find(name);
+            if (maxRate != m_options.MaxRates.end())
+            {
+                tenant.MaxRate = static_cast<double>(maxRate->second);
+            }
+            tenant.Receive.ShareGauge = &m_metrics->GetGauge("tenant_receive_share", labels);
+            tenant.Send.ShareGauge = &m_metrics->GetGauge("tenant_send_share", labels);
+            tenant.ReceivedBytes = &m_metrics->GetCounter("tenant_received_bytes_total", labels);
+            tenant.SentBytes = &m_metrics->GetCounter("tenant_sent_bytes_total", labels);
+            tenant.Duration = &m_metrics->GetHistogram("tenant_request_duration_ms", MetricsRegistry::LatencyBoundsMs(), labels);
+            return m_tenants.emplace(name, std::move(tenant)).first->second;
+        }
+
+        void BandwidthAllocator::OnStarted(std::string const &tenant)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (GetTenant(tenant).Active++ == 0 && m_options.Capacity > 0)
+            {
+                // A new tenant gets its share before its first transfer moves a byte
+                Rebalance(Clock::now());
+            }
+        }
+
+        void BandwidthAllocator::OnProgress(std::string const &tenant, int64_t received, int64_t sent)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &state = GetTenant(tenant);
+            state.Receive.Bytes += received;
+            state.Send.Bytes += sent;
+            state.ReceivedBytes->Add(static_cast<uint64_t>(received));
+            state.SentBytes->Add(static_cast<uint64_t>(sent));
+        }
+
+        void BandwidthAllocator::OnFinished(std::string const &tenant, std::chrono::milliseconds duration)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &state = GetTenant(tenant);
+            state.Duration->Record(static_cast<double>(duration.count()));
+            if (state.Active > 0 && --state.Active == 0 && m_options.Capacity > 0)
+            {
+                // Hands its share to the tenants still busy
+                Rebalance(Clock::now());
+            }
+        }
+
+        BandwidthAllocator::Rates BandwidthAllocator::GetTransferRates(std::string const &tenant)
+        {
+            Rates rates;
+            if (!IsLimiting())
+            {
+                return rates;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto const &state = GetTenant(tenant);
+            auto const transfers = static_cast<double>(std::max<size_t>(state.Active, 1));
+            if (m_options.Capacity <= 0)
+            {
+                if (state.MaxRate > 0)
+                {
+                    rates.Receive = rates.Send = std::max<int64_t>(static_cast<int64_t>(state.MaxRate / transfers), 1);
+                }
+                return rates;
+            }
+
+            auto const now = Clock::now();
+            if (now - m_lastRebalance >= RebalanceInterval)
+            {
+                Rebalance(now);
+            }
+            // At least a byte per second, zero would lift the limit
+            rates.Receive = std::max<int64_t>(static_cast<int64_t>(state.Receive.Share / transfers), 1);
+            rates.Send = std::max<int64_t>(static_cast<int64_t>(state.Send.Share / transfers), 1);
+            return rates;
+        }
+
+        void BandwidthAllocator::Rebalance(Clock::time_point now)
+        {
+            auto const elapsed = std::chrono::duration<double>(now - m_lastRebalance).count();
+            m_lastRebalance = now;
+            for (auto &entry : m_tenants)
+            {
+                for (auto direction : {&Tenant::Receive, &Tenant::Send})
+                {
+                    auto &state = entry.second.*direction;
+                    if (elapsed > 0)
+                    {
+                        auto const rate = static_cast<double>(state.Bytes) / elapsed;
+                        state.Measured = Smoothing * rate + (1 - Smoothing) * state.Measured;
+                    }
+                    state.Bytes = 0;
+                }
+            }
+
+            Allocate(&Tenant::Receive);
+            Allocate(&Tenant::Send);
+        }
+
+        void BandwidthAllocator::Allocate(Direction Tenant::*direction)
+        {
+            auto const unlimited = std::numeric_limits<double>::infinity();
+            std::vector<Claim> claims;
+            std::vector<Direction *> states;
+            claims.reserve(m_tenants.size());
+            for (auto &entry : m_tenants)
+            {
+                auto &tenant = entry.second;
+                auto &state = tenant.*direction;
+                if (tenant.Active == 0)
+                {
+                    state.Share = 0;
+                    state.ShareGauge->Set(0);
+                    continue;
+                }
+
+                Claim claim;
+                claim.Weight = tenant.Weight;
+                claim.Cap = tenant.MaxRate > 0 ? tenant.MaxRate : unlimited;
+                auto const saturated = state.Share == 0 || state.Measured >= SaturationRatio * state.Share;
+                claim.Demand = std::min(saturated ? unlimited : state.Measured * Headroom, claim.Cap);
+                claims.push_back(claim);
+                states.push_back(&state);
+            }
+
+            std::vector<Claim *> pointers;
+            for (auto &claim : claims)
+            {
+                pointers.push_back(&claim);
+            }
+            // Fair shares of what the tenants can use, then whatever is left so no capacity idles
+            auto const capacity = static_cast<double>(m_options.Capacity);
+            auto const spare = WaterFill(pointers, capacity, [](Claim const &claim)
+                                         { return claim.Demand; });
+            WaterFill(pointers, spare, [](Claim const &claim)
+                      { return claim.Cap; });
+            std::vector<double> shares;
+            for (auto const &claim : claims)
+            {
+                shares.push_back(claim.Share);
+            }
+
+            // Nobody is held below their weighted share of the link, demand or not. A quiet tenant can
+            // then ramp up without waiting for the next rebalances, and overshoots the capacity for one
+            // interval at most. Tiny limits also make libcurl pause the transfer for as long as the
+            // bytes it already moved would have taken, and it does not look at a raised limit until then.
+            for (auto &claim : claims)
+            {
+                claim.Share = 0;
+            }
+            WaterFill(pointers, capacity, [](Claim const &claim)
+                      { return claim.Cap; });
+
+            for (size_t i = 0; i < claims.size(); ++i)
+            {
+                auto const share = std::max(shares[i], claims[i].Share);
+                states[i]->Share = share;
+                states[i]->ShareGauge->Set(static_cast<int64_t>(share));
+            }
+        }
+    }
+}
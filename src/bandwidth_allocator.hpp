@@ -0,0 +1,117 @@
+/**
+ * Weighted fair sharing of the link's bandwidth between tenants
+ */
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct BandwidthOptions
+        {
+            // Bytes per second the tenants share in each direction, zero for no sharing
+            int64_t Capacity = 0;
+            // Relative shares, tenants not listed weigh 1
+            std::map<std::string, double> Weights;
+            // Bytes per second no tenant gets beyond, spare capacity or not
+            std::map<std::string, int64_t> MaxRates;
+        };
+
+        /**
+         * Splits the capacity between the tenants with transfers in flight, receive and send
+         * separately, in proportion to their weights. Tenants that use less than their share keep what
+         * they use plus headroom, and the rest goes to the others, so a quiet tenant does not leave
+         * the link idle while a busy one is capped. A tenant's share is spread evenly over its transfers,
+         * which the engines enforce with libcurl's speed limits.
+         *
+         * Shares are recomputed from measured rates every 100 ms and whenever a tenant starts or stops
+         * having transfers in flight. Without a capacity, tenants only get their caps. Shared by every
+         * engine of the transport, thread safe.
+         */
+        class BandwidthAllocator final
+        {
+        public:
+            struct Rates
+            {
+                // Bytes per second, zero for unlimited
+                int64_t Receive = 0;
+                int64_t Send = 0;
+            };
+
+            BandwidthAllocator(BandwidthOptions options, std::shared_ptr<MetricsRegistry> metrics);
+
+            /**
+             * The `tenant` metrics label of @p tenant; untagged requests are the default tenant.
+             */
+            static std::string GetTenantLabel(std::string const &tenant);
+
+            BandwidthAllocator(BandwidthAllocator const &) = delete;
+            BandwidthAllocator &operator=(BandwidthAllocator const &) = delete;
+
+            /**
+             * Whether transfers need speed limits at all, that is with a capacity to share or rate caps.
+             * Otherwise the allocator only keeps the tenant metrics.
+             */
+            bool IsLimiting() const { return m_options.Capacity > 0 || !m_options.MaxRates.empty(); }
+
+            void OnStarted(std::string const &tenant);
+
+            /**
+             * Reports bytes moved by a tenant's transfer since its last report.
+             */
+            void OnProgress(std::string const &tenant, int64_t received, int64_t sent);
+
+            void OnFinished(std::string const &tenant, std::chrono::milliseconds duration);
+
+            /**
+             * The speed limits for one transfer of @p tenant right now.
+             */
+            Rates GetTransferRates(std::string const &tenant);
+
+        private:
+            struct Direction
+            {
+                // Bytes moved since the last rebalance
+                int64_t Bytes = 0;
+                // Smoothed bytes per second
+                double Measured = 0;
+                double Share = 0;
+                Gauge *ShareGauge;
+            };
+
+            struct Tenant
+            {
+                double Weight = 1;
+                // Zero for no cap
+                double MaxRate = 0;
+                size_t Active = 0;
+                Direction Receive;
+                Direction Send;
+                Counter *ReceivedBytes;
+                Counter *SentBytes;
+                Histogram *Duration;
+            };
+
+            BandwidthOptions m_options;
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            std::mutex m_mutex;
+            std::unordered_map<std::string, Tenant> m_tenants;
+            std::chrono::steady_clock::time_point m_lastRebalance;
+
+            Tenant &GetTenant(std::string const &name);
+            void Rebalance(std::chrono::steady_clock::time_point now);
+            void Allocate(Direction Tenant::*direction);
+        };
+    }
+}
@@ -0,0 +1,288 @@
+#include "broker_channel.hpp"
+
+#if defined(MY_TRANSPORT_HAS_SHARED_MEMORY)
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Message id, kind and whether it is the message's last record
+    constexpr static const size_t RecordHeaderSize = sizeof(uint64_t) + 2;
+
+    // The broker maps memory a worker owns; without these seals the worker could shrink it under the
+    // broker, which would then fault on the next access
+    constexpr static const int RequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+    size_t RoundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 1;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    void CloseAll(std::vector<int> const &descriptors)
+    {
+        for (auto fd : descriptors)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        std::unique_ptr<BrokerChannel> BrokerChannel::Create(size_t capacity)
+        {
+            capacity = RoundUpToPowerOfTwo(std::max(capacity, size_t(1024)));
+
+            std::vector<int> descriptors;
+            descriptors.push_back(memfd_create("my-transport-broker", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+            for (size_t i = 1; i < BrokerChannelDescriptors; ++i)
+            {
+                descriptors.push_back(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+            }
+            auto const size = static_cast<off_t>(2 * SharedRing::GetRegionSize(capacity));
+            auto const created = std::find(descriptors.begin(), descriptors.end(), -1) == descriptors.end() &&
+                                 ftruncate(descriptors[0], size) == 0 &&
+                                 fcntl(descriptors[0], F_ADD_SEALS, RequiredSeals) == 0;
+            if (!created)
+            {
+                CloseAll(descriptors);
+                throw std::runtime_error("Could not create the shared memory for the transport broker");
+            }
+            return std::unique_ptr<BrokerChannel>(new BrokerChannel(std::move(descriptors), capacity, true));
+        }
+
+        std::unique_ptr<BrokerChannel> BrokerChannel::Open(std::vector<int> descriptors)
+        {
+            struct stat status = {};
+            auto const seals = descriptors.size() == BrokerChannelDescriptors ? fcntl(descriptors[0], F_GET_SEALS) : -1;
+            if (seals < 0 || (seals & RequiredSeals) != RequiredSeals || fstat(descriptors[0], &status) != 0)
+            {
+                CloseAll(descriptors);
+                throw std::runtime_error("Transport broker channel has no sealed shared memory");
+            }
+
+            // Both rings have the same capacity, which the size of the memory gives away
+            auto const regionSize = static_cast<size_t>(status.st_size) / 2;
+            auto const capacity = regionSize > SharedRing::GetRegionSize(0) ? regionSize - SharedRing::GetRegionSize(0) : 0;
+            if (static_cast<size_t>(status.st_size) != 2 * SharedRing::GetRegionSize(capacity))
+            {
+                CloseAll(descriptors);
+                throw std::runtime_error("Transport broker channel has shared memory of the wrong size");
+            }
+
+            // The broker must never block on a worker's eventfd
+            for (size_t i = 1; i < descriptors.size(); ++i)
+            {
+                fcntl(descriptors[i], F_SETFL, fcntl(descriptors[i], F_GETFL) | O_NONBLOCK);
+            }
+            return std::unique_ptr<BrokerChannel>(new BrokerChannel(std::move(descriptors), capacity, false));
+        }
+
+        BrokerChannel::BrokerChannel(std::vector<int> descriptors, size_t capacity, bool reset)
+            : m_descriptors(std::move(descriptors)), m_memorySize(2 * SharedRing::GetRegionSize(capacity))
+        {
+            m_memory = mmap(nullptr, m_memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, m_descriptors[0], 0);
+            if (m_memory == MAP_FAILED)
+            {
+                CloseAll(m_descriptors);
+                throw std::runtime_error("Could not map the shared memory of the transport broker");
+            }
+
+            try
+            {
+                auto const region = static_cast<uint8_t *>(m_memory);
+                m_requests = std::make_unique<SharedRing>(region, capacity, m_descriptors[1], m_descriptors[2], reset);
+                m_responses = std::make_unique<SharedRing>(
+                    region + SharedRing::GetRegionSize(capacity), capacity, m_descriptors[3], m_descriptors[4], reset);
+            }
+            catch (...)
+            {
+                munmap(m_memory, m_memorySize);
+                CloseAll(m_descriptors);
+                throw;
+            }
+        }
+
+        BrokerChannel::~BrokerChannel()
+        {
+            m_requests.reset();
+            m_responses.reset();
+            munmap(m_memory, m_memorySize);
+            CloseAll(m_descriptors);
+        }
+
+        void SendDescriptors(int socket, std::vector<int> const &descriptors)
+        {
+            std::vector<char> control(CMSG_SPACE(sizeof(int) * descriptors.size()));
+            char payload = 0;
+            struct iovec data = {&payload, sizeof(payload)};
+            struct msghdr message = {};
+            message.msg_iov = &data;
+            message.msg_iovlen = 1;
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+
+            auto header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int) * descriptors.size());
+            std::memcpy(CMSG_DATA(header), descriptors.data(), sizeof(int) * descriptors.size());
+
+            if (sendmsg(socket, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(payload)))
+            {
+                throw std::runtime_error("Could not pass the shared memory to the transport broker");
+            }
+        }
+
+        std::vector<int> ReceiveDescriptors(int socket, size_t count)
+        {
+            std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+            char payload = 0;
+            struct iovec data = {&payload, sizeof(payload)};
+            struct msghdr message = {};
+            message.msg_iov = &data;
+            message.msg_iovlen = 1;
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+
+            auto const received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+            std::vector<int> descriptors;
+            for (auto header = CMSG_FIRSTHDR(&message); received > 0 && header; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+                {
+                    auto const first = descriptors.size();
+                    descriptors.resize(first + (header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                    std::memcpy(descriptors.data() + first, CMSG_DATA(header), (descriptors.size() - first) * sizeof(int));
+                }
+            }
+            if (received <= 0 || descriptors.size() != count || (message.msg_flags & MSG_CTRUNC) != 0)
+            {
+                CloseAll(descriptors);
+                throw std::runtime_error("Could not receive the shared memory of a transport broker worker");
+            }
+            return descriptors;
+        }
+
+        size_t GetMessageRecordSize(SharedRing const &ring) { return ring.GetMaxRecordSize(); }
+
+        bool WriteMessage(SharedRing &ring, OutgoingMessage &message)
+        {
+            auto const maxChunk = ring.GetMaxRecordSize() - RecordHeaderSize;
+            while (!message.Done)
+            {
+                auto const chunk = std::min(maxChunk, message.Data.size() - message.Offset);
+                auto const last = message.Offset + chunk == message.Data.size();
+
+                uint8_t header[RecordHeaderSize];
+                std::memcpy(header, &message.Id, sizeof(message.Id));
+                header[sizeof(uint64_t)] = static_cast<uint8_t>(message.Kind);
+                header[sizeof(uint64_t) + 1] = last ? 1 : 0;
+                if (!ring.TryWrite(header, sizeof(header), message.Data.data() + message.Offset, chunk))
+                {
+                    return false;
+                }
+                message.Offset += chunk;
+                message.Done = last;
+            }
+            return true;
+        }
+
+        bool MessageAssembler::Add(std::vector<uint8_t> const &record, uint64_t &id, BrokerMessageKind &kind, std::vector<uint8_t> &message)
+        {
+            if (record.size() < RecordHeaderSize)
+            {
+                throw std::runtime_error("Malformed transport broker record");
+            }
+            std::memcpy(&id, record.data(), sizeof(id));
+            kind = static_cast<BrokerMessageKind>(record[sizeof(uint64_t)]);
+            auto const last = record[sizeof(uint64_t) + 1] != 0;
+
+            auto const size = record.size() - RecordHeaderSize;
+            if (size > m_maxBuffered - m_buffered)
+            {
+                throw std::runtime_error("Unfinished transport broker messages exceed the buffer limit");
+            }
+            auto &partial = m_partial[id];
+            partial.insert(partial.end(), record.begin() + RecordHeaderSize, record.end());
+            m_buffered += size;
+            if (!last)
+            {
+                return false;
+            }
+            m_buffered -= partial.size();
+            message = std::move(partial);
+            m_partial.erase(id);
+            return true;
+        }
+
+        void MessageWriter::PutInteger(uint64_t value)
+        {
+            auto const bytes = reinterpret_cast<uint8_t const *>(&value);
+            m_data.insert(m_data.end(), bytes, bytes + sizeof(value));
+        }
+
+        void MessageWriter::PutString(std::string const &value)
+        {
+            PutBytes(reinterpret_cast<uint8_t const *>(value.data()), value.size());
+        }
+
+        void MessageWriter::PutBytes(uint8_t const *data, size_t size)
+        {
+            PutInteger(size);
+            m_data.insert(m_data.end(), data, data + size);
+        }
+
+        uint64_t MessageReader::GetInteger()
+        {
+            Check(sizeof(uint64_t));
+            uint64_t value;
+            std::memcpy(&value, m_data.data() + m_offset, sizeof(value));
+            m_offset += sizeof(value);
+            return value;
+        }
+
+        std::string MessageReader::GetString()
+        {
+            auto const bytes = GetBytes();
+            return std::string(bytes.begin(), bytes.end());
+        }
+
+        std::vector<uint8_t> MessageReader::GetBytes()
+        {
+            auto const size = GetInteger();
+            Check(size);
+            std::vector<uint8_t> bytes(m_data.begin() + m_offset, m_data.begin() + m_offset + size);
+            m_offset += size;
+            return bytes;
+        }
+
+        void MessageReader::Check(size_t size) const
+        {
+            if (size > m_data.size() - m_offset)
+            {
+                throw std::runtime_error("Malformed transport broker message");
+            }
+        }
+    }
+}
+
+#endif
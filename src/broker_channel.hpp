@@ -0,0 +1,177 @@
+/**
+ * Shared memory, rings and message framing between a BrokerTransport and its TransportBroker
+ */
+
+#pragma once
+
+#include "shared_ring.hpp"
+
+#if defined(MY_TRANSPORT_HAS_SHARED_MEMORY)
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * One worker's connection to the broker: a memfd holding a request ring, written by the worker,
+         * and a response ring, written by the broker, with the four eventfds that signal them. The
+         * worker creates it and passes the descriptors over the broker's Unix socket; the broker maps
+         * the same memory.
+         */
+        class BrokerChannel final
+        {
+        public:
+            /**
+             * Creates the memory and eventfds with rings of @p capacity bytes each, rounded up to a
+             * power of two.
+             */
+            static std::unique_ptr<BrokerChannel> Create(size_t capacity);
+
+            /**
+             * Maps a channel from the descriptors of another process's GetDescriptors, taking
+             * ownership of them. Throws when they do not describe a channel.
+             */
+            static std::unique_ptr<BrokerChannel> Open(std::vector<int> descriptors);
+
+            ~BrokerChannel();
+
+            BrokerChannel(BrokerChannel const &) = delete;
+            BrokerChannel &operator=(BrokerChannel const &) = delete;
+
+            /**
+             * The memfd followed by the eventfds, in the order Open expects them.
+             */
+            std::vector<int> const &GetDescriptors() const { return m_descriptors; }
+
+            SharedRing &GetRequests() { return *m_requests; }
+            SharedRing &GetResponses() { return *m_responses; }
+
+        private:
+            BrokerChannel(std::vector<int> descriptors, size_t capacity, bool reset);
+
+            std::vector<int> m_descriptors;
+            void *m_memory = nullptr;
+            size_t m_memorySize = 0;
+            std::unique_ptr<SharedRing> m_requests;
+            std::unique_ptr<SharedRing> m_responses;
+        };
+
+        /**
+         * Number of descriptors in a channel.
+         */
+        constexpr static const size_t BrokerChannelDescriptors = 5;
+
+        /**
+         * Passes @p descriptors over the Unix socket @p socket. Throws on failure.
+         */
+        void SendDescriptors(int socket, std::vector<int> const &descriptors);
+
+        /**
+         * Receives @p count descriptors sent with SendDescriptors. Throws on failure or when a
+         * different number arrives.
+         */
+        std::vector<int> ReceiveDescriptors(int socket, size_t count);
+
+        enum class BrokerMessageKind : uint8_t
+        {
+            Request = 1,
+            Response = 2,
+            // The request failed, the message is what Send would have thrown
+            Error = 3,
+        };
+
+        /**
+         * A message on its way into a ring, split into records that fit.
+         */
+        struct OutgoingMessage
+        {
+            uint64_t Id = 0;
+            BrokerMessageKind Kind = BrokerMessageKind::Request;
+            std::vector<uint8_t> Data;
+            // Bytes of Data already written
+            size_t Offset = 0;
+            bool Done = false;
+        };
+
+        /**
+         * Writes as many records of @p message as fit into @p ring. Returns true once the whole
+         * message was written.
+         */
+        bool WriteMessage(SharedRing &ring, OutgoingMessage &message);
+
+        /**
+         * Largest record WriteMessage writes into @p ring, the size to pass to ArmWritable.
+         */
+        size_t GetMessageRecordSize(SharedRing const &ring);
+
+        /**
+         * Puts back together the messages whose records are read from one ring.
+         */
+        class MessageAssembler final
+        {
+        public:
+            /**
+             * Holds at most @p maxBuffered bytes of messages whose last record has not arrived yet,
+             * so a peer that never finishes its messages cannot exhaust memory.
+             */
+            explicit MessageAssembler(size_t maxBuffered = std::numeric_limits<size_t>::max()) : m_maxBuffered(maxBuffered) {}
+
+            /**
+             * Adds a record read from the ring. Returns true, with the message in the out parameters,
+             * when it was the last record of its message. Throws on a malformed record, or when
+             * unfinished messages would hold more than the limit.
+             */
+            bool Add(std::vector<uint8_t> const &record, uint64_t &id, BrokerMessageKind &kind, std::vector<uint8_t> &message);
+
+        private:
+            size_t m_maxBuffered;
+            size_t m_buffered = 0;
+            std::unordered_map<uint64_t, std::vector<uint8_t>> m_partial;
+        };
+
+        /**
+         * Appends fields to a message.
+         */
+        class MessageWriter final
+        {
+        public:
+            void PutInteger(uint64_t value);
+            void PutString(std::string const &value);
+            void PutBytes(uint8_t const *data, size_t size);
+
+            std::vector<uint8_t> Take() { return std::move(m_data); }
+
+        private:
+            std::vector<uint8_t> m_data;
+        };
+
+        /**
+         * Reads fields back in the order they were put. Throws when the message is too short.
+         */
+        class MessageReader final
+        {
+        public:
+            explicit MessageReader(std::vector<uint8_t> const &data) : m_data(data) {}
+
+            uint64_t GetInteger();
+            std::string GetString();
+            std::vector<uint8_t> GetBytes();
+
+        private:
+            std::vector<uint8_t> const &m_data;
+            size_t m_offset = 0;
+
+            void Check(size_t size) const;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,800 @@
+#include "broker_transport.hpp"
+
+#if defined(__linux__)
+
+#include "broker_channel.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+using Azure::Core::Context;
+using Azure::Core::Http::RawResponse;
+using Azure::Core::Http::Request;
+using Azure::Core::Http::TransportException;
+using MyNameSpace::_detail::BrokerMessageKind;
+using MyNameSpace::_detail::MessageReader;
+using MyNameSpace::_detail::MessageWriter;
+
+namespace
+{
+    // How often a request waiting on the broker checks whether it was cancelled
+    constexpr static const std::chrono::milliseconds CancellationPollInterval(100);
+    // Ready events taken per epoll_wait; more simply wait for the next call
+    constexpr static const int MaxEventsPerWait = 256;
+    // Sent in place of a deadline for requests without one
+    constexpr static const uint64_t NoDeadline = (std::numeric_limits<uint64_t>::max)();
+    // A worker sends its descriptors right after connecting; one that does not is not waited on longer
+    constexpr static const std::chrono::seconds HandshakeTimeout(1);
+    // How long a worker waits for the broker to take its channel
+    constexpr static const time_t AcknowledgementTimeoutSeconds = 5;
+    // Ring capacities of unfinished requests the broker buffers per worker
+    constexpr static const size_t MaxBufferedRings = 16;
+
+    // What the broker's epoll events come from, in the low bits of their data
+    enum EventSource : uint64_t
+    {
+        ControlSocket = 0,
+        RequestsReadable = 1,
+        ResponsesWritable = 2,
+    };
+    constexpr static const uint64_t EventSourceBits = 2;
+    // The listening socket and the wakeup eventfd; workers count from one
+    constexpr static const uint64_t BrokerKey = 0;
+
+    void Signal(int fd)
+    {
+        uint64_t const one = 1;
+        auto const written = write(fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    void Drain(int fd)
+    {
+        uint64_t value;
+        while (read(fd, &value, sizeof(value)) > 0)
+        {
+        }
+    }
+
+    socklen_t MakeAddress(std::string const &path, struct sockaddr_un &address)
+    {
+        address = {};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            throw std::runtime_error("Invalid transport broker path " + path);
+        }
+        std::memcpy(address.sun_path, path.data(), path.size());
+        // Abstract names are not terminated, their length is the address length
+        auto const abstract = path[0] == '@';
+        if (abstract)
+        {
+            address.sun_path[0] = '\0';
+        }
+        return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1));
+    }
+
+    std::vector<uint8_t> EncodeError(std::string const &message)
+    {
+        MessageWriter writer;
+        writer.PutString(message);
+        return writer.Take();
+    }
+
+    /**
+     * Response body owning the buffer it reads from.
+     */
+    class BufferedBodyStream final : public Azure::Core::IO::BodyStream
+    {
+    public:
+        explicit BufferedBodyStream(std::vector<uint8_t> data) : m_data(std::move(data)), m_stream(m_data) {}
+
+        int64_t Length() const override { return m_stream.Length(); }
+
+        void Rewind() override { m_stream.Rewind(); }
+
+    private:
+        std::vector<uint8_t> m_data;
+        Azure::Core::IO::MemoryBodyStream m_stream;
+
+        size_t OnRead(uint8_t *buffer, size_t count, Context const &context) override
+        {
+            return m_stream.Read(buffer, count, context);
+        }
+    };
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * A worker's request as the broker runs it, kept alive until its completion.
+         */
+        struct BrokeredRequest
+        {
+            BrokeredRequest(std::string const &method, std::string const &url, std::vector<uint8_t> body)
+                : Body(std::move(body)), BodyStream(Body),
+                  Request(Azure::Core::Http::HttpMethod(method), Azure::Core::Url(url), &BodyStream)
+            {
+            }
+
+            std::vector<uint8_t> Body;
+            Azure::Core::IO::MemoryBodyStream BodyStream;
+            Azure::Core::Http::Request Request;
+        };
+
+        struct BrokerWorker
+        {
+            uint64_t Key = 0;
+            int Socket = -1;
+            // When the broker stops waiting for the worker's channel
+            std::chrono::steady_clock::time_point HandshakeDeadline;
+            std::unique_ptr<BrokerChannel> Channel;
+            // Loop thread only
+            MessageAssembler Assembler;
+            std::deque<OutgoingMessage> Outgoing;
+            // Responses of completed requests, handed over from the completion threads
+            std::mutex Mutex;
+            std::vector<OutgoingMessage> Completed;
+
+            ~BrokerWorker()
+            {
+                if (Socket >= 0)
+                {
+                    close(Socket);
+                }
+            }
+        };
+    }
+
+    struct BrokerTransport::Pending
+    {
+        std::condition_variable Condition;
+        bool Done = false;
+        _detail::BrokerMessageKind Kind = _detail::BrokerMessageKind::Error;
+        std::vector<uint8_t> Message;
+    };
+
+    BrokerTransport::BrokerTransport(BrokerTransportOptions const &options)
+    {
+        try
+        {
+            struct sockaddr_un address;
+            auto const addressLength = MakeAddress(options.BrokerPath, address);
+            m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_socket < 0 || connect(m_socket, reinterpret_cast<struct sockaddr *>(&address), addressLength) != 0)
+            {
+                throw std::runtime_error("Could not connect to the transport broker at " + options.BrokerPath);
+            }
+
+            m_channel = _detail::BrokerChannel::Create(options.RingSize);
+            _detail::SendDescriptors(m_socket, m_channel->GetDescriptors());
+
+            // The broker acknowledges once it mapped the channel
+            struct timeval timeout = {AcknowledgementTimeoutSeconds, 0};
+            setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            char acknowledgement = 0;
+            if (recv(m_socket, &acknowledgement, sizeof(acknowledgement), 0) != sizeof(acknowledgement))
+            {
+                throw std::runtime_error("Transport broker at " + options.BrokerPath + " did not accept the connection");
+            }
+
+            m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_stopFd < 0)
+            {
+                throw std::runtime_error("Could not create an eventfd for the transport broker");
+            }
+        }
+        catch (...)
+        {
+            if (m_socket >= 0)
+            {
+                close(m_socket);
+            }
+            throw;
+        }
+
+        m_reader = std::thread(&BrokerTransport::ReadResponses, this);
+    }
+
+    BrokerTransport::~BrokerTransport()
+    {
+        Signal(m_stopFd);
+        m_reader.join();
+        m_channel.reset();
+        close(m_stopFd);
+        close(m_socket);
+    }
+
+    std::unique_ptr<RawResponse> BrokerTransport::Send(Request &request, Context const &context)
+    {
+        context.ThrowIfCancelled();
+
+        MessageWriter writer;
+        writer.PutString(request.GetMethod().ToString());
+        writer.PutString(request.GetUrl().GetAbsoluteUrl());
+        auto const headers = request.GetHeaders();
+        writer.PutInteger(headers.size());
+        for (auto const &header : headers)
+        {
+            writer.PutString(header.first);
+            writer.PutString(header.second);
+        }
+        auto remaining = NoDeadline;
+        auto const deadline = context.GetDeadline();
+        if (deadline != (Azure::DateTime::max)())
+        {
+            auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                static_cast<std::chrono::system_clock::time_point>(deadline) - std::chrono::system_clock::now());
+            remaining = left.count() > 0 ? static_cast<uint64_t>(left.count()) : 0;
+        }
+        writer.PutInteger(remaining);
+        std::vector<uint8_t> body;
+        if (auto bodyStream = request.GetBodyStream())
+        {
+            body = bodyStream->ReadToEnd(context);
+        }
+        writer.PutBytes(body.data(), body.size());
+        auto message = writer.Take();
+        // The broker drops a worker that sends more than it buffers, failing every other request too
+        if (message.size() > MaxBufferedRings * m_channel->GetRequests().GetCapacity())
+        {
+            throw TransportException("Request too large for the transport broker");
+        }
+
+        auto const id = ++m_nextId;
+        auto pending = std::make_shared<Pending>();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_disconnected)
+            {
+                throw TransportException("Lost the connection to the transport broker");
+            }
+            m_pending[id] = pending;
+        }
+
+        try
+        {
+            Write(id, std::move(message), context);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.erase(id);
+            throw;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!pending->Done)
+            {
+                if (context.IsCancelled())
+                {
+                    // Its response, when it comes, is dropped
+                    m_pending.erase(id);
+                    lock.unlock();
+                    context.ThrowIfCancelled();
+                }
+                pending->Condition.wait_for(lock, CancellationPollInterval);
+            }
+        }
+
+        MessageReader reader(pending->Message);
+        if (pending->Kind != BrokerMessageKind::Response)
+        {
+            throw TransportException(reader.GetString());
+        }
+        auto const status = static_cast<Azure::Core::Http::HttpStatusCode>(reader.GetInteger());
+        auto response = std::make_unique<RawResponse>(1, 1, status, reader.GetString());
+        auto const headerCount = reader.GetInteger();
+        for (uint64_t i = 0; i < headerCount; ++i)
+        {
+            auto name = reader.GetString();
+            response->SetHeader(name, reader.GetString());
+        }
+        response->SetBodyStream(std::make_unique<BufferedBodyStream>(reader.GetBytes()));
+        return response;
+    }
+
+    void BrokerTransport::Write(uint64_t id, std::vector<uint8_t> message, Context const &context)
+    {
+        _detail::OutgoingMessage outgoing;
+        outgoing.Id = id;
+        outgoing.Kind = BrokerMessageKind::Request;
+        outgoing.Data = std::move(message);
+
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        auto &ring = m_channel->GetRequests();
+        while (!_detail::WriteMessage(ring, outgoing))
+        {
+            if (!ring.ArmWritable(_detail::GetMessageRecordSize(ring)))
+            {
+                continue;
+            }
+            struct pollfd fds[] = {{ring.GetWritableFd(), POLLIN, 0}, {m_socket, POLLIN, 0}};
+            poll(fds, 2, static_cast<int>(CancellationPollInterval.count()));
+            ring.DisarmWritable();
+
+            // The broker never writes to the socket, so it only turns readable when the broker is gone
+            if (fds[1].revents != 0)
+            {
+                throw TransportException("Lost the connection to the transport broker");
+            }
+            // Once part of a message is in the ring, the rest has to follow
+            if (outgoing.Offset == 0)
+            {
+                context.ThrowIfCancelled();
+            }
+        }
+    }
+
+    void BrokerTransport::ReadResponses()
+    {
+        auto &ring = m_channel->GetResponses();
+        _detail::MessageAssembler assembler;
+        std::vector<uint8_t> record;
+        std::vector<uint8_t> message;
+        try
+        {
+            while (true)
+            {
+                while (ring.TryRead(record))
+                {
+                    uint64_t id;
+                    BrokerMessageKind kind;
+                    if (!assembler.Add(record, id, kind, message))
+                    {
+                        continue;
+                    }
+
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    auto found = m_pending.find(id);
+                    if (found != m_pending.end())
+                    {
+                        auto &pending = *found->second;
+                        pending.Kind = kind;
+                        pending.Message = std::move(message);
+                        pending.Done = true;
+                        pending.Condition.notify_one();
+                        m_pending.erase(found);
+                    }
+                }
+
+                if (!ring.ArmReadable())
+                {
+                    continue;
+                }
+                struct pollfd fds[] = {{ring.GetReadableFd(), POLLIN, 0}, {m_socket, POLLIN, 0}, {m_stopFd, POLLIN, 0}};
+                if (poll(fds, 3, -1) < 0 && errno != EINTR)
+                {
+                    break;
+                }
+                ring.DisarmReadable();
+                if (fds[1].revents != 0 || fds[2].revents != 0)
+                {
+                    break;
+                }
+            }
+        }
+        catch (std::exception const &)
+        {
+            // A corrupted ring is as good as a lost broker
+        }
+        Disconnect();
+    }
+
+    void BrokerTransport::Disconnect()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_disconnected = true;
+        for (auto &entry : m_pending)
+        {
+            auto &pending = *entry.second;
+            pending.Kind = BrokerMessageKind::Error;
+            pending.Message = EncodeError("Lost the connection to the transport broker");
+            pending.Done = true;
+            pending.Condition.notify_one();
+        }
+        m_pending.clear();
+    }
+
+    TransportBroker::TransportBroker(std::string path, std::shared_ptr<MyTransport> transport)
+        : m_path(std::move(path)), m_transport(std::move(transport))
+    {
+        try
+        {
+            struct sockaddr_un address;
+            auto const addressLength = MakeAddress(m_path, address);
+            if (m_path[0] != '@')
+            {
+                unlink(m_path.c_str());
+            }
+
+            m_listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (m_listenSocket < 0 || bind(m_listenSocket, reinterpret_cast<struct sockaddr *>(&address), addressLength) != 0 ||
+                listen(m_listenSocket, SOMAXCONN) != 0)
+            {
+                throw std::runtime_error("Could not listen for transport broker workers on " + m_path);
+            }
+
+            m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+            m_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_epollFd < 0 || m_wakeupFd < 0)
+            {
+                throw std::runtime_error("Could not create the transport broker loop");
+            }
+            for (auto const &source : {std::make_pair(m_listenSocket, ControlSocket), std::make_pair(m_wakeupFd, RequestsReadable)})
+            {
+                struct epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.u64 = (BrokerKey << EventSourceBits) | source.second;
+                if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, source.first, &event) != 0)
+                {
+                    throw std::runtime_error("Could not create the transport broker loop");
+                }
+            }
+        }
+        catch (...)
+        {
+            Close();
+            throw;
+        }
+
+        m_loopThread = std::thread(&TransportBroker::Run, this);
+    }
+
+    TransportBroker::~TransportBroker()
+    {
+        m_stop = true;
+        Signal(m_wakeupFd);
+        m_loopThread.join();
+        m_handshakes.clear();
+        m_workers.clear();
+
+        // Completions still signal the wakeup eventfd
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]()
+                    { return m_running == 0; });
+        lock.unlock();
+        Close();
+    }
+
+    void TransportBroker::Close()
+    {
+        for (auto fd : {m_listenSocket, m_epollFd, m_wakeupFd})
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        if (m_listenSocket >= 0 && !m_path.empty() && m_path[0] != '@')
+        {
+            unlink(m_path.c_str());
+        }
+    }
+
+    void TransportBroker::Run()
+    {
+        std::vector<struct epoll_event> events(MaxEventsPerWait);
+        std::vector<std::shared_ptr<_detail::BrokerWorker>> workers;
+        while (!m_stop)
+        {
+            // Connections still handshaking are checked for expiry at least once per timeout
+            auto const timeout = m_handshakes.empty() ? -1 : static_cast<int>(std::chrono::milliseconds(HandshakeTimeout).count());
+            auto const ready = epoll_wait(m_epollFd, events.data(), MaxEventsPerWait, timeout);
+            for (int i = 0; i < ready; ++i)
+            {
+                auto const key = events[i].data.u64 >> EventSourceBits;
+                auto const source = events[i].data.u64 & ((1 << EventSourceBits) - 1);
+                if (key == BrokerKey)
+                {
+                    if (source == ControlSocket)
+                    {
+                        Accept();
+                    }
+                    else
+                    {
+                        Drain(m_wakeupFd);
+                    }
+                    continue;
+                }
+                if (m_handshakes.count(key) != 0)
+                {
+                    Handshake(key);
+                    continue;
+                }
+
+                auto found = m_workers.find(key);
+                if (found == m_workers.end())
+                {
+                    continue;
+                }
+                auto &channel = *found->second->Channel;
+                if (source == ControlSocket)
+                {
+                    // Workers never write after the handshake, so this is their exit
+                    Drop(key);
+                }
+                else if (source == RequestsReadable)
+                {
+                    channel.GetRequests().DisarmReadable();
+                }
+                else
+                {
+                    channel.GetResponses().DisarmWritable();
+                }
+            }
+            ExpireHandshakes();
+
+            // Every worker on every wakeup, which is cheap for the tens of workers of a prefork server
+            // and spares completions from telling the loop whose they are
+            workers.clear();
+            for (auto const &worker : m_workers)
+            {
+                workers.push_back(worker.second);
+            }
+            for (auto const &worker : workers)
+            {
+                try
+                {
+                    Serve(worker);
+                }
+                catch (std::exception const &)
+                {
+                    // Corrupted its channel
+                    Drop(worker->Key);
+                }
+            }
+        }
+    }
+
+    void TransportBroker::Accept()
+    {
+        while (true)
+        {
+            auto const workerSocket = accept4(m_listenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (workerSocket < 0)
+            {
+                return;
+            }
+
+            auto worker = std::make_shared<_detail::BrokerWorker>();
+            worker->Socket = workerSocket;
+            worker->Key = ++m_nextWorker;
+            worker->HandshakeDeadline = std::chrono::steady_clock::now() + HandshakeTimeout;
+
+            // Its channel is taken once the socket turns readable, a silent client must not stall the
+            // loop in the meantime
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = (worker->Key << EventSourceBits) | ControlSocket;
+            if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, workerSocket, &event) == 0)
+            {
+                m_handshakes[worker->Key] = std::move(worker);
+            }
+        }
+    }
+
+    void TransportBroker::Handshake(uint64_t key)
+    {
+        auto found = m_handshakes.find(key);
+        auto worker = std::move(found->second);
+        m_handshakes.erase(found);
+
+        try
+        {
+            worker->Channel = _detail::BrokerChannel::Open(_detail::ReceiveDescriptors(worker->Socket, _detail::BrokerChannelDescriptors));
+            worker->Assembler = _detail::MessageAssembler(MaxBufferedRings * worker->Channel->GetRequests().GetCapacity());
+            char const acknowledgement = 1;
+            if (send(worker->Socket, &acknowledgement, sizeof(acknowledgement), MSG_NOSIGNAL) != sizeof(acknowledgement))
+            {
+                return;
+            }
+
+            // The socket is already in the epoll set, with the same key
+            auto const sources = {
+                std::make_pair(worker->Channel->GetRequests().GetReadableFd(), RequestsReadable),
+                std::make_pair(worker->Channel->GetResponses().GetWritableFd(), ResponsesWritable)};
+            for (auto const &source : sources)
+            {
+                struct epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.u64 = (key << EventSourceBits) | source.second;
+                epoll_ctl(m_epollFd, EPOLL_CTL_ADD, source.first, &event);
+            }
+            m_workers[key] = worker;
+            m_workerCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        catch (std::exception const &)
+        {
+            // Not a worker, or one that gave up; closing the socket takes it out of the epoll set
+        }
+    }
+
+    void TransportBroker::ExpireHandshakes()
+    {
+        auto const now = std::chrono::steady_clock::now();
+        for (auto it = m_handshakes.begin(); it != m_handshakes.end();)
+        {
+            if (it->second->HandshakeDeadline <= now)
+            {
+                it = m_handshakes.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    void TransportBroker::Drop(uint64_t key)
+    {
+        auto found = m_workers.find(key);
+        if (found == m_workers.end())
+        {
+            return;
+        }
+        // The eventfds stay open in the worker, which would keep them in the epoll set
+        auto &worker = *found->second;
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, worker.Socket, nullptr);
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, worker.Channel->GetRequests().GetReadableFd(), nullptr);
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, worker.Channel->GetResponses().GetWritableFd(), nullptr);
+        // Completions in flight keep the worker alive, the shutdown tells it now that it was dropped
+        shutdown(worker.Socket, SHUT_RDWR);
+        m_workers.erase(found);
+        m_workerCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void TransportBroker::Serve(std::shared_ptr<_detail::BrokerWorker> const &worker)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->Mutex);
+            for (auto &completed : worker->Completed)
+            {
+                worker->Outgoing.push_back(std::move(completed));
+            }
+            worker->Completed.clear();
+        }
+
+        auto &requests = worker->Channel->GetRequests();
+        std::vector<uint8_t> record;
+        std::vector<uint8_t> message;
+        do
+        {
+            while (requests.TryRead(record))
+            {
+                uint64_t id;
+                BrokerMessageKind kind;
+                if (worker->Assembler.Add(record, id, kind, message))
+                {
+                    Dispatch(worker, id, message);
+                }
+            }
+        } while (!requests.ArmReadable());
+
+        auto &responses = worker->Channel->GetResponses();
+        while (!worker->Outgoing.empty())
+        {
+            if (_detail::WriteMessage(responses, worker->Outgoing.front()))
+            {
+                worker->Outgoing.pop_front();
+            }
+            else if (responses.ArmWritable(_detail::GetMessageRecordSize(responses)))
+            {
+                break;
+            }
+        }
+    }
+
+    void TransportBroker::Dispatch(std::shared_ptr<_detail::BrokerWorker> const &worker, uint64_t id, std::vector<uint8_t> const &message)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_running;
+        }
+
+        try
+        {
+            MessageReader reader(message);
+            auto const method = reader.GetString();
+            auto const url = reader.GetString();
+            // Read one by one: the count comes from worker memory, and each header must be in the message
+            std::vector<std::pair<std::string, std::string>> headers;
+            auto const headerCount = reader.GetInteger();
+            for (uint64_t i = 0; i < headerCount; ++i)
+            {
+                auto name = reader.GetString();
+                headers.emplace_back(std::move(name), reader.GetString());
+            }
+            auto const remaining = reader.GetInteger();
+            auto request = std::make_shared<_detail::BrokeredRequest>(method, url, reader.GetBytes());
+            for (auto const &header : headers)
+            {
+                request->Request.SetHeader(header.first, header.second);
+            }
+
+            auto const context = remaining == NoDeadline
+                                     ? Context()
+                                     : Context().WithDeadline(Azure::DateTime(std::chrono::system_clock::now() + std::chrono::milliseconds(remaining)));
+            m_transport->Submit(
+                request->Request, [this, worker, id, request](SendManyResult result)
+                { Complete(worker, id, std::move(result)); },
+                context);
+        }
+        catch (...)
+        {
+            SendManyResult result;
+            result.Error = std::current_exception();
+            Complete(worker, id, std::move(result));
+        }
+    }
+
+    void TransportBroker::Complete(std::shared_ptr<_detail::BrokerWorker> const &worker, uint64_t id, SendManyResult result)
+    {
+        _detail::OutgoingMessage outgoing;
+        outgoing.Id = id;
+        try
+        {
+            if (result.Error)
+            {
+                std::rethrow_exception(result.Error);
+            }
+
+            auto &response = *result.Response;
+            MessageWriter writer;
+            writer.PutInteger(static_cast<uint64_t>(response.GetStatusCode()));
+            writer.PutString(response.GetReasonPhrase());
+            auto const &headers = response.GetHeaders();
+            writer.PutInteger(headers.size());
+            for (auto const &header : headers)
+            {
+                writer.PutString(header.first);
+                writer.PutString(header.second);
+            }
+            std::vector<uint8_t> body;
+            if (auto bodyStream = response.ExtractBodyStream())
+            {
+                body = bodyStream->ReadToEnd(Context());
+            }
+            writer.PutBytes(body.data(), body.size());
+            outgoing.Kind = BrokerMessageKind::Response;
+            outgoing.Data = writer.Take();
+        }
+        catch (std::exception const &error)
+        {
+            outgoing.Kind = BrokerMessageKind::Error;
+            outgoing.Data = EncodeError(error.what());
+        }
+        catch (...)
+        {
+            outgoing.Kind = BrokerMessageKind::Error;
+            outgoing.Data = EncodeError("Unknown error in the transport broker");
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(worker->Mutex);
+            worker->Completed.push_back(std::move(outgoing));
+        }
+        Signal(m_wakeupFd);
+
+        // Last, the destructor returns as soon as it sees no request running
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_running;
+        m_idle.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * Transport that forwards requests over shared memory to a broker process owning the connections
+ */
+
+#pragma once
+
+#include "my_transport.hpp"
+
+#include <azure/core/http/transport.hpp>
+
+// The shared memory channel is built on memfd and eventfd
+#if defined(__linux__)
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        class BrokerChannel;
+        struct BrokeredRequest;
+        struct BrokerWorker;
+    }
+
+    /**
+     * Options to tune the behavior of #BrokerTransport
+     */
+    struct BrokerTransportOptions
+    {
+        /**
+         * Unix socket the TransportBroker listens on; a path starting with `@` names a socket in
+         * Linux's abstract namespace.
+         */
+        std::string BrokerPath;
+
+        /**
+         * Bytes of shared memory for each direction. Messages larger than a quarter of it are split.
+         * The broker buffers at most 16 times this of a worker's unfinished requests, so larger
+         * requests, body included, fail without being sent; responses are not limited.
+         */
+        size_t RingSize = 4 * 1024 * 1024;
+    };
+
+    /**
+     * Sends requests through a TransportBroker in another process instead of opening connections.
+     * Meant for prefork servers: every worker process gets its own BrokerTransport, after forking,
+     * and the broker keeps one set of connection pools and TLS sessions for all of them.
+     *
+     * Requests and responses, bodies included, are copied through a pair of rings in memory shared
+     * with the broker and signalled with eventfds, so a worker does no socket or TLS work. Bodies are
+     * buffered whole on both sides, like MyTransport's own responses.
+     *
+     * Only the request's deadline travels with it; priority, tenant and timing set on the context are
+     * not forwarded. A cancelled request stops being waited for, but the broker still completes it.
+     */
+    class BrokerTransport final : public Azure::Core::Http::HttpTransport
+    {
+    public:
+        /**
+         * Connects to the broker. Throws when it cannot be reached.
+         */
+        explicit BrokerTransport(BrokerTransportOptions const &options);
+        ~BrokerTransport() override;
+
+        BrokerTransport(BrokerTransport const &) = delete;
+        BrokerTransport &operator=(BrokerTransport const &) = delete;
+
+        std::unique_ptr<Azure::Core::Http::RawResponse> Send(Azure::Core::Http::Request &request, Azure::Core::Context const &context) override;
+
+    private:
+        struct Pending;
+
+        int m_socket = -1;
+        int m_stopFd = -1;
+        std::unique_ptr<_detail::BrokerChannel> m_channel;
+        std::atomic<uint64_t> m_nextId{0};
+        // Serializes writers of the request ring
+        std::mutex m_writeMutex;
+        std::mutex m_mutex;
+        std::unordered_map<uint64_t, std::shared_ptr<Pending>> m_pending;
+        // Set, under m_mutex, once the broker went away
+        bool m_disconnected = false;
+        std::thread m_reader;
+
+        void ReadResponses();
+        void Write(uint64_t id, std::vector<uint8_t> message, Azure::Core::Context const &context);
+        void Disconnect();
+    };
+
+    /**
+     * Serves BrokerTransport workers from the current process, running their requests on @p transport
+     * through MyTransport::Submit. The broker's own thread only moves messages between the rings and
+     * the transport's event loops.
+     *
+     * A worker that exits or corrupts its channel is dropped; its outstanding requests still run to
+     * completion and their responses are discarded.
+     */
+    class TransportBroker final
+    {
+    public:
+        /**
+         * Listens on @p path, removing a stale socket file first. Throws when it cannot.
+         */
+        TransportBroker(std::string path, std::shared_ptr<MyTransport> transport);
+
+        /**
+         * Stops accepting and serving workers and waits for the requests still running.
+         */
+        ~TransportBroker();
+
+        TransportBroker(TransportBroker const &) = delete;
+        TransportBroker &operator=(TransportBroker const &) = delete;
+
+        /**
+         * Number of workers currently connected.
+         */
+        size_t GetWorkerCount() const { return m_workerCount.load(std::memory_order_relaxed); }
+
+    private:
+        std::string m_path;
+        std::shared_ptr<MyTransport> m_transport;
+        int m_listenSocket = -1;
+        int m_epollFd = -1;
+        int m_wakeupFd = -1;
+        std::atomic<bool> m_stop{false};
+        std::atomic<size_t> m_workerCount{0};
+        // Loop thread only
+        std::unordered_map<uint64_t, std::shared_ptr<_detail::BrokerWorker>> m_workers;
+        // Accepted connections whose channel has not arrived yet
+        std::unordered_map<uint64_t, std::shared_ptr<_detail::BrokerWorker>> m_handshakes;
+        uint64_t m_nextWorker = 0;
+
+        // Requests handed to the transport whose completion has not run yet
+        std::mutex m_mutex;
+        std::condition_variable m_idle;
+        size_t m_running = 0;
+
+        std::thread m_loopThread;
+
+        void Run();
+        void Accept();
+        void Handshake(uint64_t key);
+        void ExpireHandshakes();
+        void Serve(std::shared_ptr<_detail::BrokerWorker> const &worker);
+        void Dispatch(std::shared_ptr<_detail::BrokerWorker> const &worker, uint64_t id, std::vector<uint8_t> const &message);
+        void Complete(std::shared_ptr<_detail::BrokerWorker> const &worker, uint64_t id, SendManyResult result);
+        void Drop(uint64_t key);
+        void Close();
+    };
+}
+
+#endif
@@ -0,0 +1,277 @@
+#include "ca_store.hpp"
+
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#endif
+
+namespace
+{
+    // Well-known locations of the system CA bundle, in the same order libcurl probes them at build time.
+    char const *const WellKnownBundlePaths[] = {
+        "/etc/ssl/certs/ca-certificates.crt",
+        "/etc/pki/tls/certs/ca-bundle.crt",
+        "/usr/share/ssl/certs/ca-bundle.crt",
+        "/usr/local/share/certs/ca-root-nss.crt",
+        "/etc/ssl/cert.pem",
+    };
+
+    bool GetFileStamp(std::string const &path, int64_t &modified, int64_t &size)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+        {
+            return false;
+        }
+        modified = static_cast<int64_t>(info.st_mtime);
+        size = static_cast<int64_t>(info.st_size);
+        return true;
+    }
+
+    std::string ResolveBundlePath(std::string const &path)
+    {
+        if (!path.empty())
+        {
+            return path;
+        }
+
+        auto const fromEnv = std::getenv("SSL_CERT_FILE");
+        if (fromEnv != nullptr && *fromEnv != '\0')
+        {
+            return fromEnv;
+        }
+
+        int64_t modified, size;
+        for (auto const candidate : WellKnownBundlePaths)
+        {
+            if (GetFileStamp(candidate, modified, size))
+            {
+                return candidate;
+            }
+        }
+        return std::string();
+    }
+
+    // The parsed store can only be handed to libcurl when both sides agree on what an SSL_CTX is.
+    bool IsOpenSslBackend()
+    {
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+        static bool const isOpenSsl = []()
+        {
+            auto const info = curl_version_info(CURLVERSION_NOW);
+            return info != nullptr && info->ssl_version != nullptr && std::strstr(info->ssl_version, "OpenSSL") != nullptr;
+        }();
+        return isOpenSsl;
+#else
+        return false;
+#endif
+    }
+
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+    CURLcode InstallSharedStore(CURL *, void *sslContext, void *userp)
+    {
+        auto store = static_cast<X509_STORE *>(static_cast<MyNameSpace::_detail::CaBundle const *>(userp)->GetX509Store());
+        // SSL_CTX_set_cert_store takes ownership of one reference and frees the store libcurl created
+        X509_STORE_up_ref(store);
+        SSL_CTX_set_cert_store(static_cast<SSL_CTX *>(sslContext), store);
+        return CURLE_OK;
+    }
+#endif
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        CaBundle::CaBundle(std::string path, std::string pem) : m_path(std::move(path)), m_pem(std::move(pem))
+        {
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+            if (!IsOpenSslBackend())
+            {
+                return;
+            }
+
+            auto store = X509_STORE_new();
+            auto bio = BIO_new_mem_buf(m_pem.data(), static_cast<int>(m_pem.size()));
+            if (store == nullptr || bio == nullptr)
+            {
+                X509_STORE_free(store);
+                BIO_free(bio);
+                throw std::runtime_error("Could not allocate the shared CA store");
+            }
+
+            size_t loaded = 0;
+            while (auto certificate = PEM_read_bio_X509_AUX(bio, nullptr, nullptr, nullptr))
+            {
+                if (X509_STORE_add_cert(store, certificate) == 1)
+                {
+                    ++loaded;
+                }
+                X509_free(certificate);
+            }
+            // Reaching the end of the bundle leaves a "no start line" error behind
+            ERR_clear_error();
+            BIO_free(bio);
+
+            if (loaded == 0)
+            {
+                X509_STORE_free(store);
+                throw std::runtime_error("No certificates found in CA bundle " + m_path);
+            }
+            m_x509Store = store;
+#endif
+        }
+
+        CaBundle::~CaBundle()
+        {
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+            X509_STORE_free(static_cast<X509_STORE *>(m_x509Store));
+#endif
+        }
+
+        std::shared_ptr<CaStore> CaStore::GetInstance(
+            std::string const &path,
+            std::chrono::seconds refreshInterval)
+        {
+            auto const resolvedPath = ResolveBundlePath(path);
+            if (resolvedPath.empty())
+            {
+                return nullptr;
+            }
+
+            // Transports asking for another refresh interval get a store of their own
+            static std::mutex instancesMutex;
+            static std::map<std::pair<std::string, std::chrono::seconds::rep>, std::weak_ptr<CaStore>> instances;
+
+            std::lock_guard<std::mutex> lock(instancesMutex);
+            auto &entry = instances[std::make_pair(resolvedPath, refreshInterval.count())];
+            auto instance = entry.lock();
+            if (!instance)
+            {
+                instance = std::make_shared<CaStore>(resolvedPath, refreshInterval);
+                entry = instance;
+            }
+            return instance;
+        }
+
+        CaStore::CaStore(std::string path, std::chrono::seconds refreshInterval)
+            : m_path(std::move(path)), m_refreshInterval(refreshInterval)
+        {
+            if (!Reload())
+            {
+                throw std::runtime_error("Could not load CA bundle " + m_path);
+            }
+
+            m_refreshTask = std::make_unique<PeriodicTask>(m_refreshInterval, [this]()
+                                                           { RefreshIfChanged(); });
+        }
+
+        CaStore::~CaStore() { m_refreshTask->Stop(); }
+
+        std::shared_ptr<CaBundle const> CaStore::GetBundle() const
+        {
+            std::lock_guard<std::mutex> lock(m_bundleMutex);
+            return m_bundle;
+        }
+
+        bool CaStore::Reload()
+        {
+            int64_t modified, size;
+            if (!GetFileStamp(m_path, modified, size))
+            {
+                return false;
+            }
+
+            std::ifstream file(m_path, std::ios::binary);
+            if (!file)
+            {
+                return false;
+            }
+            std::ostringstream content;
+            content << file.rdbuf();
+
+            // Parse outside of the lock; handles keep using the previous snapshot meanwhile
+            auto bundle = std::make_shared<CaBundle const>(m_path, content.str());
+
+            std::lock_guard<std::mutex> lock(m_bundleMutex);
+            m_bundle = std::move(bundle);
+            m_lastModified = modified;
+            m_lastSize = size;
+            return true;
+        }
+
+        void CaStore::RefreshIfChanged()
+        {
+            int64_t modified, size;
+            if (!GetFileStamp(m_path, modified, size))
+            {
+                // The bundle is being replaced; keep serving the last good snapshot
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_bundleMutex);
+                if (modified == m_lastModified && size == m_lastSize)
+                {
+                    return;
+                }
+            }
+
+            // A half-written bundle fails to parse and throws; the next tick tries again
+            Reload();
+        }
+
+        void CaStore::ApplyTo(CURL *handle, CaBundle const &bundle)
+        {
+            CURLcode operationResult;
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+            if (bundle.GetX509Store() != nullptr)
+            {
+                // Stop libcurl from parsing the default bundle; the callback installs the shared store
+                operationResult = curl_easy_setopt(handle, CURLOPT_SSL_CTX_FUNCTION, InstallSharedStore);
+                if (operationResult == CURLE_OK)
+                {
+                    operationResult = curl_easy_setopt(handle, CURLOPT_SSL_CTX_DATA, const_cast<CaBundle *>(&bundle));
+                    if (operationResult != CURLE_OK)
+                    {
+                        throw std::runtime_error("Could not set CURLOPT_SSL_CTX_DATA for libcurl");
+                    }
+                    curl_easy_setopt(handle, CURLOPT_CAINFO, nullptr);
+                    curl_easy_setopt(handle, CURLOPT_CAPATH, nullptr);
+                    return;
+                }
+            }
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x074d00
+            struct curl_blob blob;
+            blob.data = const_cast<char *>(bundle.GetPem().data());
+            blob.len = bundle.GetPem().size();
+            blob.flags = CURL_BLOB_NOCOPY;
+            operationResult = curl_easy_setopt(handle, CURLOPT_CAINFO_BLOB, &blob);
+            if (operationResult == CURLE_OK)
+            {
+                return;
+            }
+#endif
+            // Backend without blob support, fall back to pointing libcurl at the same file
+            operationResult = curl_easy_setopt(handle, CURLOPT_CAINFO, bundle.GetPath().c_str());
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set CURLOPT_CAINFO for libcurl");
+            }
+        }
+    }
+}
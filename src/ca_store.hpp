@@ -0,0 +1,97 @@
+/**
+ * Process-wide CA bundle shared by every libcurl handle created by the transport
+ */
+
+#pragma once
+
+#include <curl/curl.h>
+
+#include "periodic_task.hpp"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * An immutable, already parsed snapshot of the CA bundle.
+         *
+         * Handles keep the snapshot they were configured with alive for their whole lifetime, so a
+         * background refresh never invalidates a certificate store that a connection is still using.
+         */
+        class CaBundle final
+        {
+        public:
+            CaBundle(std::string path, std::string pem);
+            ~CaBundle();
+
+            CaBundle(CaBundle const &) = delete;
+            CaBundle &operator=(CaBundle const &) = delete;
+
+            std::string const &GetPath() const { return m_path; }
+            std::string const &GetPem() const { return m_pem; }
+
+            // Parsed `X509_STORE *` when libcurl runs on top of OpenSSL, null otherwise.
+            void *GetX509Store() const { return m_x509Store; }
+
+        private:
+            std::string m_path;
+            std::string m_pem;
+            void *m_x509Store = nullptr;
+        };
+
+        /**
+         * Loads the CA bundle once per process and hands the same parsed snapshot to every handle.
+         *
+         * With OpenSSL the parsed `X509_STORE` is installed through `CURLOPT_SSL_CTX_FUNCTION`, so new
+         * TLS connections skip certificate parsing entirely. Other TLS backends get the in-memory PEM
+         * through `CURLOPT_CAINFO_BLOB`, which at least avoids touching the file system per handle.
+         * A background thread reloads the bundle when the file changes on disk.
+         */
+        class CaStore final
+        {
+        public:
+            /**
+             * Returns the store for @p path and @p refreshInterval, creating it on first use, so
+             * transports only share a store when they refresh it equally often. An empty path selects
+             * the first well-known system bundle. Returns null when no bundle can be found, in which case
+             * libcurl defaults are used.
+             */
+            static std::shared_ptr<CaStore> GetInstance(
+                std::string const &path,
+                std::chrono::seconds refreshInterval);
+
+            CaStore(std::string path, std::chrono::seconds refreshInterval);
+            ~CaStore();
+
+            CaStore(CaStore const &) = delete;
+            CaStore &operator=(CaStore const &) = delete;
+
+            std::shared_ptr<CaBundle const> GetBundle() const;
+
+            /**
+             * Configures @p handle to trust @p bundle. The caller must keep @p bundle alive for as long
+             * as the handle can open new connections.
+             */
+            static void ApplyTo(CURL *handle, CaBundle const &bundle);
+
+        private:
+            std::string m_path;
+            std::chrono::seconds m_refreshInterval;
+
+            mutable std::mutex m_bundleMutex;
+            std::shared_ptr<CaBundle const> m_bundle;
+            int64_t m_lastModified = 0;
+            int64_t m_lastSize = 0;
+
+            std::unique_ptr<PeriodicTask> m_refreshTask;
+
+            bool Reload();
+            void RefreshIfChanged();
+        };
+    }
+}
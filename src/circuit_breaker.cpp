@@ -0,0 +1,151 @@
+#include "circuit_breaker.hpp"
+
+#include <algorithm>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        CircuitBreaker::CircuitBreaker(
+            CircuitBreakerOptions const &options,
+            std::shared_ptr<MetricsRegistry> metrics)
+            : m_options(options), m_metrics(std::move(metrics))
+        {
+        }
+
+        CircuitBreaker::HostState &CircuitBreaker::GetHostState(std::string const &host)
+        {
+            auto found = m_hosts.find(host);
+            if (found != m_hosts.end())
+            {
+                return found->second;
+            }
+
+            auto const labels = MetricsRegistry::Label("host", host);
+            HostState state;
+            state.WindowStart = std::chrono::steady_clock::now();
+            state.StateGauge = &m_metrics->GetGauge("circuit_state", labels);
+            state.Trips = &m_metrics->GetCounter("circuit_trips_total", labels);
+            state.Rejected = &m_metrics->GetCounter("circuit_rejected_total", labels);
+            return m_hosts.emplace(host, std::move(state)).first->second;
+        }
+
+        bool CircuitBreaker::Allow(std::string const &host, uint64_t &probe)
+        {
+            probe = 0;
+            if (m_options.ConsecutiveFailureThreshold == 0)
+            {
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &state = GetHostState(host);
+            if (state.Current == State::Open && std::chrono::steady_clock::now() >= state.OpenUntil)
+            {
+                ++state.HalfOpenPeriod;
+                SetState(state, State::HalfOpen);
+            }
+
+            switch (state.Current)
+            {
+            case State::Closed:
+                return true;
+            case State::HalfOpen:
+                if (state.ProbesInFlight < m_options.HalfOpenProbes)
+                {
+                    ++state.ProbesInFlight;
+                    probe = state.HalfOpenPeriod;
+                    return true;
+                }
+                break;
+            case State::Open:
+                break;
+            }
+            state.Rejected->Add();
+            return false;
+        }
+
+        void CircuitBreaker::OnResult(std::string const &host, uint64_t probe, Outcome outcome)
+        {
+            if (m_options.ConsecutiveFailureThreshold == 0)
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &state = GetHostState(host);
+
+            if (state.Current == State::HalfOpen)
+            {
+                // Stragglers from before the circuit opened, or probes of an earlier period
+                if (probe != state.HalfOpenPeriod)
+                {
+                    return;
+                }
+                state.ProbesInFlight -= std::min<size_t>(state.ProbesInFlight, 1);
+                if (outcome == Outcome::Success)
+                {
+                    state.ConsecutiveFailures = 0;
+                    state.WindowRequests = state.WindowFailures = 0;
+                    state.WindowStart = std::chrono::steady_clock::now();
+                    state.OpenDuration = std::chrono::milliseconds(0);
+                    SetState(state, State::Closed);
+                }
+                else if (outcome != Outcome::Ignored)
+                {
+                    Open(state, std::min(state.OpenDuration * 2, m_options.MaxOpenDuration));
+                }
+                return;
+            }
+
+            // Results of requests let through before the circuit opened, and of stale probes
+            if (state.Current == State::Open || probe != 0 || outcome == Outcome::Ignored)
+            {
+                return;
+            }
+
+            auto const now = std::chrono::steady_clock::now();
+            if (now - state.WindowStart >= m_options.ErrorRateWindow)
+            {
+                state.WindowRequests = state.WindowFailures = 0;
+                state.WindowStart = now;
+            }
+            ++state.WindowRequests;
+
+            if (outcome == Outcome::Success)
+            {
+                state.ConsecutiveFailures = 0;
+                return;
+            }
+
+            ++state.WindowFailures;
+            if (outcome == Outcome::ConnectFailure)
+            {
+                ++state.ConsecutiveFailures;
+            }
+
+            auto const tooManyConsecutive = state.ConsecutiveFailures >= m_options.ConsecutiveFailureThreshold;
+            auto const errorRateTooHigh = state.WindowRequests >= m_options.MinRequests &&
+                                          static_cast<double>(state.WindowFailures) >= m_options.ErrorRateThreshold * static_cast<double>(state.WindowRequests);
+            if (tooManyConsecutive || errorRateTooHigh)
+            {
+                Open(state, m_options.OpenDuration);
+            }
+        }
+
+        void CircuitBreaker::Open(HostState &state, std::chrono::milliseconds duration)
+        {
+            state.OpenDuration = duration;
+            state.OpenUntil = std::chrono::steady_clock::now() + duration;
+            state.ProbesInFlight = 0;
+            state.Trips->Add();
+            SetState(state, State::Open);
+        }
+
+        void CircuitBreaker::SetState(HostState &state, State next)
+        {
+            state.Current = next;
+            state.StateGauge->Set(static_cast<int64_t>(next));
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/**
+ * Per-host circuit breaker that fails requests fast while a host is unreachable
+ */
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct CircuitBreakerOptions
+        {
+            // Consecutive connection failures that open the circuit, zero disables the breaker
+            size_t ConsecutiveFailureThreshold = 5;
+            // Failure ratio over ErrorRateWindow that opens the circuit once MinRequests were seen
+            double ErrorRateThreshold = 0.5;
+            size_t MinRequests = 20;
+            std::chrono::milliseconds ErrorRateWindow{10000};
+            // How long the circuit stays open before probing; doubles with every failed probe
+            std::chrono::milliseconds OpenDuration{5000};
+            std::chrono::milliseconds MaxOpenDuration{60000};
+            // Requests let through at once while half open
+            size_t HalfOpenProbes = 1;
+        };
+
+        /**
+         * Closed, the breaker only counts outcomes. Too many consecutive connection failures, or too
+         * high a transport error rate, open it: requests to the host then fail immediately instead of
+         * each waiting out a connect timeout. Once the open period has passed the breaker is half open
+         * and lets a few probe requests through. A successful probe closes it, a failed one reopens it
+         * for twice as long. Only the probes of the current half-open period decide; requests that were
+         * already in flight when the circuit opened no longer count.
+         *
+         * Only transport failures count. Any HTTP response, including a 5xx, proves the host is
+         * reachable, and throttling is left to the ThrottlePacer.
+         */
+        class CircuitBreaker final
+        {
+        public:
+            enum class Outcome
+            {
+                Success,
+                Failure,
+                ConnectFailure,
+                // Cancelled or never sent; frees a probe slot without judging the host
+                Ignored,
+            };
+
+            CircuitBreaker(CircuitBreakerOptions const &options, std::shared_ptr<MetricsRegistry> metrics);
+
+            /**
+             * Whether a request to @p host may be sent. Every allowed request must be followed by
+             * exactly one OnResult, passing back the @p probe this sets: nonzero when the request is a
+             * half-open probe.
+             */
+            bool Allow(std::string const &host, uint64_t &probe);
+
+            void OnResult(std::string const &host, uint64_t probe, Outcome outcome);
+
+        private:
+            enum class State
+            {
+                Closed = 0,
+                Open = 1,
+                HalfOpen = 2,
+            };
+
+            struct HostState
+            {
+                State Current = State::Closed;
+                size_t ConsecutiveFailures = 0;
+                size_t WindowRequests = 0;
+                size_t WindowFailures = 0;
+                std::chrono::steady_clock::time_point WindowStart;
+                std::chrono::steady_clock::time_point OpenUntil;
+                std::chrono::milliseconds OpenDuration{0};
+                size_t ProbesInFlight = 0;
+                // Numbers the half-open periods, so probes of an earlier one are told apart
+                uint64_t HalfOpenPeriod = 0;
+                Gauge *StateGauge;
+                Counter *Trips;
+                Counter *Rejected;
+            };
+
+            CircuitBreakerOptions m_options;
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            std::mutex m_mutex;
+            std::unordered_map<std::string, HostState> m_hosts;
+
+            HostState &GetHostState(std::string const &host);
+            void Open(HostState &state, std::chrono::milliseconds duration);
+            void SetState(HostState &state, State next);
+        };
+    }
+}
@@ -0,0 +1,138 @@
+#include "completion_executor.hpp"
+
+#include "transport_threads.hpp"
+
+#include <algorithm>
+#include <exception>
+
+namespace
+{
+    // Lets a task posted from a worker land on that worker's own deque
+    thread_local MyNameSpace::_detail::CompletionExecutor const *CurrentExecutor = nullptr;
+    thread_local size_t CurrentWorker = 0;
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        CompletionExecutor::CompletionExecutor(size_t threads, std::shared_ptr<MetricsRegistry> const &metrics)
+            : m_queued(metrics->GetGauge("completion_queue_depth")),
+              m_steals(metrics->GetCounter("completion_steals_total"))
+        {
+            threads = std::max<size_t>(threads, 1);
+            m_workers.reserve(threads);
+            for (size_t i = 0; i < threads; ++i)
+            {
+                m_workers.push_back(std::make_unique<Worker>());
+            }
+            // Started once every deque exists, workers steal from all of them
+            for (size_t i = 0; i < threads; ++i)
+            {
+                m_workers[i]->Thread = std::thread(&CompletionExecutor::Run, this, i);
+            }
+        }
+
+        CompletionExecutor::~CompletionExecutor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_idleMutex);
+                m_stop = true;
+            }
+            m_idle.notify_all();
+            for (auto &worker : m_workers)
+            {
+                worker->Thread.join();
+            }
+        }
+
+        void CompletionExecutor::Post(std::function<void()> task)
+        {
+            auto const index = CurrentExecutor == this
+                ? CurrentWorker
+                : m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+            {
+                auto &worker = *m_workers[index];
+                std::lock_guard<std::mutex> lock(worker.Mutex);
+                worker.Tasks.push_back(std::move(task));
+                // Pairs with the sleeping count a worker raises before checking for work, so either
+                // it sees this task or this sees it asleep
+                m_pending.fetch_add(1);
+            }
+            m_queued.Add(1);
+
+            if (m_sleeping.load() > 0)
+            {
+                std::lock_guard<std::mutex> lock(m_idleMutex);
+                m_idle.notify_one();
+            }
+        }
+
+        bool CompletionExecutor::TryTake(size_t index, std::function<void()> &task)
+        {
+            {
+                auto &own = *m_workers[index];
+                std::lock_guard<std::mutex> lock(own.Mutex);
+                if (!own.Tasks.empty())
+                {
+                    task = std::move(own.Tasks.back());
+                    own.Tasks.pop_back();
+                    m_pending.fetch_sub(1);
+                    return true;
+                }
+            }
+
+            for (size_t offset = 1; offset < m_workers.size(); ++offset)
+            {
+                auto &victim = *m_workers[(index + offset) % m_workers.size()];
+                std::lock_guard<std::mutex> lock(victim.Mutex);
+                if (!victim.Tasks.empty())
+                {
+                    // The oldest task, the one its owner would run last
+                    task = std::move(victim.Tasks.front());
+                    victim.Tasks.pop_front();
+                    m_pending.fetch_sub(1);
+                    m_steals.Add();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void CompletionExecutor::Run(size_t index)
+        {
+            CurrentExecutor = this;
+            CurrentWorker = index;
+            IsTransportThread() = true;
+
+            std::function<void()> task;
+            while (true)
+            {
+                if (TryTake(index, task))
+                {
+                    m_queued.Add(-1);
+                    try
+                    {
+                        task();
+                    }
+                    catch (std::exception const &)
+                    {
+                    }
+                    task = nullptr;
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(m_idleMutex);
+                m_sleeping.fetch_add(1);
+                // Queued tasks still run on shutdown, their callers are waiting on them
+                m_idle.wait(lock, [this]()
+                            { return m_pending.load() > 0 || m_stop; });
+                m_sleeping.fetch_sub(1);
+                if (m_stop && m_pending.load() == 0)
+                {
+                    return;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * Work-stealing thread pool that runs transfer completion callbacks off the event loops
+ */
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Every worker owns a deque. Tasks posted from a worker go to the back of its own deque and it
+         * takes them back LIFO, while they are still in cache. Tasks posted from elsewhere, the loop
+         * threads, are dealt round-robin. A worker with an empty deque steals from the front of the
+         * others' before going to sleep, so one slow callback never holds up the ones behind it.
+         *
+         * Each deque has its own mutex, only contended when a worker is being stolen from.
+         */
+        class CompletionExecutor final
+        {
+        public:
+            CompletionExecutor(size_t threads, std::shared_ptr<MetricsRegistry> const &metrics);
+
+            /**
+             * Runs the tasks still queued, then joins the workers.
+             */
+            ~CompletionExecutor();
+
+            CompletionExecutor(CompletionExecutor const &) = delete;
+            CompletionExecutor &operator=(CompletionExecutor const &) = delete;
+
+            /**
+             * Queues @p task to run on a worker. Exceptions thrown by the task are swallowed.
+             */
+            void Post(std::function<void()> task);
+
+        private:
+            struct Worker
+            {
+                std::mutex Mutex;
+                std::deque<std::function<void()>> Tasks;
+                std::thread Thread;
+            };
+
+            std::vector<std::unique_ptr<Worker>> m_workers;
+            std::atomic<size_t> m_nextWorker{0};
+            // Posted and not yet taken by a worker
+            std::atomic<size_t> m_pending{0};
+            std::atomic<size_t> m_sleeping{0};
+            std::atomic<bool> m_stop{false};
+            std::mutex m_idleMutex;
+            std::condition_variable m_idle;
+
+            Gauge &m_queued;
+            Counter &m_steals;
+
+            void Run(size_t index);
+            bool TryTake(size_t index, std::function<void()> &task);
+        };
+    }
+}
@@ -0,0 +1,71 @@
+#include "concurrency_limiter.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // Weight of a new sample in the smoothed latency
+    constexpr static const double SmoothingFactor = 0.1;
+
+    // How long a minimum latency keeps counting as the baseline
+    constexpr static const std::chrono::seconds BaselineWindow(10);
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        ConcurrencyLimiter::ConcurrencyLimiter(ConcurrencyLimiterOptions const &options)
+            : m_options(options), m_limit(static_cast<double>(options.InitialLimit))
+        {
+            Clamp();
+        }
+
+        void ConcurrencyLimiter::OnSample(std::chrono::microseconds latency, bool overloaded, size_t inFlight)
+        {
+            auto const now = std::chrono::steady_clock::now();
+            auto const sampleUs = static_cast<double>(std::max<std::chrono::microseconds::rep>(latency.count(), 1));
+            m_smoothedUs = m_smoothedUs == 0 ? sampleUs : m_smoothedUs + (sampleUs - m_smoothedUs) * SmoothingFactor;
+
+            if (now - m_windowStart >= BaselineWindow)
+            {
+                m_previousWindowMinUs = m_windowMinUs;
+                m_windowMinUs = 0;
+                m_windowStart = now;
+            }
+            if (m_windowMinUs == 0 || sampleUs < m_windowMinUs)
+            {
+                m_windowMinUs = sampleUs;
+            }
+
+            if (overloaded || m_smoothedUs > GetBaselineUs() * m_options.LatencyTolerance)
+            {
+                // Responses to requests sent before the last decrease still carry the old load
+                if (now - m_lastDecrease >= std::chrono::microseconds(static_cast<int64_t>(m_smoothedUs)))
+                {
+                    m_limit *= m_options.Backoff;
+                    m_lastDecrease = now;
+                }
+            }
+            else if (static_cast<double>(inFlight) * 2 >= m_limit)
+            {
+                m_limit += 1 / m_limit;
+            }
+            Clamp();
+        }
+
+        double ConcurrencyLimiter::GetBaselineUs() const
+        {
+            return m_previousWindowMinUs == 0 ? m_windowMinUs : std::min(m_windowMinUs, m_previousWindowMinUs);
+        }
+
+        void ConcurrencyLimiter::Clamp()
+        {
+            m_limit = std::max(m_limit, static_cast<double>(std::max<size_t>(m_options.MinLimit, 1)));
+            if (m_options.MaxLimit != 0)
+            {
+                m_limit = std::min(m_limit, static_cast<double>(m_options.MaxLimit));
+            }
+        }
+    }
+}
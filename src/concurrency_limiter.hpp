@@ -0,0 +1,63 @@
+/**
+ * AIMD concurrency limit that follows the latency a host is able to sustain
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct ConcurrencyLimiterOptions
+        {
+            size_t InitialLimit = 16;
+            size_t MinLimit = 1;
+            // Zero means no upper bound
+            size_t MaxLimit = 0;
+            // Latency above this multiple of the baseline counts as congestion
+            double LatencyTolerance = 2.0;
+            // Factor the limit is multiplied by on congestion
+            double Backoff = 0.7;
+        };
+
+        /**
+         * Additive increase, multiplicative decrease over observed request latency.
+         *
+         * The baseline is the lowest latency seen over the current and the previous window, so a lasting
+         * change of the route or of the service becomes the new normal within two windows. While
+         * smoothed latency stays within LatencyTolerance of the baseline and the limit is actually being
+         * used, it grows by one per limit-many completions. A 503, a timeout or latency beyond the
+         * tolerance cuts it by Backoff, at most once per smoothed round trip so a single burst of slow
+         * responses does not collapse it.
+         */
+        class ConcurrencyLimiter final
+        {
+        public:
+            explicit ConcurrencyLimiter(ConcurrencyLimiterOptions const &options);
+
+            size_t GetLimit() const { return static_cast<size_t>(m_limit); }
+
+            /**
+             * Feeds a completed request. @p inFlight is the number of requests that were running, used
+             * to tell a limit that is too low from one that is not being reached.
+             */
+            void OnSample(std::chrono::microseconds latency, bool overloaded, size_t inFlight);
+
+        private:
+            ConcurrencyLimiterOptions m_options;
+            double m_limit;
+            double m_smoothedUs = 0;
+            // Lowest latencies of the running and the last completed baseline window, zero when unset
+            double m_windowMinUs = 0;
+            double m_previousWindowMinUs = 0;
+            std::chrono::steady_clock::time_point m_windowStart;
+            std::chrono::steady_clock::time_point m_lastDecrease;
+
+            double GetBaselineUs() const;
+            void Clamp();
+        };
+    }
+}
@@ -0,0 +1,144 @@
+#include "connection_monitor.hpp"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <stdexcept>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        ConnectionMonitor::ConnectionMonitor(std::shared_ptr<MetricsRegistry> metrics)
+            : m_metrics(std::move(metrics)),
+              m_opened(m_metrics->GetCounter("connections_opened_total")),
+              m_closed(m_metrics->GetCounter("connections_closed_total")),
+              m_open(m_metrics->GetGauge("connections_open"))
+        {
+        }
+
+        void ConnectionMonitor::OnOpened(curl_socket_t socket, std::string const &host)
+        {
+            auto const now = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto &connection = m_connections[socket];
+                connection.Host = host;
+                connection.OpenedAt = now;
+                connection.LastUsed = now;
+                connection.Reaped = false;
+            }
+            m_opened.Add();
+            m_open.Add(1);
+            m_metrics->GetGauge("connections_open", MetricsRegistry::Label("host", host)).Add(1);
+        }
+
+        void ConnectionMonitor::OnReleased(curl_socket_t socket)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_connections.find(socket);
+            if (found != m_connections.end())
+            {
+                found->second.LastUsed = std::chrono::steady_clock::now();
+            }
+        }
+
+        std::vector<curl_socket_t> ConnectionMonitor::CollectExpired(
+            std::chrono::milliseconds maxIdle,
+            std::chrono::milliseconds maxAge)
+        {
+            auto const now = std::chrono::steady_clock::now();
+            std::vector<curl_socket_t> expired;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &entry : m_connections)
+            {
+                auto const &connection = entry.second;
+                if (connection.Reaped)
+                {
+                    continue;
+                }
+                auto const idleTooLong = maxIdle.count() > 0 && now - connection.LastUsed > maxIdle;
+                auto const tooOld = maxAge.count() > 0 && now - connection.OpenedAt > maxAge;
+                if (idleTooLong || tooOld)
+                {
+                    expired.push_back(entry.first);
+                }
+            }
+            return expired;
+        }
+
+        std::vector<curl_socket_t> ConnectionMonitor::CollectIdle(
+            std::string const &host,
+            std::chrono::milliseconds minIdle)
+        {
+            auto const now = std::chrono::steady_clock::now();
+            std::vector<curl_socket_t> idle;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto const &entry : m_connections)
+            {
+                auto const &connection = entry.second;
+                if (!connection.Reaped && (host.empty() || connection.Host == host) && now - connection.LastUsed >= minIdle)
+                {
+                    idle.push_back(entry.first);
+                }
+            }
+            return idle;
+        }
+
+        void ConnectionMonitor::OnReaped(curl_socket_t socket)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_connections.find(socket);
+            if (found != m_connections.end())
+            {
+                found->second.Reaped = true;
+            }
+        }
+
+        void ConnectionMonitor::ApplyTo(CURL *handle)
+        {
+            auto operationResult = curl_easy_setopt(handle, CURLOPT_CLOSESOCKETFUNCTION, CloseSocket);
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set CURLOPT_CLOSESOCKETFUNCTION for libcurl");
+            }
+            operationResult = curl_easy_setopt(handle, CURLOPT_CLOSESOCKETDATA, static_cast<void *>(this));
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set CURLOPT_CLOSESOCKETDATA for libcurl");
+            }
+        }
+
+        int ConnectionMonitor::CloseSocket(void *clientp, curl_socket_t socket)
+        {
+            auto monitor = static_cast<ConnectionMonitor *>(clientp);
+            std::string host;
+            bool tracked = false;
+            {
+                std::lock_guard<std::mutex> lock(monitor->m_mutex);
+                auto found = monitor->m_connections.find(socket);
+                if (found != monitor->m_connections.end())
+                {
+                    host = std::move(found->second.Host);
+                    monitor->m_connections.erase(found);
+                    tracked = true;
+                }
+            }
+            if (tracked)
+            {
+                monitor->m_closed.Add();
+                monitor->m_open.Add(-1);
+                monitor->m_metrics->GetGauge("connections_open", MetricsRegistry::Label("host", host)).Add(-1);
+            }
+
+#if defined(_WIN32)
+            return closesocket(socket);
+#else
+            return close(socket);
+#endif
+        }
+    }
+}
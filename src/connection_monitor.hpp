@@ -0,0 +1,85 @@
+/**
+ * Tracks the sockets in a connection pool so its occupancy can be observed and stale sockets reaped
+ */
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * libcurl gives no way to enumerate its connection cache, so the pool is observed from the
+         * outside: sockets are recorded when libcurl creates them (`CURLOPT_SOCKOPTFUNCTION`), marked
+         * used when a transfer on them finishes and forgotten when libcurl closes them
+         * (`CURLOPT_CLOSESOCKETFUNCTION`).
+         *
+         * libcurl binds the close callback to the connection when it is created, so the monitor must
+         * outlive the share that owns the connection cache.
+         */
+        class ConnectionMonitor final
+        {
+        public:
+            explicit ConnectionMonitor(std::shared_ptr<MetricsRegistry> metrics);
+
+            ConnectionMonitor(ConnectionMonitor const &) = delete;
+            ConnectionMonitor &operator=(ConnectionMonitor const &) = delete;
+
+            void OnOpened(curl_socket_t socket, std::string const &host);
+            void OnReleased(curl_socket_t socket);
+
+            /**
+             * Sockets idle for longer than @p maxIdle or open for longer than @p maxAge that have not
+             * been reaped yet. A zero duration disables that limit.
+             */
+            std::vector<curl_socket_t> CollectExpired(
+                std::chrono::milliseconds maxIdle,
+                std::chrono::milliseconds maxAge);
+
+            /**
+             * Sockets to @p host, or to every host when empty, that have not been used for at least
+             * @p minIdle and have not been reaped yet.
+             */
+            std::vector<curl_socket_t> CollectIdle(std::string const &host, std::chrono::milliseconds minIdle);
+
+            /**
+             * Records that @p socket was shut down; libcurl closes it the next time it inspects it.
+             */
+            void OnReaped(curl_socket_t socket);
+
+            /**
+             * Installs the close callback that keeps the monitor in sync on @p handle.
+             */
+            void ApplyTo(CURL *handle);
+
+        private:
+            struct Connection
+            {
+                std::string Host;
+                std::chrono::steady_clock::time_point OpenedAt;
+                std::chrono::steady_clock::time_point LastUsed;
+                bool Reaped = false;
+            };
+
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            std::mutex m_mutex;
+            std::unordered_map<curl_socket_t, Connection> m_connections;
+            Counter &m_opened;
+            Counter &m_closed;
+            Gauge &m_open;
+
+            static int CloseSocket(void *clientp, curl_socket_t socket);
+        };
+    }
+}
@@ -0,0 +1,976 @@
+#include "curl_engine.hpp"
+
+#include "transport_threads.hpp"
+
+#include <azure/core/http/transport.hpp>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <cerrno>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    // How often a waiting caller checks its context; Azure contexts have no cancellation callback
+    constexpr static const std::chrono::milliseconds CancellationPollInterval(100);
+
+    // Upper bound for a single wait so housekeeping runs even without socket activity
+    constexpr static const int MaxPollTimeoutMs = 1000;
+
+    // How often running transfers report their bytes to the bandwidth allocator and get new limits
+    constexpr static const std::chrono::milliseconds BandwidthSampleInterval(100);
+
+    // A delta of two counters taken from the same connection, zero if the connection changed under them
+    template <class T> T GetIncrease(T later, T earlier) { return later > earlier ? later - earlier : T(); }
+
+    // Sockets used this recently are known to be alive and skip the health check
+    constexpr static const std::chrono::milliseconds HealthCheckMinIdle(1000);
+
+    // Failures that mean the connection died under the request rather than the request being rejected
+    bool IsConnectionLoss(CURLcode result)
+    {
+        return result == CURLE_SEND_ERROR || result == CURLE_RECV_ERROR || result == CURLE_GOT_NOTHING;
+    }
+
+    // Failures that mean the host could not be reached at all
+    bool IsConnectFailure(CURLcode result)
+    {
+        return result == CURLE_COULDNT_RESOLVE_HOST || result == CURLE_COULDNT_CONNECT || result == CURLE_SSL_CONNECT_ERROR;
+    }
+
+    MyNameSpace::_detail::CircuitBreaker::Outcome GetBreakerOutcome(CURLcode result)
+    {
+        using Outcome = MyNameSpace::_detail::CircuitBreaker::Outcome;
+        if (result == CURLE_OK)
+        {
+            return Outcome::Success;
+        }
+        if (result == CURLE_ABORTED_BY_CALLBACK)
+        {
+            return Outcome::Ignored;
+        }
+        return IsConnectFailure(result) ? Outcome::ConnectFailure : Outcome::Failure;
+    }
+
+    // Non-blocking peek at an idle connection. Only an orderly shutdown or a reset by the peer counts as
+    // dead; pending bytes may be TLS or HTTP/2 control records that libcurl consumes itself.
+    bool IsIdleSocketAlive(curl_socket_t socket)
+    {
+        char probe;
+#if defined(_WIN32)
+        // libcurl sockets are non-blocking already
+        auto const received = recv(socket, &probe, 1, MSG_PEEK);
+        if (received < 0)
+        {
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        }
+#else
+        auto const received = recv(socket, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (received < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+#endif
+        return received > 0;
+    }
+
+    long GetLocalPort(curl_socket_t socket)
+    {
+        struct sockaddr_storage address;
+        socklen_t addressLen = sizeof(address);
+        if (getsockname(socket, reinterpret_cast<struct sockaddr *>(&address), &addressLen) != 0)
+        {
+            return -1;
+        }
+        if (address.ss_family == AF_INET)
+        {
+            return ntohs(reinterpret_cast<struct sockaddr_in *>(&address)->sin_port);
+        }
+        if (address.ss_family == AF_INET6)
+        {
+            return ntohs(reinterpret_cast<struct sockaddr_in6 *>(&address)->sin6_port);
+        }
+        return -1;
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        CurlEngine::CurlEngine(
+            std::shared_ptr<CurlShare> share,
+            CurlEngineOptions const &options,
+            std::shared_ptr<MetricsRegistry> metrics)
+            : m_share(std::move(share)), m_options(options), m_metrics(std::move(metrics)),
+              m_admission(options.Admission, m_metrics),
+              m_breaker(options.Breaker, m_metrics),
+              m_activeTransfers(m_metrics->GetGauge("transfers_active")),
+              m_shardActiveTransfers(m_metrics->GetGauge("transfers_active", MetricsRegistry::Label("shard", std::to_string(options.Shard)))),
+              m_reapedConnections(m_metrics->GetCounter("connections_reaped_total")),
+              m_culledConnections(m_metrics->GetCounter("connections_culled_total")),
+              m_staleConnectionFailures(m_metrics->GetCounter("transfers_failed_on_reused_connection_total"))
+        {
+            m_multiHandle = curl_multi_init();
+            if (!m_multiHandle)
+            {
+                throw std::runtime_error("Could not create a new libcurl multi handle");
+            }
+
+            CURLMcode operationResult;
+            operationResult = curl_multi_setopt(m_multiHandle, CURLMOPT_MAX_HOST_CONNECTIONS, m_options.MaxConnectionsPerHost);
+            if (operationResult == CURLM_OK)
+            {
+                operationResult = curl_multi_setopt(m_multiHandle, CURLMOPT_MAX_TOTAL_CONNECTIONS, m_options.MaxTotalConnections);
+            }
+            if (operationResult == CURLM_OK)
+            {
+                // Without this libcurl keeps only 4 idle connections per attached handle
+                operationResult = curl_multi_setopt(m_multiHandle, CURLMOPT_MAXCONNECTS, m_options.MaxCachedConnections);
+            }
+            if (operationResult != CURLM_OK)
+            {
+                curl_multi_cleanup(m_multiHandle);
+                throw std::runtime_error("Could not set connection limits for libcurl multi handle");
+            }
+
+#if defined(MY_TRANSPORT_HAS_EPOLL)
+            try
+            {
+                m_eventLoop.reset(new EpollLoop(m_multiHandle));
+            }
+            catch (...)
+            {
+                curl_multi_cleanup(m_multiHandle);
+                throw;
+            }
+#endif
+
+            if (m_options.UpkeepInterval.count() > 0)
+            {
+                m_upkeepHandle = curl_easy_init();
+                if (!m_upkeepHandle)
+                {
+                    curl_multi_cleanup(m_multiHandle);
+                    throw std::runtime_error("Could not create a new libcurl handle");
+                }
+                // Attached to the share so upkeep walks the same connection cache the transfers use
+                m_share->ApplyTo(m_upkeepHandle);
+                curl_easy_setopt(m_upkeepHandle, CURLOPT_UPKEEP_INTERVAL_MS, static_cast<long>(m_options.UpkeepInterval.count()));
+            }
+
+            m_nextReap = std::chrono::steady_clock::now();
+            m_nextUpkeep = m_nextReap + m_options.UpkeepInterval;
+            m_loopThread = std::thread(&CurlEngine::Run, this);
+        }
+
+        CurlEngine::~CurlEngine()
+        {
+            m_stop = true;
+            Wakeup();
+            m_loopThread.join();
+
+            // Nobody is left to drive these transfers; fail them so their callers stop waiting
+            for (auto node = m_submitted.PopAll(); node;)
+            {
+                std::unique_ptr<Transfer> transfer(node);
+                node = node->Next;
+                Deliver(*transfer, {CURLE_ABORTED_BY_CALLBACK, std::string()});
+            }
+            for (auto &queued : m_queued)
+            {
+                Deliver(*queued.second, {CURLE_ABORTED_BY_CALLBACK, std::string()});
+            }
+            m_queued.clear();
+            while (!m_running.empty())
+            {
+                Complete(m_running.begin()->first, CURLE_ABORTED_BY_CALLBACK);
+            }
+#if defined(MY_TRANSPORT_HAS_EPOLL)
+            m_eventLoop.reset();
+#endif
+            curl_multi_cleanup(m_multiHandle);
+            if (m_upkeepHandle)
+            {
+                curl_easy_cleanup(m_upkeepHandle);
+            }
+        }
+
+        void CurlEngine::Submit(
+            CURL *handle,
+            std::string host,
+            CompletionCallback onComplete,
+            TransferAttributes const &attributes)
+        {
+            Enqueue(handle, std::move(host), std::move(onComplete), attributes, false);
+        }
+
+        void CurlEngine::Enqueue(
+            CURL *handle,
+            std::string host,
+            CompletionCallback onComplete,
+            TransferAttributes const &attributes,
+            bool inlineCompletion)
+        {
+            if (m_stop)
+            {
+                throw std::runtime_error("The transport engine is shutting down");
+            }
+
+            // Every submitted transfer completes exactly once, through Deliver
+            m_load.fetch_add(1, std::memory_order_relaxed);
+            if (attributes.Priority.Class > 0)
+            {
+                m_latencySensitive.fetch_add(1);
+            }
+            m_submitted.Push(new Transfer{
+                this, handle, std::move(host), std::move(onComplete), attributes.Priority, attributes.Tenant, inlineCompletion});
+            WakeupIfSleeping();
+        }
+
+        void CurlEngine::Cancel(CURL *handle)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cancelled.push_back(handle);
+                m_handlesPending = true;
+            }
+            WakeupIfSleeping();
+        }
+
+        void CurlEngine::Unpause(CURL *handle)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_unpaused.push_back(handle);
+                m_handlesPending = true;
+            }
+            WakeupIfSleeping();
+        }
+
+        TransferResult CurlEngine::Perform(
+            CURL *handle,
+            std::string host,
+            Azure::Core::Context const &context,
+            TransferAttributes const &attributes)
+        {
+            // Shared with the callback, which may still be unlocking when the waiter wakes up
+            struct Completion
+            {
+                std::mutex Mutex;
+                std::condition_variable Condition;
+                bool Done = false;
+                TransferResult Result;
+            };
+            auto completion = std::make_shared<Completion>();
+
+            // Only wakes the caller, which parses the response itself; a hop through the completion
+            // executor would just add latency
+            Enqueue(
+                handle, std::move(host), [completion](TransferResult const &result)
+                {
+                    std::lock_guard<std::mutex> lock(completion->Mutex);
+                    completion->Result = result;
+                    completion->Done = true;
+                    completion->Condition.notify_one(); },
+                attributes,
+                true);
+
+            std::unique_lock<std::mutex> lock(completion->Mutex);
+            bool cancelRequested = false;
+            while (!completion->Condition.wait_for(lock, CancellationPollInterval, [&completion]()
+                                                   { return completion->Done; }))
+            {
+                if (!cancelRequested && context.IsCancelled())
+                {
+                    // The callback still runs once the loop detaches the handle, wait for it
+                    Cancel(handle);
+                    cancelRequested = true;
+                }
+            }
+
+            if (!completion->Result.Rejection.empty())
+            {
+                throw Azure::Core::Http::TransportException(completion->Result.Rejection);
+            }
+            return completion->Result;
+        }
+
+        void CurlEngine::Run()
+        {
+            IsTransportThread() = true;
+            std::vector<CURL *> cancelled;
+            std::vector<CURL *> unpaused;
+
+#if defined(__linux__)
+            if (m_options.Cpu >= 0 && m_options.Cpu < CPU_SETSIZE)
+            {
+                // Best effort; an unavailable CPU leaves the thread unpinned
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(m_options.Cpu, &cpus);
+                pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            }
+#endif
+
+            while (!m_stop)
+            {
+                // Cancellations first: a transfer is always pushed before it can be cancelled, so
+                // every cancellation taken here finds its transfer in this pass or an earlier one
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    cancelled.swap(m_cancelled);
+                    unpaused.swap(m_unpaused);
+                    m_handlesPending = false;
+                }
+                for (auto node = m_submitted.PopAll(); node;)
+                {
+                    std::unique_ptr<Transfer> transfer(node);
+                    node = node->Next;
+                    Admit(std::move(transfer));
+                }
+
+                for (auto handle : cancelled)
+                {
+                    auto queued = m_queued.find(handle);
+                    if (queued != m_queued.end())
+                    {
+                        // Never reached the multi handle, it only leaves the admission queue
+                        m_admission.Withdraw(handle);
+                        auto transfer = std::move(queued->second);
+                        m_queued.erase(queued);
+                        m_breaker.OnResult(transfer->Host, transfer->BreakerProbe, CircuitBreaker::Outcome::Ignored);
+                        Deliver(*transfer, {CURLE_ABORTED_BY_CALLBACK, std::string()});
+                    }
+                    else
+                    {
+                        Complete(handle, CURLE_ABORTED_BY_CALLBACK);
+                    }
+                }
+                cancelled.clear();
+                for (auto handle : unpaused)
+                {
+                    if (m_running.count(handle) != 0)
+                    {
+                        curl_easy_pause(handle, CURLPAUSE_CONT);
+                    }
+                }
+                unpaused.clear();
+                UpdateBackgroundThrottle();
+
+#if !defined(MY_TRANSPORT_HAS_EPOLL)
+                // The epoll loop drives ready sockets while it waits, below
+                int stillRunning = 0;
+                curl_multi_perform(m_multiHandle, &stillRunning);
+#endif
+
+                int messagesLeft = 0;
+                while (auto message = curl_multi_info_read(m_multiHandle, &messagesLeft))
+                {
+                    if (message->msg == CURLMSG_DONE)
+                    {
+                        Complete(message->easy_handle, message->data.result);
+                    }
+                }
+
+                auto const now = std::chrono::steady_clock::now();
+                auto const limiting = m_options.Bandwidth && m_options.Bandwidth->IsLimiting();
+                if (limiting && now >= m_nextBandwidthSample)
+                {
+                    SampleBandwidth();
+                    m_nextBandwidthSample = now + BandwidthSampleInterval;
+                }
+                if (m_options.TcpInfoInterval.count() > 0 && now >= m_nextTcpInfoSample)
+                {
+                    SampleConnections();
+                    m_nextTcpInfoSample = now + m_options.TcpInfoInterval;
+                }
+                if (now >= m_nextReap)
+                {
+                    ReapExpiredConnections();
+                }
+                if (m_upkeepHandle && now >= m_nextUpkeep)
+                {
+                    // Sends HTTP/2 PINGs on idle connections so neither side times them out
+                    curl_easy_upkeep(m_upkeepHandle);
+                    m_nextUpkeep = now + m_options.UpkeepInterval;
+                }
+
+                // Completions above may have been the last latency sensitive transfers
+                UpdateBackgroundThrottle();
+
+                // From here on producers wake the loop themselves. Anything pushed or cancelled before
+                // they could see that is still pending and keeps this pass from blocking.
+                m_loopAwake = false;
+                auto waitMs = m_submitted.IsEmpty() && !m_handlesPending ? MaxPollTimeoutMs : 0;
+                if (limiting && !m_running.empty())
+                {
+                    // Limits must follow the shares even when the capped transfers are all waiting
+                    waitMs = std::min(waitMs, static_cast<int>(BandwidthSampleInterval.count()));
+                }
+#if defined(MY_TRANSPORT_HAS_EPOLL)
+                m_eventLoop->RunOnce(std::chrono::milliseconds(waitMs));
+#else
+                curl_multi_poll(m_multiHandle, nullptr, 0, waitMs, nullptr);
+#endif
+                m_loopAwake = true;
+            }
+        }
+
+        void CurlEngine::Wakeup()
+        {
+#if defined(MY_TRANSPORT_HAS_EPOLL)
+            m_eventLoop->Wakeup();
+#else
+            curl_multi_wakeup(m_multiHandle);
+#endif
+        }
+
+        void CurlEngine::WakeupIfSleeping()
+        {
+            // The plain load keeps producers off the cache line's exclusive state while the loop is busy
+            if (!m_loopAwake.load() && !m_loopAwake.exchange(true))
+            {
+                Wakeup();
+            }
+        }
+
+        void CurlEngine::Admit(std::unique_ptr<Transfer> transfer)
+        {
+            if (!m_breaker.Allow(transfer->Host, transfer->BreakerProbe))
+            {
+                auto const reason = "Circuit breaker open for " + transfer->Host + ", failing the request without sending it.";
+                Reject(std::move(transfer), reason);
+                return;
+            }
+
+            auto const handle = transfer->Handle;
+            switch (m_admission.Acquire(transfer->Host, handle, transfer->Priority))
+            {
+            case AdmissionController::Decision::Admitted:
+                Start(std::move(transfer));
+                break;
+            case AdmissionController::Decision::Queued:
+                // Started when a transfer to the same host completes
+                m_queued.emplace(handle, std::move(transfer));
+                break;
+            case AdmissionController::Decision::Rejected:
+                m_breaker.OnResult(transfer->Host, transfer->BreakerProbe, CircuitBreaker::Outcome::Ignored);
+                auto const reason = "Too many requests queued for " + transfer->Host + ", rejecting the request.";
+                Reject(std::move(transfer), reason);
+                break;
+            }
+        }
+
+        void CurlEngine::Deliver(Transfer &transfer, TransferResult result)
+        {
+            m_load.fetch_sub(1, std::memory_order_relaxed);
+            if (transfer.Priority.Class > 0)
+            {
+                m_latencySensitive.fetch_sub(1);
+            }
+            if (!m_options.Completions || transfer.InlineCompletion)
+            {
+                transfer.OnComplete(result);
+                return;
+            }
+
+            // The handle is already detached, the loop moves on to socket I/O right away
+            auto onComplete = std::move(transfer.OnComplete);
+            m_options.Completions->Post([onComplete, result]()
+                                        { onComplete(result); });
+        }
+
+        void CurlEngine::Reject(std::unique_ptr<Transfer> transfer, std::string reason)
+        {
+            Deliver(*transfer, {CURLE_ABORTED_BY_CALLBACK, std::move(reason)});
+        }
+
+        void CurlEngine::Start(std::unique_ptr<Transfer> transfer)
+        {
+            auto handle = transfer->Handle;
+            transfer->Metrics = &GetHostMetrics(transfer->Host);
+            if (m_options.HealthCheckBeforeReuse)
+            {
+                CullDeadConnections(transfer->Host);
+            }
+
+            // New sockets are attributed to the host of the transfer that opened them, and the local
+            // port of the connection a transfer runs on tells the reaper which sockets are busy
+            auto const configured = curl_easy_setopt(handle, CURLOPT_SOCKOPTFUNCTION, OnSocketCreated) == CURLE_OK &&
+                                    curl_easy_setopt(handle, CURLOPT_SOCKOPTDATA, static_cast<void *>(transfer.get())) == CURLE_OK &&
+                                    curl_easy_setopt(handle, CURLOPT_PREREQFUNCTION, OnConnectionReady) == CURLE_OK &&
+                                    curl_easy_setopt(handle, CURLOPT_PREREQDATA, static_cast<void *>(transfer.get())) == CURLE_OK;
+            if (!configured || curl_multi_add_handle(m_multiHandle, handle) != CURLM_OK)
+            {
+                auto const host = transfer->Host;
+                m_breaker.OnResult(host, transfer->BreakerProbe, CircuitBreaker::Outcome::Ignored);
+                Deliver(*transfer, {CURLE_FAILED_INIT, std::string()});
+                ReleaseAdmission(host);
+                return;
+            }
+
+            m_activeTransfers.Add(1);
+            m_shardActiveTransfers.Add(1);
+            transfer->Metrics->ActiveTransfers->Add(1);
+            if (m_options.Bandwidth)
+            {
+                // Counted before its limits are set so the transfer gets its part of the tenant's share;
+                // libcurl reads them once the transfer moves
+                m_options.Bandwidth->OnStarted(transfer->Tenant);
+            }
+            ApplySpeedLimits(*transfer);
+            m_running.emplace(handle, std::move(transfer));
+        }
+
+        void CurlEngine::UpdateBackgroundThrottle()
+        {
+            if (m_options.BackgroundMaxSendSpeed <= 0)
+            {
+                return;
+            }
+            auto const throttled = m_latencySensitive.load() > 0;
+            if (throttled == m_backgroundThrottled)
+            {
+                return;
+            }
+
+            // libcurl reads the speed limits as the transfer goes, so running uploads adjust too
+            m_backgroundThrottled = throttled;
+            for (auto const &running : m_running)
+            {
+                ApplySpeedLimits(*running.second);
+            }
+        }
+
+        void CurlEngine::ApplySpeedLimits(Transfer const &transfer)
+        {
+            auto const background = m_options.BackgroundMaxSendSpeed > 0 && transfer.Priority.Class < 0;
+            auto const limiting = m_options.Bandwidth && m_options.Bandwidth->IsLimiting();
+            if (!background && !limiting)
+            {
+                return;
+            }
+
+            BandwidthAllocator::Rates rates;
+            if (limiting)
+            {
+                rates = m_options.Bandwidth->GetTransferRates(transfer.Tenant);
+            }
+            curl_off_t sendSpeed = rates.Send;
+            if (background && m_backgroundThrottled)
+            {
+                // Zero is unlimited, the tighter of the two limits otherwise
+                sendSpeed = sendSpeed > 0 ? std::min<curl_off_t>(sendSpeed, m_options.BackgroundMaxSendSpeed)
+                                          : m_options.BackgroundMaxSendSpeed;
+            }
+            curl_easy_setopt(transfer.Handle, CURLOPT_MAX_SEND_SPEED_LARGE, sendSpeed);
+            if (limiting)
+            {
+                curl_easy_setopt(transfer.Handle, CURLOPT_MAX_RECV_SPEED_LARGE, static_cast<curl_off_t>(rates.Receive));
+            }
+        }
+
+        void CurlEngine::SampleBandwidth()
+        {
+            // All the reports first so the allocator rebalances on this round's bytes
+            for (auto const &running : m_running)
+            {
+                ReportBandwidth(*running.second);
+            }
+            for (auto const &running : m_running)
+            {
+                ApplySpeedLimits(*running.second);
+            }
+        }
+
+        void CurlEngine::ReportBandwidth(Transfer &transfer)
+        {
+            curl_off_t received = 0;
+            curl_off_t sent = 0;
+            curl_easy_getinfo(transfer.Handle, CURLINFO_SIZE_DOWNLOAD_T, &received);
+            curl_easy_getinfo(transfer.Handle, CURLINFO_SIZE_UPLOAD_T, &sent);
+            // Both restart from zero when libcurl retries the request internally
+            auto const receivedDelta = std::max<curl_off_t>(received - transfer.ReportedReceived, 0);
+            auto const sentDelta = std::max<curl_off_t>(sent - transfer.ReportedSent, 0);
+            transfer.ReportedReceived = received;
+            transfer.ReportedSent = sent;
+            if (receivedDelta > 0 || sentDelta > 0)
+            {
+                m_options.Bandwidth->OnProgress(transfer.Tenant, receivedDelta, sentDelta);
+            }
+        }
+
+        void CurlEngine::Complete(CURL *handle, CURLcode result)
+        {
+            auto found = m_running.find(handle);
+            if (found == m_running.end())
+            {
+                // Cancelled after it already completed
+                return;
+            }
+            auto transfer = std::move(found->second);
+            m_running.erase(found);
+
+            // The connection went back to the pool, its idle time starts now
+            curl_socket_t socket = CURL_SOCKET_BAD;
+            if (curl_easy_getinfo(handle, CURLINFO_ACTIVESOCKET, &socket) == CURLE_OK && socket != CURL_SOCKET_BAD)
+            {
+                m_share->GetConnectionMonitor().OnReleased(socket);
+                // Unix domain sockets have no port
+                if (transfer->LocalPort > 0)
+                {
+                    m_socketsByPort[transfer->LocalPort] = socket;
+                }
+            }
+            // Taken while the connection is still the transfer's
+            TcpInfoSample tcpInfo;
+            if (transfer->TcpAtStart.Available)
+            {
+                tcpInfo = _detail::SampleTcpInfo(socket);
+                RecordTcpInfo(*transfer, tcpInfo);
+            }
+            if (result == CURLE_OK && m_options.Sockets && m_options.Sockets->IsAutoTuning())
+            {
+                RecordPathSample(handle, transfer->Host, socket, tcpInfo);
+            }
+            if (tcpInfo.Available && result == CURLE_OK)
+            {
+                // Told apart from the tcp_rtt_ms of the same host, shows whether slow requests waited on
+                // the server or on the network
+                auto const serverTime = EstimateServerTime(handle, tcpInfo);
+                transfer->Metrics->ServerTime->Record(std::chrono::duration<double, std::milli>(serverTime).count());
+            }
+            if (tcpInfo.Available)
+            {
+                tcpInfo.Retransmits = GetIncrease(tcpInfo.Retransmits, transfer->TcpAtStart.Retransmits);
+                tcpInfo.ReceiveWindowLimited = GetIncrease(tcpInfo.ReceiveWindowLimited, transfer->TcpAtStart.ReceiveWindowLimited);
+            }
+
+            long newConnections = 0;
+            if (IsConnectionLoss(result) && curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &newConnections) == CURLE_OK && newConnections == 0)
+            {
+                // What the health checks are meant to drive to zero
+                m_staleConnectionFailures.Add();
+            }
+
+            curl_multi_remove_handle(m_multiHandle, handle);
+            m_activeTransfers.Add(-1);
+            m_shardActiveTransfers.Add(-1);
+            transfer->Metrics->ActiveTransfers->Add(-1);
+            curl_off_t totalTime = 0;
+            curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &totalTime);
+            auto const duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::microseconds(totalTime));
+            if (m_options.Bandwidth)
+            {
+                ReportBandwidth(*transfer);
+                m_options.Bandwidth->OnFinished(transfer->Tenant, duration);
+            }
+            else
+            {
+                RecordTenantMetrics(*transfer, duration);
+            }
+
+            // The handle belongs to the caller again once the callback has run
+            RecordAdmissionSample(handle, transfer->Host, result);
+            m_breaker.OnResult(transfer->Host, transfer->BreakerProbe, GetBreakerOutcome(result));
+            Deliver(*transfer, {result, std::string(), tcpInfo});
+            ReleaseAdmission(transfer->Host);
+        }
+
+        void CurlEngine::RecordTenantMetrics(Transfer const &transfer, std::chrono::milliseconds duration)
+        {
+            auto found = m_tenantMetrics.find(transfer.Tenant);
+            if (found == m_tenantMetrics.end())
+            {
+                auto const labels = MetricsRegistry::Label("tenant", BandwidthAllocator::GetTenantLabel(transfer.Tenant));
+                TenantMetrics metrics;
+                metrics.ReceivedBytes = &m_metrics->GetCounter("tenant_received_bytes_total", labels);
+                metrics.SentBytes = &m_metrics->GetCounter("tenant_sent_bytes_total", labels);
+                metrics.Duration = &m_metrics->GetHistogram("tenant_request_duration_ms", MetricsRegistry::LatencyBoundsMs(), labels);
+                found = m_tenantMetrics.emplace(transfer.Tenant, metrics).first;
+            }
+
+            curl_off_t received = 0;
+            curl_off_t sent = 0;
+            curl_easy_getinfo(transfer.Handle, CURLINFO_SIZE_DOWNLOAD_T, &received);
+            curl_easy_getinfo(transfer.Handle, CURLINFO_SIZE_UPLOAD_T, &sent);
+            found->second.ReceivedBytes->Add(static_cast<uint64_t>(std::max<curl_off_t>(received, 0)));
+            found->second.SentBytes->Add(static_cast<uint64_t>(std::max<curl_off_t>(sent, 0)));
+            found->second.Duration->Record(static_cast<double>(duration.count()));
+        }
+
+        CurlEngine::HostMetrics &CurlEngine::GetHostMetrics(std::string const &host)
+        {
+            auto found = m_hostMetrics.find(host);
+            if (found != m_hostMetrics.end())
+            {
+                return found->second;
+            }
+
+            auto const labels = MetricsRegistry::Label("host", host);
+            HostMetrics metrics;
+            metrics.ActiveTransfers = &m_metrics->GetGauge("transfers_active", labels);
+            return m_hostMetrics.emplace(host, metrics).first->second;
+        }
+
+        void CurlEngine::RecordAdmissionSample(CURL *handle, std::string const &host, CURLcode result)
+        {
+            long statusCode = 0;
+            curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &statusCode);
+            // Azure Storage signals ServerBusy and similar throttling with 503
+            auto const overloaded = result == CURLE_OPERATION_TIMEDOUT || statusCode == 503;
+            if (result != CURLE_OK && !overloaded)
+            {
+                // Failures say nothing about how loaded the host is
+                return;
+            }
+
+            // Time to first byte after the request was sent; connection setup and the size of the
+            // response would otherwise swamp the server-side queueing the limiter is looking for
+            curl_off_t preTransfer = 0;
+            curl_off_t startTransfer = 0;
+            curl_easy_getinfo(handle, CURLINFO_PRETRANSFER_TIME_T, &preTransfer);
+            curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &startTransfer);
+            auto const latency = std::chrono::microseconds(std::max<curl_off_t>(startTransfer - preTransfer, 0));
+
+            m_admission.OnCompleted(host, latency, overloaded);
+        }
+
+        void CurlEngine::ReleaseAdmission(std::string const &host)
+        {
+            if (m_stop)
+            {
+                // The destructor fails the queued transfers itself
+                return;
+            }
+            for (auto key : m_admission.Release(host))
+            {
+                auto found = m_queued.find(static_cast<CURL *>(const_cast<void *>(key)));
+                auto transfer = std::move(found->second);
+                m_queued.erase(found);
+                Start(std::move(transfer));
+            }
+        }
+
+        void CurlEngine::RecordPathSample(CURL *handle, std::string const &host, curl_socket_t socket, TcpInfoSample const &tcpInfo)
+        {
+            curl_off_t nameLookup = 0;
+            curl_off_t connect = 0;
+            curl_off_t preTransfer = 0;
+            curl_off_t startTransfer = 0;
+            curl_off_t total = 0;
+            curl_off_t received = 0;
+            curl_off_t sent = 0;
+            long newConnections = 0;
+            curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &nameLookup);
+            curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+            curl_easy_getinfo(handle, CURLINFO_PRETRANSFER_TIME_T, &preTransfer);
+            curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &startTransfer);
+            curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total);
+            curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &received);
+            curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD_T, &sent);
+            curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &newConnections);
+
+            PathSample sample;
+            if (tcpInfo.Available && tcpInfo.Rtt.count() > 0)
+            {
+                // Smoothed over the connection's lifetime, better than a single handshake
+                sample.Rtt = tcpInfo.Rtt;
+            }
+            else if (newConnections > 0)
+            {
+                // The TCP handshake takes one round trip
+                sample.Rtt = std::chrono::microseconds(connect - nameLookup);
+            }
+            sample.ReceivedBytes = received;
+            sample.ReceiveTime = std::chrono::microseconds(total - startTransfer);
+            // Includes the server's time to the first response byte, so uploads read a little slow
+            sample.SentBytes = sent;
+            sample.SendTime = std::chrono::microseconds(startTransfer - preTransfer);
+            m_options.Sockets->OnTransferDone(host, socket, sample);
+        }
+
+        void CurlEngine::RecordTcpInfo(Transfer &transfer, TcpInfoSample const &sample)
+        {
+            if (!sample.Available)
+            {
+                return;
+            }
+
+            auto &metrics = *transfer.Metrics;
+            if (!metrics.TcpRtt)
+            {
+                auto const labels = MetricsRegistry::Label("host", transfer.Host);
+                metrics.ServerTime = &m_metrics->GetHistogram("server_time_ms", MetricsRegistry::LatencyBoundsMs(), labels);
+                metrics.TcpRtt = &m_metrics->GetHistogram("tcp_rtt_ms", MetricsRegistry::LatencyBoundsMs(), labels);
+                metrics.TcpRttVariance = &m_metrics->GetGauge("tcp_rtt_variance_us", labels);
+                metrics.TcpCongestionWindow = &m_metrics->GetGauge("tcp_congestion_window_segments", labels);
+                metrics.TcpDeliveryRate = &m_metrics->GetGauge("tcp_delivery_rate_bytes", labels);
+                metrics.TcpRetransmits = &m_metrics->GetCounter("tcp_retransmits_total", labels);
+                metrics.TcpReceiveWindowLimited = &m_metrics->GetCounter("tcp_receive_window_limited_us_total", labels);
+            }
+
+            metrics.TcpRtt->Record(std::chrono::duration<double, std::milli>(sample.Rtt).count());
+            metrics.TcpRttVariance->Set(sample.RttVariance.count());
+            metrics.TcpCongestionWindow->Set(sample.CongestionWindow);
+            metrics.TcpDeliveryRate->Set(static_cast<int64_t>(sample.DeliveryRate));
+            metrics.TcpRetransmits->Add(GetIncrease(sample.Retransmits, transfer.TcpRecorded.Retransmits));
+            metrics.TcpReceiveWindowLimited->Add(
+                static_cast<uint64_t>(GetIncrease(sample.ReceiveWindowLimited, transfer.TcpRecorded.ReceiveWindowLimited).count()));
+            transfer.TcpRecorded = sample;
+        }
+
+        void CurlEngine::SampleConnections()
+        {
+            for (auto const &running : m_running)
+            {
+                auto &transfer = *running.second;
+                // Transfers still connecting have nothing to compare against yet
+                if (transfer.TcpAtStart.Available)
+                {
+                    RecordTcpInfo(transfer, _detail::SampleTcpInfo(transfer.Socket));
+                }
+            }
+        }
+
+        void CurlEngine::ReapExpiredConnections()
+        {
+            auto const maxIdle = m_options.MaxConnectionIdleTime;
+            auto const maxAge = m_options.MaxConnectionAge;
+            if (maxIdle.count() <= 0 && maxAge.count() <= 0)
+            {
+                m_nextReap = std::chrono::steady_clock::time_point::max();
+                return;
+            }
+
+            // Check a few times per limit so a socket outlives its limit by a fraction at most
+            auto interval = std::chrono::milliseconds::max();
+            for (auto limit : {maxIdle, maxAge})
+            {
+                if (limit.count() > 0)
+                {
+                    interval = std::min(interval, limit / 4);
+                }
+            }
+            interval = std::max(std::chrono::milliseconds(100), std::min(interval, std::chrono::milliseconds(5000)));
+            m_nextReap = std::chrono::steady_clock::now() + interval;
+
+            auto &monitor = m_share->GetConnectionMonitor();
+            auto const expired = monitor.CollectExpired(maxIdle, maxAge);
+            if (expired.empty())
+            {
+                return;
+            }
+
+            auto const busyPorts = GetBusyLocalPorts();
+            for (auto socket : expired)
+            {
+                auto const localPort = GetLocalPort(socket);
+                if (localPort < 0 || std::find(busyPorts.begin(), busyPorts.end(), localPort) != busyPorts.end())
+                {
+                    // Still carrying a transfer; libcurl will not reuse it past its limits anyway
+                    continue;
+                }
+
+                ShutdownIdleSocket(socket);
+                m_reapedConnections.Add();
+            }
+        }
+
+        void CurlEngine::CullDeadConnections(std::string const &host)
+        {
+            auto &monitor = m_share->GetConnectionMonitor();
+            auto const idle = monitor.CollectIdle(host, HealthCheckMinIdle);
+            if (idle.empty())
+            {
+                return;
+            }
+
+            auto const busyPorts = GetBusyLocalPorts();
+            for (auto socket : idle)
+            {
+                auto const localPort = GetLocalPort(socket);
+                if (localPort < 0 || std::find(busyPorts.begin(), busyPorts.end(), localPort) != busyPorts.end())
+                {
+                    continue;
+                }
+                if (!IsIdleSocketAlive(socket))
+                {
+                    ShutdownIdleSocket(socket);
+                    m_culledConnections.Add();
+                }
+            }
+        }
+
+        std::vector<long> CurlEngine::GetBusyLocalPorts() const
+        {
+            std::vector<long> busyPorts;
+            busyPorts.reserve(m_running.size());
+            for (auto const &running : m_running)
+            {
+                busyPorts.push_back(running.second->LocalPort);
+            }
+            return busyPorts;
+        }
+
+        void CurlEngine::ShutdownIdleSocket(curl_socket_t socket)
+        {
+            // Sends FIN now instead of letting the server time the socket out; libcurl sees it as dead
+            // on its next liveness check and closes it through the monitor
+#if defined(_WIN32)
+            shutdown(socket, SD_BOTH);
+#else
+            shutdown(socket, SHUT_RDWR);
+#endif
+            m_share->GetConnectionMonitor().OnReaped(socket);
+        }
+
+        int CurlEngine::OnSocketCreated(void *clientp, curl_socket_t socket, curlsocktype purpose)
+        {
+            if (purpose == CURLSOCKTYPE_IPCXN)
+            {
+                auto transfer = static_cast<Transfer *>(clientp);
+                transfer->Socket = socket;
+                transfer->Engine->m_share->GetConnectionMonitor().OnOpened(socket, transfer->Host);
+                if (auto const &sockets = transfer->Engine->m_options.Sockets)
+                {
+                    sockets->Configure(socket, transfer->Host);
+                }
+            }
+            return CURL_SOCKOPT_OK;
+        }
+
+        int CurlEngine::OnConnectionReady(void *clientp, char *, char *, int, int localPort)
+        {
+            auto transfer = static_cast<Transfer *>(clientp);
+            transfer->LocalPort = localPort;
+
+            // A new connection's socket was seen when it was created, unless another attempt won the
+            // race to connect; a reused one was seen when its last transfer completed
+            if (transfer->Socket == CURL_SOCKET_BAD || GetLocalPort(transfer->Socket) != localPort)
+            {
+                auto const &sockets = transfer->Engine->m_socketsByPort;
+                auto found = sockets.find(localPort);
+                transfer->Socket = found != sockets.end() && GetLocalPort(found->second) == localPort ? found->second : CURL_SOCKET_BAD;
+            }
+
+            // Baseline for the transfer's share of the connection's counters
+            transfer->TcpAtStart = _detail::SampleTcpInfo(transfer->Socket);
+            transfer->TcpRecorded = transfer->TcpAtStart;
+            return CURL_PREREQFUNC_OK;
+        }
+    }
+}
@@ -0,0 +1,322 @@
+/**
+ * Multi handle driven by a dedicated thread that runs every transfer of the transport
+ */
+
+#pragma once
+
+#include "admission_controller.hpp"
+#include "bandwidth_allocator.hpp"
+#include "circuit_breaker.hpp"
+#include "completion_executor.hpp"
+#include "curl_share.hpp"
+#include "epoll_loop.hpp"
+#include "mpsc_queue.hpp"
+#include "metrics.hpp"
+#include "socket_tuner.hpp"
+#include "tcp_info.hpp"
+
+#include <azure/core/context.hpp>
+
+#include <curl/curl.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct CurlEngineOptions
+        {
+            // Zero means unlimited for both connection limits
+            long MaxConnectionsPerHost = 0;
+            long MaxTotalConnections = 0;
+            long MaxCachedConnections = 64;
+            std::chrono::milliseconds MaxConnectionIdleTime{0};
+            std::chrono::milliseconds MaxConnectionAge{0};
+            // Zero disables the periodic upkeep (HTTP/2 PING) of idle connections
+            std::chrono::milliseconds UpkeepInterval{0};
+            bool HealthCheckBeforeReuse = true;
+            AdmissionOptions Admission;
+            CircuitBreakerOptions Breaker;
+            // Index among the transport's engines, used to label metrics
+            size_t Shard = 0;
+            // CPU the loop thread is pinned to, -1 leaves it to the scheduler
+            int Cpu = -1;
+            // Runs Submit's completion callbacks; without one they run on the loop thread
+            std::shared_ptr<CompletionExecutor> Completions;
+            // Upload cap, in bytes per second, for background transfers while latency sensitive ones are
+            // outstanding on the engine. Zero never caps them.
+            curl_off_t BackgroundMaxSendSpeed = 0;
+            // Shared by the transport's engines, null when no tenant limits or weights are configured
+            std::shared_ptr<BandwidthAllocator> Bandwidth;
+            // Configures the sockets libcurl opens and learns each host's path from completed transfers
+            std::shared_ptr<SocketTuner> Sockets;
+            // How often running transfers' connections are sampled for TCP_INFO metrics, zero only
+            // samples them when a transfer completes
+            std::chrono::milliseconds TcpInfoInterval{0};
+        };
+
+        struct TransferAttributes
+        {
+            TransferPriority Priority;
+            // Whose bandwidth share the transfer runs under, empty for the default tenant
+            std::string Tenant;
+        };
+
+        struct TransferResult
+        {
+            CURLcode Code;
+            // Why the engine refused to start the transfer, empty when it ran
+            std::string Rejection;
+            // The connection at the end of the transfer, retransmits and window limited time counted
+            // from when it started
+            TcpInfoSample TcpInfo{};
+        };
+
+        /**
+         * Owns one `CURLM` and the thread that drives it. Easy handles stay owned by the caller; the
+         * engine only attaches them for the duration of the transfer.
+         *
+         * On Linux the loop waits in an EpollLoop and libcurl is driven with `curl_multi_socket_action`
+         * for the sockets that are ready. Elsewhere it falls back to `curl_multi_poll` and
+         * `curl_multi_perform`, which visit every transfer on each wakeup.
+         *
+         * Running every transfer on one multi handle is what lets libcurl enforce the per-host and total
+         * connection limits. The loop thread also reaps pooled sockets that have been idle or open for
+         * too long, shutting them down before the server's idle timeout closes them under a request.
+         *
+         * Before a transfer is attached, idle sockets to its host are peeked without blocking and the
+         * ones the server has closed or reset are culled, so libcurl never picks them. Idle HTTP/2
+         * connections are kept alive with periodic `curl_easy_upkeep` PINGs.
+         *
+         * Submissions pass through an AdmissionController first. Transfers over the per-host in-flight
+         * limit wait in the engine, unattached, until a transfer to the same host completes. A per-host
+         * CircuitBreaker, fed with every transfer's outcome, sits in front of admission. Both only run
+         * on the loop thread.
+         *
+         * Application threads hand transfers over through a lock-free MpscQueue. The loop is only woken
+         * when it is about to sleep; while it is awake, producers skip the eventfd write and the loop
+         * picks their transfers up on its next pass.
+         *
+         * Background transfers, those with a class below zero, have their uploads capped while latency
+         * sensitive transfers are outstanding, so they leave the link to interactive requests.
+         *
+         * With a CompletionExecutor configured, completion callbacks are handed to it so the loop thread
+         * only does socket I/O; a blocking Perform still wakes its caller directly.
+         *
+         * With a BandwidthAllocator, the bytes each running transfer moved are reported to it under the
+         * transfer's tenant every 100 ms, and the transfer's receive and send speed limits are set to
+         * what the allocator gives it back. Without one, the loop records the per-tenant metrics itself
+         * when a transfer completes.
+         *
+         * New sockets get their options from the SocketTuner, which completed transfers feed with the
+         * round trip time and throughput they saw.
+         *
+         * Where the OS supports it, a transfer's connection is sampled with `TCP_INFO` when it is ready
+         * and again when the transfer completes, optionally also periodically in between. The samples
+         * feed per-host `tcp_*` metrics and the completion gets the connection's state, with the
+         * counters as deltas over the transfer. Transfers multiplexed on one HTTP/2 connection share
+         * its counters. Connections over Unix domain sockets have no `TCP_INFO`, and having no local
+         * port they are left to libcurl's own limits by the reaper and the health check.
+         */
+        class CurlEngine final
+        {
+        public:
+            using CompletionCallback = std::function<void(TransferResult const &)>;
+
+            CurlEngine(
+                std::shared_ptr<CurlShare> share,
+                CurlEngineOptions const &options,
+                std::shared_ptr<MetricsRegistry> metrics);
+            ~CurlEngine();
+
+            CurlEngine(CurlEngine const &) = delete;
+            CurlEngine &operator=(CurlEngine const &) = delete;
+
+            /**
+             * Starts the transfer configured on @p handle, or queues it when its host is at the in-flight
+             * limit. Queued transfers start by the priority in @p attributes: class first, then earliest
+             * deadline. @p onComplete runs once the handle is done and detached, on the completion
+             * executor when there is one and on the loop thread otherwise, and must not throw.
+             *
+             * When the host's circuit is open or its wait queue is full the transfer is not started and
+             * @p onComplete receives `CURLE_ABORTED_BY_CALLBACK` with the reason in `Rejection`.
+             */
+            void Submit(
+                CURL *handle,
+                std::string host,
+                CompletionCallback onComplete,
+                TransferAttributes const &attributes = TransferAttributes());
+
+            /**
+             * Aborts a submitted or queued transfer. Its completion callback receives
+             * `CURLE_ABORTED_BY_CALLBACK`.
+             */
+            void Cancel(CURL *handle);
+
+            /**
+             * Continues a transfer whose write callback paused it with `CURL_WRITEFUNC_PAUSE`. Only
+             * the loop thread may unpause a handle, so this hands it over there; a transfer that
+             * completed in the meantime is left alone.
+             */
+            void Unpause(CURL *handle);
+
+            /**
+             * Runs the transfer and blocks until it completes or @p context is cancelled. Throws
+             * TransportException when the engine rejects the transfer.
+             */
+            TransferResult Perform(
+                CURL *handle,
+                std::string host,
+                Azure::Core::Context const &context,
+                TransferAttributes const &attributes = TransferAttributes());
+
+            /**
+             * Number of submitted transfers that have not completed yet, queued ones included.
+             */
+            size_t GetLoad() const { return m_load.load(std::memory_order_relaxed); }
+
+        private:
+            // Per-host metrics, looked up in the registry once per host
+            struct HostMetrics
+            {
+                Gauge *ActiveTransfers;
+                // The rest only once the host's connections have TCP_INFO
+                Histogram *ServerTime = nullptr;
+                Histogram *TcpRtt = nullptr;
+                Gauge *TcpRttVariance = nullptr;
+                Gauge *TcpCongestionWindow = nullptr;
+                Gauge *TcpDeliveryRate = nullptr;
+                Counter *TcpRetransmits = nullptr;
+                Counter *TcpReceiveWindowLimited = nullptr;
+            };
+
+            struct Transfer
+            {
+                CurlEngine *Engine;
+                CURL *Handle;
+                std::string Host;
+                CompletionCallback OnComplete;
+                TransferPriority Priority;
+                std::string Tenant;
+                // Set by Perform, whose callback only wakes the waiting caller
+                bool InlineCompletion;
+                // Set by the circuit breaker when the transfer is a half-open probe
+                uint64_t BreakerProbe = 0;
+                long LocalPort = -1;
+                // The connection's socket once it is ready; libcurl only reports it after the transfer
+                curl_socket_t Socket = CURL_SOCKET_BAD;
+                // Byte counts last reported to the bandwidth allocator
+                curl_off_t ReportedReceived = 0;
+                curl_off_t ReportedSent = 0;
+                // The connection when it was ready, and when last recorded into the metrics
+                TcpInfoSample TcpAtStart{};
+                TcpInfoSample TcpRecorded{};
+                // Set once the transfer starts
+                HostMetrics *Metrics = nullptr;
+                // Link in the submission queue
+                Transfer *Next = nullptr;
+            };
+
+            struct TenantMetrics
+            {
+                Counter *ReceivedBytes;
+                Counter *SentBytes;
+                Histogram *Duration;
+            };
+
+            std::shared_ptr<CurlShare> m_share;
+            CurlEngineOptions m_options;
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            CURLM *m_multiHandle;
+#if defined(MY_TRANSPORT_HAS_EPOLL)
+            std::unique_ptr<EpollLoop> m_eventLoop;
+#endif
+
+            // Filled by application threads and drained by the loop
+            MpscQueue<Transfer> m_submitted;
+            // False only while the loop is about to wait or waiting
+            std::atomic<bool> m_loopAwake{true};
+            std::atomic<bool> m_stop{false};
+            // Guarded by m_mutex; cancellations and unpauses are rare enough not to need their own queue
+            std::mutex m_mutex;
+            std::vector<CURL *> m_cancelled;
+            std::vector<CURL *> m_unpaused;
+            // Set with either list, so the loop does not go to sleep on a handle it has not taken
+            std::atomic<bool> m_handlesPending{false};
+
+            // Only touched by the loop thread
+            AdmissionController m_admission;
+            CircuitBreaker m_breaker;
+            // Transfers waiting for an admission slot
+            std::unordered_map<CURL *, std::unique_ptr<Transfer>> m_queued;
+            std::unordered_map<CURL *, std::unique_ptr<Transfer>> m_running;
+            std::chrono::steady_clock::time_point m_nextReap;
+            std::chrono::steady_clock::time_point m_nextUpkeep;
+            // Never transfers; only used to run upkeep over the shared connection cache
+            CURL *m_upkeepHandle = nullptr;
+
+            std::atomic<size_t> m_load{0};
+            // Outstanding transfers with a class above zero
+            std::atomic<size_t> m_latencySensitive{0};
+            // Whether running background transfers are capped, only touched by the loop thread
+            bool m_backgroundThrottled = false;
+            std::chrono::steady_clock::time_point m_nextBandwidthSample;
+            std::chrono::steady_clock::time_point m_nextTcpInfoSample;
+            // Sockets of pooled connections by local port, for the transfers that reuse them
+            std::unordered_map<long, curl_socket_t> m_socketsByPort;
+            Gauge &m_activeTransfers;
+            Gauge &m_shardActiveTransfers;
+            Counter &m_reapedConnections;
+            Counter &m_culledConnections;
+            Counter &m_staleConnectionFailures;
+            // Per-tenant metrics kept by the loop itself when there is no BandwidthAllocator
+            std::unordered_map<std::string, TenantMetrics> m_tenantMetrics;
+            std::unordered_map<std::string, HostMetrics> m_hostMetrics;
+
+            std::thread m_loopThread;
+
+            void Run();
+            void Wakeup();
+            void WakeupIfSleeping();
+            void Enqueue(
+                CURL *handle,
+                std::string host,
+                CompletionCallback onComplete,
+                TransferAttributes const &attributes,
+                bool inlineCompletion);
+            void Admit(std::unique_ptr<Transfer> transfer);
+            void Deliver(Transfer &transfer, TransferResult result);
+            void Reject(std::unique_ptr<Transfer> transfer, std::string reason);
+            void Start(std::unique_ptr<Transfer> transfer);
+            void UpdateBackgroundThrottle();
+            void ApplySpeedLimits(Transfer const &transfer);
+            void SampleBandwidth();
+            void ReportBandwidth(Transfer &transfer);
+            void RecordTenantMetrics(Transfer const &transfer, std::chrono::milliseconds duration);
+            HostMetrics &GetHostMetrics(std::string const &host);
+            void Complete(CURL *handle, CURLcode result);
+            void ReleaseAdmission(std::string const &host);
+            void RecordAdmissionSample(CURL *handle, std::string const &host, CURLcode result);
+            void RecordPathSample(CURL *handle, std::string const &host, curl_socket_t socket, TcpInfoSample const &tcpInfo);
+            void RecordTcpInfo(Transfer &transfer, TcpInfoSample const &sample);
+            void SampleConnections();
+            void ReapExpiredConnections();
+            void CullDeadConnections(std::string const &host);
+            std::vector<long> GetBusyLocalPorts() const;
+            void ShutdownIdleSocket(curl_socket_t socket);
+
+            static int OnSocketCreated(void *clientp, curl_socket_t socket, curlsocktype purpose);
+            static int OnConnectionReady(void *clientp, char *primaryIp, char *localIp, int primaryPort, int localPort);
+        };
+    }
+}
@@ -0,0 +1,75 @@
+#include "curl_share.hpp"
+
+#include <stdexcept>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        CurlShare::CurlShare(std::shared_ptr<MetricsRegistry> metrics)
+            : m_connectionMonitor(std::make_unique<ConnectionMonitor>(std::move(metrics)))
+        {
+            m_shareHandle = curl_share_init();
+            if (!m_shareHandle)
+            {
+                throw std::runtime_error("Could not create a new libcurl share handle");
+            }
+
+            CURLSHcode operationResult;
+            operationResult = curl_share_setopt(m_shareHandle, CURLSHOPT_LOCKFUNC, Lock);
+            if (operationResult == CURLSHE_OK)
+            {
+                operationResult = curl_share_setopt(m_shareHandle, CURLSHOPT_UNLOCKFUNC, Unlock);
+            }
+            if (operationResult == CURLSHE_OK)
+            {
+                operationResult = curl_share_setopt(m_shareHandle, CURLSHOPT_USERDATA, static_cast<void *>(this));
+            }
+            if (operationResult != CURLSHE_OK)
+            {
+                curl_share_cleanup(m_shareHandle);
+                throw std::runtime_error("Could not set lock functions for libcurl share");
+            }
+
+            // TLS sessions are shared so a ticket obtained by one handle lets every other handle resume
+            operationResult = curl_share_setopt(m_shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            if (operationResult != CURLSHE_OK)
+            {
+                curl_share_cleanup(m_shareHandle);
+                throw std::runtime_error("Could not share TLS sessions for libcurl");
+            }
+
+            // A single connection cache lets every session reuse keep-alive connections opened by others
+            operationResult = curl_share_setopt(m_shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+            if (operationResult != CURLSHE_OK)
+            {
+                curl_share_cleanup(m_shareHandle);
+                throw std::runtime_error("Could not share the connection cache for libcurl");
+            }
+        }
+
+        CurlShare::~CurlShare()
+        {
+            curl_share_cleanup(m_shareHandle);
+        }
+
+        void CurlShare::ApplyTo(CURL *handle) const
+        {
+            if (curl_easy_setopt(handle, CURLOPT_SHARE, m_shareHandle) != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set CURLOPT_SHARE for libcurl");
+            }
+            m_connectionMonitor->ApplyTo(handle);
+        }
+
+        void CurlShare::Lock(CURL *, curl_lock_data data, curl_lock_access, void *userp)
+        {
+            static_cast<CurlShare *>(userp)->m_locks[data].lock();
+        }
+
+        void CurlShare::Unlock(CURL *, curl_lock_data data, void *userp)
+        {
+            static_cast<CurlShare *>(userp)->m_locks[data].unlock();
+        }
+    }
+}
@@ -0,0 +1,48 @@
+/**
+ * libcurl share handle owned by the transport and attached to every easy handle it creates
+ */
+
+#pragma once
+
+#include "connection_monitor.hpp"
+#include "metrics.hpp"
+
+#include <curl/curl.h>
+
+#include <memory>
+#include <mutex>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Thread safe wrapper around `CURLSH`. Sessions keep a shared_ptr to it because libcurl
+         * requires the share to outlive every easy handle attached to it.
+         *
+         * The share owns the connection cache, so it also owns the monitor observing that cache.
+         */
+        class CurlShare final
+        {
+        public:
+            explicit CurlShare(std::shared_ptr<MetricsRegistry> metrics);
+            ~CurlShare();
+
+            CurlShare(CurlShare const &) = delete;
+            CurlShare &operator=(CurlShare const &) = delete;
+
+            void ApplyTo(CURL *handle) const;
+
+            ConnectionMonitor &GetConnectionMonitor() const { return *m_connectionMonitor; }
+
+        private:
+            // Declared first so it is still alive when the cleanup closes the cached connections
+            std::unique_ptr<ConnectionMonitor> m_connectionMonitor;
+            CURLSH *m_shareHandle;
+            std::mutex m_locks[CURL_LOCK_DATA_LAST];
+
+            static void Lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userp);
+            static void Unlock(CURL *handle, curl_lock_data data, void *userp);
+        };
+    }
+}
@@ -0,0 +1,184 @@
+#include "dns_cache.hpp"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <algorithm>
+
+namespace
+{
+    // Records are refreshed once this fraction of the TTL has elapsed, leaving the rest of the TTL as
+    // headroom for a slow or failing resolver
+    constexpr static const int RefreshAheadPercent = 75;
+
+    // Hosts that have not been used for this many TTLs stop being refreshed
+    constexpr static const int IdleEvictionTtls = 10;
+
+    std::string MakeKey(std::string const &host, uint16_t port)
+    {
+        return host + ":" + std::to_string(port);
+    }
+
+    std::string FormatResolveEntry(std::string const &key, std::vector<std::string> const &addresses, size_t first)
+    {
+        std::string resolveEntry = key + ":";
+        for (size_t i = 0; i < addresses.size(); ++i)
+        {
+            if (i > 0)
+            {
+                resolveEntry += ",";
+            }
+            resolveEntry += addresses[(first + i) % addresses.size()];
+        }
+        return resolveEntry;
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        DnsCache::DnsCache(std::chrono::seconds ttl) : m_ttl(ttl)
+        {
+            // Ticks often enough that every entry is looked at well before it expires
+            auto const interval = std::max(std::chrono::seconds(1), m_ttl / 10);
+            m_refreshTask = std::make_unique<PeriodicTask>(interval, [this]()
+                                                           { RefreshExpiring(); });
+        }
+
+        DnsCache::~DnsCache() { m_refreshTask->Stop(); }
+
+        std::string DnsCache::GetResolveEntry(std::string const &host, uint16_t port)
+        {
+            auto const key = MakeKey(host, port);
+            auto const now = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(m_entriesMutex);
+                auto found = m_entries.find(key);
+                if (found == m_entries.end())
+                {
+                    // Placeholder so concurrent first requests and the refresher know about the host
+                    found = m_entries.emplace(key, Entry()).first;
+                }
+                auto &entry = found->second;
+                entry.LastUsed = now;
+                if (!entry.Addresses.empty())
+                {
+                    return FormatResolveEntry(key, entry.Addresses, entry.NextAddress++ % entry.Addresses.size());
+                }
+            }
+
+            // Cold host; this request pays for the lookup once, the refresher keeps it warm afterwards
+            auto addresses = Resolve(host, port);
+            if (addresses.empty())
+            {
+                return std::string();
+            }
+
+            std::lock_guard<std::mutex> lock(m_entriesMutex);
+            auto &entry = m_entries[key];
+            entry.Addresses = addresses;
+            entry.ResolvedAt = now;
+            entry.LastUsed = now;
+            return FormatResolveEntry(key, addresses, entry.NextAddress++ % addresses.size());
+        }
+
+        std::vector<std::string> DnsCache::Resolve(std::string const &host, uint16_t port)
+        {
+            struct addrinfo hints = {};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_protocol = IPPROTO_TCP;
+
+            struct addrinfo *results = nullptr;
+            if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0)
+            {
+                return {};
+            }
+
+            std::vector<std::string> addresses;
+            for (auto current = results; current != nullptr; current = current->ai_next)
+            {
+                char buffer[INET6_ADDRSTRLEN];
+                std::string address;
+                if (current->ai_family == AF_INET)
+                {
+                    auto const ipv4 = reinterpret_cast<struct sockaddr_in const *>(current->ai_addr);
+                    if (inet_ntop(AF_INET, &ipv4->sin_addr, buffer, sizeof(buffer)) != nullptr)
+                    {
+                        address = buffer;
+                    }
+                }
+                else if (current->ai_family == AF_INET6)
+                {
+                    auto const ipv6 = reinterpret_cast<struct sockaddr_in6 const *>(current->ai_addr);
+                    if (inet_ntop(AF_INET6, &ipv6->sin6_addr, buffer, sizeof(buffer)) != nullptr)
+                    {
+                        // CURLOPT_RESOLVE wants IPv6 addresses in brackets
+                        address = std::string("[") + buffer + "]";
+                    }
+                }
+
+                if (!address.empty() && std::find(addresses.begin(), addresses.end(), address) == addresses.end())
+                {
+                    addresses.push_back(address);
+                }
+            }
+            freeaddrinfo(results);
+            return addresses;
+        }
+
+        void DnsCache::RefreshExpiring()
+        {
+            auto const now = std::chrono::steady_clock::now();
+            auto const refreshAfter = m_ttl * RefreshAheadPercent / 100;
+
+            std::vector<std::string> expiring;
+            {
+                std::lock_guard<std::mutex> lock(m_entriesMutex);
+                for (auto entry = m_entries.begin(); entry != m_entries.end();)
+                {
+                    if (now - entry->second.LastUsed > m_ttl * IdleEvictionTtls)
+                    {
+                        entry = m_entries.erase(entry);
+                        continue;
+                    }
+                    if (!entry->second.Addresses.empty() && now - entry->second.ResolvedAt >= refreshAfter)
+                    {
+                        expiring.push_back(entry->first);
+                    }
+                    ++entry;
+                }
+            }
+
+            // Resolve without holding the lock so request threads keep getting the current records
+            for (auto const &key : expiring)
+            {
+                auto const separator = key.rfind(':');
+                auto const host = key.substr(0, separator);
+                auto const port = static_cast<uint16_t>(std::stoi(key.substr(separator + 1)));
+                auto addresses = Resolve(host, port);
+
+                std::lock_guard<std::mutex> lock(m_entriesMutex);
+                auto found = m_entries.find(key);
+                if (found == m_entries.end())
+                {
+                    continue;
+                }
+                if (!addresses.empty())
+                {
+                    found->second.Addresses = std::move(addresses);
+                }
+                // Also on failure, so a broken resolver is retried on the next cycle instead of every tick
+                found->second.ResolvedAt = std::chrono::steady_clock::now();
+            }
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/**
+ * Transport-owned resolver cache that refreshes records in the background
+ */
+
+#pragma once
+
+#include "periodic_task.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Keeps every A/AAAA record of the hosts the transport talks to and re-resolves them in the
+         * background before they expire, so requests never block on name resolution after the first
+         * one. Results are pinned into handles through `CURLOPT_RESOLVE`.
+         *
+         * `getaddrinfo` does not report record TTLs, the configured TTL is used for every host. A host
+         * whose refresh fails keeps its last known addresses until it is resolved again.
+         */
+        class DnsCache final
+        {
+        public:
+            explicit DnsCache(std::chrono::seconds ttl);
+            ~DnsCache();
+
+            DnsCache(DnsCache const &) = delete;
+            DnsCache &operator=(DnsCache const &) = delete;
+
+            /**
+             * Returns a `CURLOPT_RESOLVE` entry (`host:port:addr1,addr2`) for @p host. The address list
+             * is rotated on every call so new connections spread across all records. The first call for
+             * a host resolves synchronously; an empty string means the host could not be resolved and
+             * libcurl should do it itself.
+             */
+            std::string GetResolveEntry(std::string const &host, uint16_t port);
+
+        private:
+            struct Entry
+            {
+                std::vector<std::string> Addresses;
+                std::chrono::steady_clock::time_point ResolvedAt;
+                std::chrono::steady_clock::time_point LastUsed;
+                size_t NextAddress = 0;
+            };
+
+            std::chrono::seconds m_ttl;
+            std::mutex m_entriesMutex;
+            std::unordered_map<std::string, Entry> m_entries;
+            std::unique_ptr<PeriodicTask> m_refreshTask;
+
+            static std::vector<std::string> Resolve(std::string const &host, uint16_t port);
+            void RefreshExpiring();
+        };
+    }
+}
@@ -0,0 +1,93 @@
+#include "endpoint_selector.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        EndpointSelector::EndpointSelector(EndpointSelectorOptions const &options, std::shared_ptr<MetricsRegistry> metrics)
+            : m_options(options), m_metrics(std::move(metrics))
+        {
+        }
+
+        EndpointSelector::Endpoint &EndpointSelector::GetEndpoint(std::string const &host)
+        {
+            auto found = m_endpoints.find(host);
+            if (found != m_endpoints.end())
+            {
+                return found->second;
+            }
+
+            auto const labels = MetricsRegistry::Label("host", host);
+            Endpoint endpoint;
+            endpoint.Latencies = &m_metrics->GetHistogram("read_endpoint_latency_ms", MetricsRegistry::LatencyBoundsMs(), labels);
+            endpoint.Reads = &m_metrics->GetCounter("read_endpoint_requests_total", labels);
+            endpoint.Failures = &m_metrics->GetCounter("read_endpoint_failures_total", labels);
+            endpoint.Probes = &m_metrics->GetCounter("read_endpoint_probes_total", labels);
+            endpoint.LatencyGauge = &m_metrics->GetGauge("read_endpoint_smoothed_latency_us", labels);
+            endpoint.ErrorRateGauge = &m_metrics->GetGauge("read_endpoint_error_rate_ppm", labels);
+            return m_endpoints.emplace(host, std::move(endpoint)).first->second;
+        }
+
+        bool EndpointSelector::ChooseSecondary(std::string const &primary, std::string const &secondary, bool &probe)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &primaryEndpoint = GetEndpoint(primary);
+            auto &secondaryEndpoint = GetEndpoint(secondary);
+
+            bool useSecondary;
+            if (IsHealthy(primaryEndpoint) != IsHealthy(secondaryEndpoint))
+            {
+                useSecondary = IsHealthy(secondaryEndpoint);
+            }
+            else if (!IsHealthy(primaryEndpoint))
+            {
+                useSecondary = secondaryEndpoint.ErrorRate < primaryEndpoint.ErrorRate;
+            }
+            else
+            {
+                // Until probes measured the secondary it is never preferred
+                useSecondary = secondaryEndpoint.Latency > 0 && primaryEndpoint.Latency > 0 &&
+                               secondaryEndpoint.Latency * m_options.SecondaryBias < primaryEndpoint.Latency;
+            }
+
+            ++m_reads;
+            probe = false;
+            if (m_options.ProbeFraction > 0)
+            {
+                auto const probeEvery = static_cast<uint64_t>(std::max(1.0, std::round(1 / m_options.ProbeFraction)));
+                if (m_reads % probeEvery == 0)
+                {
+                    useSecondary = !useSecondary;
+                    probe = true;
+                    (useSecondary ? secondaryEndpoint : primaryEndpoint).Probes->Add();
+                }
+            }
+            (useSecondary ? secondaryEndpoint : primaryEndpoint).Reads->Add();
+            return useSecondary;
+        }
+
+        void EndpointSelector::OnResult(std::string const &host, std::chrono::microseconds latency, bool failed)
+        {
+            auto const milliseconds = std::chrono::duration<double, std::milli>(latency).count();
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &endpoint = GetEndpoint(host);
+            endpoint.ErrorRate = m_options.Smoothing * (failed ? 1 : 0) + (1 - m_options.Smoothing) * endpoint.ErrorRate;
+            if (failed)
+            {
+                endpoint.Failures->Add();
+            }
+            else
+            {
+                endpoint.Latency = endpoint.Latency > 0 ? m_options.Smoothing * milliseconds + (1 - m_options.Smoothing) * endpoint.Latency
+                                                        : milliseconds;
+                endpoint.Latencies->Record(milliseconds);
+            }
+            endpoint.LatencyGauge->Set(static_cast<int64_t>(endpoint.Latency * 1000));
+            endpoint.ErrorRateGauge->Set(static_cast<int64_t>(endpoint.ErrorRate * 1000000));
+        }
+    }
+}
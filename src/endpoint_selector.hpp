@@ -0,0 +1,83 @@
+/**
+ * Picks the faster healthy one of a primary and secondary endpoint from their recent latency and errors
+ */
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct EndpointSelectorOptions
+        {
+            // Weight of the newest read in the smoothed latency and error rate
+            double Smoothing = 0.2;
+            // Error rate above which an endpoint is unhealthy and only probed
+            double MaxErrorRate = 0.1;
+            // How much faster the secondary has to be before it is preferred
+            double SecondaryBias = 1.25;
+            // Share of reads sent to the endpoint not chosen, to keep its estimates current
+            double ProbeFraction = 0.02;
+        };
+
+        /**
+         * Keeps an exponentially weighted moving average of each endpoint's read latency and error
+         * rate, and sends each read to the healthy endpoint with the lower latency. The secondary has
+         * to beat the primary by SecondaryBias, so reads only move there, and to its possibly stale
+         * data, when the primary is clearly slower. When both are unhealthy the one with fewer errors
+         * wins.
+         *
+         * Estimates only change when an endpoint is read from, so a fixed share of reads probes the
+         * other endpoint. That is also how the secondary gets measured at first, and how an endpoint
+         * that was unhealthy gets picked again once it recovers.
+         */
+        class EndpointSelector final
+        {
+        public:
+            EndpointSelector(EndpointSelectorOptions const &options, std::shared_ptr<MetricsRegistry> metrics);
+
+            /**
+             * Returns whether a read should go to @p secondary rather than @p primary. @p probe is set
+             * when the read goes to the endpoint that was not chosen, to measure it.
+             */
+            bool ChooseSecondary(std::string const &primary, std::string const &secondary, bool &probe);
+
+            /**
+             * Feeds the outcome of a read sent to @p host. Latency is only used when it did not fail.
+             */
+            void OnResult(std::string const &host, std::chrono::microseconds latency, bool failed);
+
+        private:
+            struct Endpoint
+            {
+                // Milliseconds, zero until the first successful read
+                double Latency = 0;
+                double ErrorRate = 0;
+                Histogram *Latencies;
+                Counter *Reads;
+                Counter *Failures;
+                Counter *Probes;
+                Gauge *LatencyGauge;
+                Gauge *ErrorRateGauge;
+            };
+
+            EndpointSelectorOptions m_options;
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            std::mutex m_mutex;
+            std::unordered_map<std::string, Endpoint> m_endpoints;
+            uint64_t m_reads = 0;
+
+            Endpoint &GetEndpoint(std::string const &host);
+            bool IsHealthy(Endpoint const &endpoint) const { return endpoint.ErrorRate <= m_options.MaxErrorRate; }
+        };
+    }
+}
@@ -0,0 +1,88 @@
+#include "engine_shards.hpp"
+
+#include "transport_threads.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        EngineShards::EngineShards(
+            size_t count,
+            CurlEngineOptions const &options,
+            std::vector<int> const &cpus,
+            bool leastLoaded,
+            std::shared_ptr<MetricsRegistry> const &metrics)
+            : m_leastLoaded(leastLoaded)
+        {
+            count = std::max<size_t>(count, 1);
+            m_shards.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto shardOptions = options;
+                shardOptions.Shard = i;
+                shardOptions.Cpu = i < cpus.size() ? cpus[i] : -1;
+
+                EngineShard shard;
+                shard.Share = std::make_shared<CurlShare>(metrics);
+                shard.Engine = MakeTransportShared<CurlEngine>(shard.Share, shardOptions, metrics);
+                m_shards.push_back(std::move(shard));
+            }
+        }
+
+        size_t EngineShards::GetHostShard(std::string const &host) const
+        {
+            return std::hash<std::string>()(host) % m_shards.size();
+        }
+
+        EngineShard const &EngineShards::Route(std::string const &host) const
+        {
+            if (m_shards.size() == 1)
+            {
+                return m_shards.front();
+            }
+            if (!m_leastLoaded)
+            {
+                return m_shards[GetHostShard(host)];
+            }
+
+            // Ties go to the host's own shard, so an idle transport still reuses its connections
+            auto best = &m_shards[GetHostShard(host)];
+            for (auto const &shard : m_shards)
+            {
+                if (shard.Engine->GetLoad() < best->Engine->GetLoad())
+                {
+                    best = &shard;
+                }
+            }
+            return *best;
+        }
+
+        std::vector<EngineShard const *> EngineShards::GetCandidates(std::string const &host) const
+        {
+            std::vector<EngineShard const *> candidates;
+            if (!m_leastLoaded)
+            {
+                candidates.push_back(&m_shards[GetHostShard(host)]);
+                return candidates;
+            }
+            for (auto const &shard : m_shards)
+            {
+                candidates.push_back(&shard);
+            }
+            return candidates;
+        }
+
+        std::vector<std::shared_ptr<CurlShare>> EngineShards::GetShares() const
+        {
+            std::vector<std::shared_ptr<CurlShare>> shares;
+            for (auto const &shard : m_shards)
+            {
+                shares.push_back(shard.Share);
+            }
+            return shares;
+        }
+    }
+}
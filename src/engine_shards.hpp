@@ -0,0 +1,60 @@
+/**
+ * Independent engines, each with its own connection pool, that requests are spread over
+ */
+
+#pragma once
+
+#include "curl_engine.hpp"
+#include "curl_share.hpp"
+#include "metrics.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct EngineShard
+        {
+            std::shared_ptr<CurlShare> Share;
+            std::shared_ptr<CurlEngine> Engine;
+        };
+
+        /**
+         * Runs N engines side by side. Each has its own share, so its own connection pool and TLS
+         * session cache, and its own loop thread, optionally pinned to a CPU.
+         *
+         * Routing by host hash keeps every request to a host on one shard, so connections are reused and
+         * per-host limits hold exactly. Least-loaded routing sends each request to the shard with the
+         * fewest outstanding transfers, which balances a few busy hosts better at the cost of a pool,
+         * and per-host limits, per shard.
+         */
+        class EngineShards final
+        {
+        public:
+            EngineShards(
+                size_t count,
+                CurlEngineOptions const &options,
+                std::vector<int> const &cpus,
+                bool leastLoaded,
+                std::shared_ptr<MetricsRegistry> const &metrics);
+
+            EngineShard const &Route(std::string const &host) const;
+
+            /**
+             * The shards requests to @p host can be routed to.
+             */
+            std::vector<EngineShard const *> GetCandidates(std::string const &host) const;
+
+            std::vector<std::shared_ptr<CurlShare>> GetShares() const;
+
+        private:
+            std::vector<EngineShard> m_shards;
+            bool m_leastLoaded;
+
+            size_t GetHostShard(std::string const &host) const;
+        };
+    }
+}
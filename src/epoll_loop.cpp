@@ -0,0 +1,188 @@
+#include "epoll_loop.hpp"
+
+#if defined(MY_TRANSPORT_HAS_EPOLL)
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace
+{
+    // Ready events taken per epoll_wait; more simply wait for the next call
+    constexpr static const int MaxEventsPerWait = 256;
+
+    void Drain(int fd)
+    {
+        uint64_t value;
+        while (read(fd, &value, sizeof(value)) > 0)
+        {
+        }
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        EpollLoop::EpollLoop(CURLM *multiHandle) : m_multiHandle(multiHandle)
+        {
+            m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+            m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            m_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_epollFd < 0 || m_timerFd < 0 || m_wakeupFd < 0)
+            {
+                Close();
+                throw std::runtime_error("Could not create the epoll loop for libcurl");
+            }
+
+            for (auto fd : {m_timerFd, m_wakeupFd})
+            {
+                struct epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.fd = fd;
+                if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+                {
+                    Close();
+                    throw std::runtime_error("Could not create the epoll loop for libcurl");
+                }
+            }
+
+            auto const configured = curl_multi_setopt(m_multiHandle, CURLMOPT_SOCKETFUNCTION, OnSocket) == CURLM_OK &&
+                                    curl_multi_setopt(m_multiHandle, CURLMOPT_SOCKETDATA, static_cast<void *>(this)) == CURLM_OK &&
+                                    curl_multi_setopt(m_multiHandle, CURLMOPT_TIMERFUNCTION, OnTimer) == CURLM_OK &&
+                                    curl_multi_setopt(m_multiHandle, CURLMOPT_TIMERDATA, static_cast<void *>(this)) == CURLM_OK;
+            if (!configured)
+            {
+                Close();
+                throw std::runtime_error("Could not set socket callbacks for libcurl multi handle");
+            }
+        }
+
+        EpollLoop::~EpollLoop()
+        {
+            // The multi handle may outlive the loop while it is being cleaned up
+            curl_multi_setopt(m_multiHandle, CURLMOPT_SOCKETFUNCTION, nullptr);
+            curl_multi_setopt(m_multiHandle, CURLMOPT_TIMERFUNCTION, nullptr);
+            Close();
+        }
+
+        void EpollLoop::Close()
+        {
+            for (auto fd : {m_epollFd, m_timerFd, m_wakeupFd})
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+            m_epollFd = m_timerFd = m_wakeupFd = -1;
+        }
+
+        void EpollLoop::Wakeup()
+        {
+            uint64_t const one = 1;
+            // Only fails when the counter is saturated, which still leaves the loop woken
+            auto written = write(m_wakeupFd, &one, sizeof(one));
+            (void)written;
+        }
+
+        void EpollLoop::RunOnce(std::chrono::milliseconds maxWait)
+        {
+            struct epoll_event events[MaxEventsPerWait];
+            auto const ready = epoll_wait(m_epollFd, events, MaxEventsPerWait, static_cast<int>(maxWait.count()));
+            if (ready < 0)
+            {
+                // EINTR; the caller loops anyway
+                return;
+            }
+
+            int stillRunning = 0;
+            for (int i = 0; i < ready; ++i)
+            {
+                auto const fd = events[i].data.fd;
+                if (fd == m_wakeupFd)
+                {
+                    Drain(m_wakeupFd);
+                }
+                else if (fd == m_timerFd)
+                {
+                    Drain(m_timerFd);
+                    curl_multi_socket_action(m_multiHandle, CURL_SOCKET_TIMEOUT, 0, &stillRunning);
+                }
+                else
+                {
+                    int flags = 0;
+                    if (events[i].events & EPOLLIN)
+                    {
+                        flags |= CURL_CSELECT_IN;
+                    }
+                    if (events[i].events & EPOLLOUT)
+                    {
+                        flags |= CURL_CSELECT_OUT;
+                    }
+                    if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    {
+                        flags |= CURL_CSELECT_ERR;
+                    }
+                    curl_multi_socket_action(m_multiHandle, fd, flags, &stillRunning);
+                }
+            }
+        }
+
+        int EpollLoop::OnSocket(CURL *, curl_socket_t socket, int what, void *userp, void *socketp)
+        {
+            auto loop = static_cast<EpollLoop *>(userp);
+            if (what == CURL_POLL_REMOVE)
+            {
+                // Fails harmlessly when the socket is already closed, which drops it from the set
+                epoll_ctl(loop->m_epollFd, EPOLL_CTL_DEL, socket, nullptr);
+                curl_multi_assign(loop->m_multiHandle, socket, nullptr);
+                return 0;
+            }
+
+            struct epoll_event event = {};
+            event.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0u) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0u);
+            event.data.fd = socket;
+
+            // socketp marks sockets already in the set. A descriptor libcurl closed and reopened
+            // between callbacks can disagree with it, so fall back to the other operation.
+            auto const operation = socketp ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            if (epoll_ctl(loop->m_epollFd, operation, socket, &event) != 0)
+            {
+                auto const fallback = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+                if (epoll_ctl(loop->m_epollFd, fallback, socket, &event) != 0)
+                {
+                    return -1;
+                }
+            }
+            if (!socketp)
+            {
+                curl_multi_assign(loop->m_multiHandle, socket, userp);
+            }
+            return 0;
+        }
+
+        int EpollLoop::OnTimer(CURLM *, long timeoutMs, void *userp)
+        {
+            auto loop = static_cast<EpollLoop *>(userp);
+            struct itimerspec timer = {};
+            if (timeoutMs == 0)
+            {
+                // A zero it_value disarms the timer, fire as soon as possible instead
+                timer.it_value.tv_nsec = 1;
+            }
+            else if (timeoutMs > 0)
+            {
+                timer.it_value.tv_sec = timeoutMs / 1000;
+                timer.it_value.tv_nsec = (timeoutMs % 1000) * 1000000;
+            }
+            return timerfd_settime(loop->m_timerFd, 0, &timer, nullptr) == 0 ? 0 : -1;
+        }
+    }
+}
+
+#endif
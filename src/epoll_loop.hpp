@@ -0,0 +1,63 @@
+/**
+ * epoll and timerfd readiness loop that drives a multi handle through curl_multi_socket_action
+ */
+
+#pragma once
+
+#if defined(__linux__)
+#define MY_TRANSPORT_HAS_EPOLL 1
+#endif
+
+#if defined(MY_TRANSPORT_HAS_EPOLL)
+
+#include <curl/curl.h>
+
+#include <chrono>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Installs `CURLMOPT_SOCKETFUNCTION` and `CURLMOPT_TIMERFUNCTION` on a multi handle and keeps the
+         * sockets libcurl asks about in an epoll set, with libcurl's timeout in a timerfd. Each ready
+         * socket is handed to `curl_multi_socket_action` on its own, so the cost of a wakeup is
+         * proportional to the sockets that are actually active instead of to every transfer.
+         *
+         * An eventfd in the same set lets other threads wake the loop; `curl_multi_wakeup` only works
+         * with `curl_multi_poll`. Only the thread calling RunOnce may touch the multi handle.
+         */
+        class EpollLoop final
+        {
+        public:
+            explicit EpollLoop(CURLM *multiHandle);
+            ~EpollLoop();
+
+            EpollLoop(EpollLoop const &) = delete;
+            EpollLoop &operator=(EpollLoop const &) = delete;
+
+            /**
+             * Makes a running or the next RunOnce return. Thread safe.
+             */
+            void Wakeup();
+
+            /**
+             * Waits up to @p maxWait for socket readiness, libcurl's timer or a wakeup, and lets libcurl
+             * act on whatever fired. Finished transfers are then available from `curl_multi_info_read`.
+             */
+            void RunOnce(std::chrono::milliseconds maxWait);
+
+        private:
+            CURLM *m_multiHandle;
+            int m_epollFd = -1;
+            int m_timerFd = -1;
+            int m_wakeupFd = -1;
+
+            void Close();
+            static int OnSocket(CURL *easy, curl_socket_t socket, int what, void *userp, void *socketp);
+            static int OnTimer(CURLM *multi, long timeoutMs, void *userp);
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,129 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+    std::string MakeKey(std::string const &name, std::string const &labels)
+    {
+        return labels.empty() ? name : name + "{" + labels + "}";
+    }
+
+    std::string FormatBound(double bound)
+    {
+        std::ostringstream formatted;
+        formatted << bound;
+        return formatted.str();
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        Histogram::Histogram(std::vector<double> bounds)
+            : m_bounds(std::move(bounds)), m_buckets(new std::atomic<uint64_t>[m_bounds.size() + 1])
+        {
+            std::sort(m_bounds.begin(), m_bounds.end());
+            for (size_t i = 0; i <= m_bounds.size(); ++i)
+            {
+                m_buckets[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void Histogram::Record(double value)
+        {
+            auto const bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) - m_bounds.begin();
+            m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            m_count.fetch_add(1, std::memory_order_relaxed);
+
+            auto sum = m_sum.load(std::memory_order_relaxed);
+            while (!m_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        Counter &MetricsRegistry::GetCounter(std::string const &name, std::string const &labels)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &counter = m_counters[MakeKey(name, labels)];
+            if (!counter)
+            {
+                counter = std::make_unique<Counter>();
+            }
+            return *counter;
+        }
+
+        Gauge &MetricsRegistry::GetGauge(std::string const &name, std::string const &labels)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &gauge = m_gauges[MakeKey(name, labels)];
+            if (!gauge)
+            {
+                gauge = std::make_unique<Gauge>();
+            }
+            return *gauge;
+        }
+
+        Histogram &MetricsRegistry::GetHistogram(
+            std::string const &name,
+            std::vector<double> const &bounds,
+            std::string const &labels)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // The labels are kept separate from the name so buckets can add `le`
+            auto &histogram = m_histograms[name + "\n" + labels];
+            if (!histogram)
+            {
+                histogram = std::make_unique<Histogram>(bounds);
+            }
+            return *histogram;
+        }
+
+        std::map<std::string, double> MetricsRegistry::Snapshot() const
+        {
+            std::map<std::string, double> snapshot;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto const &counter : m_counters)
+            {
+                snapshot[counter.first] = static_cast<double>(counter.second->Get());
+            }
+            for (auto const &gauge : m_gauges)
+            {
+                snapshot[gauge.first] = static_cast<double>(gauge.second->Get());
+            }
+            for (auto const &entry : m_histograms)
+            {
+                auto const separator = entry.first.find('\n');
+                auto const name = entry.first.substr(0, separator);
+                auto const labels = entry.first.substr(separator + 1);
+                auto const prefix = labels.empty() ? std::string() : labels + ",";
+                auto const &histogram = *entry.second;
+
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < histogram.GetBounds().size(); ++i)
+                {
+                    cumulative += histogram.GetBucket(i);
+                    snapshot[name + "_bucket{" + prefix + Label("le", FormatBound(histogram.GetBounds()[i])) + "}"] = static_cast<double>(cumulative);
+                }
+                cumulative += histogram.GetBucket(histogram.GetBounds().size());
+                snapshot[name + "_bucket{" + prefix + Label("le", "+Inf") + "}"] = static_cast<double>(cumulative);
+                snapshot[MakeKey(name + "_sum", labels)] = histogram.GetSum();
+                snapshot[MakeKey(name + "_count", labels)] = static_cast<double>(histogram.GetCount());
+            }
+            return snapshot;
+        }
+
+        std::string MetricsRegistry::Label(std::string const &key, std::string const &value)
+        {
+            return key + "=\"" + value + "\"";
+        }
+
+        std::vector<double> const &MetricsRegistry::LatencyBoundsMs()
+        {
+            static std::vector<double> const bounds = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000};
+            return bounds;
+        }
+    }
+}
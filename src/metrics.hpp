@@ -0,0 +1,98 @@
+/**
+ * Lock-free counters, gauges and histograms the transport publishes through MyTransport::GetMetrics()
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        class Counter final
+        {
+        public:
+            void Add(uint64_t value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+            uint64_t Get() const { return m_value.load(std::memory_order_relaxed); }
+
+        private:
+            std::atomic<uint64_t> m_value{0};
+        };
+
+        class Gauge final
+        {
+        public:
+            void Add(int64_t value) { m_value.fetch_add(value, std::memory_order_relaxed); }
+            void Set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+            int64_t Get() const { return m_value.load(std::memory_order_relaxed); }
+
+        private:
+            std::atomic<int64_t> m_value{0};
+        };
+
+        /**
+         * Cumulative histogram with fixed upper bounds, exported Prometheus style as `_bucket`, `_sum`
+         * and `_count` values.
+         */
+        class Histogram final
+        {
+        public:
+            explicit Histogram(std::vector<double> bounds);
+
+            void Record(double value);
+
+            std::vector<double> const &GetBounds() const { return m_bounds; }
+            uint64_t GetBucket(size_t index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+            uint64_t GetCount() const { return m_count.load(std::memory_order_relaxed); }
+            double GetSum() const { return m_sum.load(std::memory_order_relaxed); }
+
+        private:
+            std::vector<double> m_bounds;
+            // One slot per bound plus the +Inf bucket
+            std::unique_ptr<std::atomic<uint64_t>[]> m_buckets;
+            std::atomic<uint64_t> m_count{0};
+            std::atomic<double> m_sum{0};
+        };
+
+        /**
+         * Owns every metric by name. Returned references stay valid for the registry's lifetime, so hot
+         * paths look a metric up once and keep the reference.
+         */
+        class MetricsRegistry final
+        {
+        public:
+            Counter &GetCounter(std::string const &name, std::string const &labels = std::string());
+            Gauge &GetGauge(std::string const &name, std::string const &labels = std::string());
+            Histogram &GetHistogram(
+                std::string const &name,
+                std::vector<double> const &bounds,
+                std::string const &labels = std::string());
+
+            /**
+             * Flattens every metric into `name{labels}` keys.
+             */
+            std::map<std::string, double> Snapshot() const;
+
+            /**
+             * Formats a single `key="value"` label.
+             */
+            static std::string Label(std::string const &key, std::string const &value);
+
+            // Bounds in milliseconds suitable for request, queue and connection timings
+            static std::vector<double> const &LatencyBoundsMs();
+
+        private:
+            mutable std::mutex m_mutex;
+            std::map<std::string, std::unique_ptr<Counter>> m_counters;
+            std::map<std::string, std::unique_ptr<Gauge>> m_gauges;
+            std::map<std::string, std::unique_ptr<Histogram>> m_histograms;
+        };
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * Lock-free intrusive multi-producer, single-consumer queue
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Producers push with a single compare-and-swap on the head and never block each other for
+         * longer than a retry. The consumer takes everything pushed so far in one exchange and gets it
+         * back in push order. Nodes link through their own `T *Next` member, so pushing never
+         * allocates.
+         *
+         * Operations are sequentially consistent so a consumer that clears a "sleeping" flag and then
+         * finds the queue empty cannot miss a producer that pushed and then saw the flag set.
+         */
+        template <class T> class MpscQueue final
+        {
+        public:
+            MpscQueue() = default;
+            MpscQueue(MpscQueue const &) = delete;
+            MpscQueue &operator=(MpscQueue const &) = delete;
+
+            void Push(T *node)
+            {
+                node->Next = m_head.load();
+                while (!m_head.compare_exchange_weak(node->Next, node))
+                {
+                }
+            }
+
+            /**
+             * Detaches every pushed node, oldest first, linked through `Next`. Consumer only.
+             */
+            T *PopAll()
+            {
+                T *newestFirst = m_head.exchange(nullptr);
+                T *oldestFirst = nullptr;
+                while (newestFirst)
+                {
+                    auto next = newestFirst->Next;
+                    newestFirst->Next = oldestFirst;
+                    oldestFirst = newestFirst;
+                    newestFirst = next;
+                }
+                return oldestFirst;
+            }
+
+            bool IsEmpty() const { return m_head.load() == nullptr; }
+
+        private:
+            std::atomic<T *> m_head{nullptr};
+        };
+    }
+}
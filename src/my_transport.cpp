@@ -1,25 +1,253 @@
 #include "my_transport.hpp"
 
+#include "ca_store.hpp"
+#include "completion_executor.hpp"
+#include "curl_engine.hpp"
+#include "curl_share.hpp"
+#include "dns_cache.hpp"
+#include "engine_shards.hpp"
+#include "metrics.hpp"
+#include "request_trace.hpp"
+#include "throttle_pacer.hpp"
+#include "tls_session_store.hpp"
+#include "transport_threads.hpp"
+
 #include <curl/curl.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 using namespace Azure::Core::Http;
 using namespace Azure::Core;
 
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        // Everything the transport configures on each libcurl handle it creates. Holding it keeps the
+        // shared objects alive for as long as the handle exists.
+        struct HandleSettings
+        {
+            std::shared_ptr<CurlShare> Share;
+            std::shared_ptr<CurlEngine> Engine;
+            std::shared_ptr<CaBundle const> CaCertificates;
+            std::shared_ptr<DnsCache> Resolver;
+            std::shared_ptr<ThrottlePacer> Pacer;
+            // Socket paths of the hosts reached over Unix domain sockets, null when there are none
+            std::shared_ptr<std::map<std::string, std::string> const> UnixSockets;
+            // Null when requests are not recorded
+            std::shared_ptr<TraceWriter> Recorder;
+            // CURL_HTTP_VERSION_NONE keeps the libcurl default
+            long HttpVersion;
+            // Wait for a connection to multiplex on instead of opening a new one
+            bool WaitForMultiplexing;
+            // Zero keeps the libcurl defaults
+            long MaxConnectionIdleSeconds;
+            long MaxConnectionAgeSeconds;
+        };
+    }
+}
+
 namespace
 {
+    using MyNameSpace::_detail::HandleSettings;
+    using MyNameSpace::_detail::ThrottlePacer;
+    using MyNameSpace::_detail::TraceRecord;
+
+    // How often a batch waiting for its transfers checks whether it was cancelled
+    constexpr static const std::chrono::milliseconds CancellationPollInterval(100);
+    // Unread bytes of a SendAsync body past which its transfer is paused until the reader catches up
+    constexpr static const size_t MaxBufferedBody = 1024 * 1024;
+
+    // Where MyTransport::WithPriority stores the priority of a request in its context
+    Azure::Core::Context::Key const PriorityKey;
+    // Where MyTransport::WithTenant stores the tenant a request is attributed to
+    Azure::Core::Context::Key const TenantKey;
+    // Where MyTransport::WithTiming stores the RequestTiming to fill in
+    Azure::Core::Context::Key const TimingKey;
+
+    std::shared_ptr<MyNameSpace::RequestTiming> GetTiming(Context const &context)
+    {
+        std::shared_ptr<MyNameSpace::RequestTiming> timing;
+        context.TryGetValue(TimingKey, timing);
+        return timing;
+    }
+
+    void FillTiming(CURL *handle, MyNameSpace::_detail::TcpInfoSample const &tcpInfo, MyNameSpace::RequestTiming &timing)
+    {
+        auto const getTime = [handle](CURLINFO info)
+        {
+            curl_off_t value = 0;
+            curl_easy_getinfo(handle, info, &value);
+            return std::chrono::microseconds(value);
+        };
+        timing.NameLookup = getTime(CURLINFO_NAMELOOKUP_TIME_T);
+        timing.Connect = getTime(CURLINFO_CONNECT_TIME_T);
+        timing.TlsHandshake = getTime(CURLINFO_APPCONNECT_TIME_T);
+        timing.PreTransfer = getTime(CURLINFO_PRETRANSFER_TIME_T);
+        timing.FirstByte = getTime(CURLINFO_STARTTRANSFER_TIME_T);
+        timing.Total = getTime(CURLINFO_TOTAL_TIME_T);
+        long newConnections = 0;
+        curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &newConnections);
+        timing.NewConnection = newConnections > 0;
+
+        auto &tcp = timing.Tcp;
+        tcp.Available = tcpInfo.Available;
+        tcp.Rtt = tcpInfo.Rtt;
+        tcp.RttVariance = tcpInfo.RttVariance;
+        tcp.MinRtt = tcpInfo.MinRtt;
+        tcp.Retransmits = tcpInfo.Retransmits;
+        tcp.CongestionWindow = tcpInfo.CongestionWindow;
+        tcp.DeliveryRate = tcpInfo.DeliveryRate;
+        tcp.ReceiveWindowLimited = tcpInfo.ReceiveWindowLimited;
+        timing.ServerTime = MyNameSpace::_detail::EstimateServerTime(handle, tcpInfo);
+    }
+
+    MyNameSpace::_detail::TransferAttributes GetTransferAttributes(Context const &context)
+    {
+        MyNameSpace::_detail::TransferAttributes attributes;
+        auto &priority = attributes.Priority;
+        auto requestPriority = MyNameSpace::RequestPriority::Normal;
+        if (context.TryGetValue(PriorityKey, requestPriority))
+        {
+            priority.Class = static_cast<int>(requestPriority);
+        }
+        context.TryGetValue(TenantKey, attributes.Tenant);
+
+        // The engine orders on the monotonic clock
+        auto const deadline = context.GetDeadline();
+        if (deadline != (Azure::DateTime::max)())
+        {
+            auto const remaining = static_cast<std::chrono::system_clock::time_point>(deadline) - std::chrono::system_clock::now();
+            priority.Deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(remaining);
+        }
+        return attributes;
+    }
+
+    void ApplyHandleSettings(CURL *handle, HandleSettings const &settings)
+    {
+        settings.Share->ApplyTo(handle);
+
+        if (settings.CaCertificates)
+        {
+            MyNameSpace::_detail::CaStore::ApplyTo(handle, *settings.CaCertificates);
+        }
+
+        if (settings.HttpVersion != CURL_HTTP_VERSION_NONE && curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, settings.HttpVersion) != CURLE_OK)
+        {
+            throw std::runtime_error("Could not set CURLOPT_HTTP_VERSION for libcurl");
+        }
+        if (settings.WaitForMultiplexing && curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L) != CURLE_OK)
+        {
+            throw std::runtime_error("Could not set CURLOPT_PIPEWAIT for libcurl");
+        }
+
+        // libcurl refuses to reuse connections past these limits, the engine reaps them proactively
+        if (settings.MaxConnectionIdleSeconds > 0 && curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, settings.MaxConnectionIdleSeconds) != CURLE_OK)
+        {
+            throw std::runtime_error("Could not set CURLOPT_MAXAGE_CONN for libcurl");
+        }
+        if (settings.MaxConnectionAgeSeconds > 0 && curl_easy_setopt(handle, CURLOPT_MAXLIFETIME_CONN, settings.MaxConnectionAgeSeconds) != CURLE_OK)
+        {
+            throw std::runtime_error("Could not set CURLOPT_MAXLIFETIME_CONN for libcurl");
+        }
+    }
+
+    // Points the handle at the Unix domain socket @p host is mapped to, if any. libcurl keys pooled
+    // connections on the socket path as well, so they are reused like TCP ones.
+    bool ApplyUnixSocket(CURL *handle, HandleSettings const &settings, std::string const &host)
+    {
+        if (!settings.UnixSockets)
+        {
+            return false;
+        }
+        auto found = settings.UnixSockets->find(host);
+        if (found == settings.UnixSockets->end())
+        {
+            return false;
+        }
+
+        auto const &path = found->second;
+        auto const abstract = !path.empty() && path[0] == '@';
+        auto const operationResult = abstract ? curl_easy_setopt(handle, CURLOPT_ABSTRACT_UNIX_SOCKET, path.c_str() + 1)
+                                              : curl_easy_setopt(handle, CURLOPT_UNIX_SOCKET_PATH, path.c_str());
+        if (operationResult != CURLE_OK)
+        {
+            throw std::runtime_error("Could not set Unix domain socket " + path + " for libcurl");
+        }
+        return true;
+    }
+
+    // Pins the cached addresses of the url's host into the handle so libcurl never resolves on the
+    // request path. The returned list must be kept alive until the transfer is done.
+    struct curl_slist *ApplyCachedResolve(CURL *handle, HandleSettings const &settings, Azure::Core::Url const &url)
+    {
+        if (!settings.Resolver)
+        {
+            return nullptr;
+        }
+
+        auto port = url.GetPort();
+        if (port == 0)
+        {
+            port = Azure::Core::_internal::StringExtensions::ToLower(url.GetScheme()) == "http" ? 80 : 443;
+        }
+        auto const resolveEntry = settings.Resolver->GetResolveEntry(url.GetHost(), port);
+        if (resolveEntry.empty())
+        {
+            return nullptr;
+        }
+
+        auto resolveHandle = curl_slist_append(NULL, resolveEntry.c_str());
+        if (resolveHandle == NULL)
+        {
+            throw std::runtime_error("Failing creating resolve list for libcurl");
+        }
+        if (curl_easy_setopt(handle, CURLOPT_RESOLVE, resolveHandle) != CURLE_OK)
+        {
+            curl_slist_free_all(resolveHandle);
+            throw std::runtime_error("Could not set CURLOPT_RESOLVE for libcurl");
+        }
+        return resolveHandle;
+    }
+
+    /**
+     * Receives a transfer's response as it arrives instead of having the session buffer it. Called on
+     * the engine thread, must not throw.
+     */
+    class TransferListener
+    {
+    public:
+        virtual ~TransferListener() = default;
+        // The status line and headers are in, the session can build the response
+        virtual void OnHeaders() = 0;
+        // Returns false to leave the data with libcurl and pause the transfer until it is unpaused
+        virtual bool OnData(uint8_t const *data, size_t size) = 0;
+    };
+
     class CurlSession final : public Azure::Core::IO::BodyStream
     {
     private:
         CURL *m_curlHandle;
         struct curl_slist *m_headerHandle = NULL;
+        struct curl_slist *m_resolveHandle = NULL;
         std::vector<uint8_t> m_responseData;
+        // Header lines as received, parsed off the loop thread
+        std::string m_headerData;
+        bool m_headersParsed = false;
+        bool m_headersComplete = false;
+        TransferListener *m_listener = nullptr;
         std::vector<uint8_t> m_sendBuffer;
         std::unique_ptr<RawResponse> m_response = nullptr;
         std::unique_ptr<Azure::Core::IO::BodyStream> m_responseStream;
         bool m_chunked = false;
+        HandleSettings m_settings;
+        std::string m_host;
+        // The request being recorded, until the transfer finishes
+        std::unique_ptr<TraceRecord> m_trace;
 
         // ----- BodyStream implementation ( overrides )   ---- //
         size_t OnRead(uint8_t *buffer, size_t count, Azure::Core::Context const &context) override
@@ -45,8 +273,8 @@ namespace
         {
             auto start = *begin;
             auto end = std::find(start, last, separator);
-            // Move the original ptr to one place after the separator
-            *begin = end + 1;
+            // Move the original ptr to one place after the separator, never past the end
+            *begin = end == last ? last : end + 1;
             return mutator(std::string(start, end));
         }
 
@@ -57,8 +285,12 @@ namespace
         {
             // set response code, HTTP version and reason phrase (i.e. HTTP/1.1 200 OK)
             auto start = begin + HttpWordLen + 1; // HTTP = 4, / = 1, moving to 5th place for version
-            auto majorVersion = GetNextToken(&start, last, '.');
-            auto minorVersion = GetNextToken(&start, last, ' ');
+            // HTTP/2 and HTTP/3 have no minor version (i.e. HTTP/2 200)
+            auto const versionEnd = std::find_if(start, last, [](char c)
+                                                 { return c == '.' || c == ' '; });
+            auto const hasMinorVersion = versionEnd != last && *versionEnd == '.';
+            auto majorVersion = GetNextToken(&start, last, hasMinorVersion ? '.' : ' ');
+            auto minorVersion = hasMinorVersion ? GetNextToken(&start, last, ' ') : 0;
             auto statusCode = GetNextToken(&start, last, ' ');
             auto reasonPhrase = GetNextToken<std::string>(
                 &start, last, '\r', [](std::string const &value)
@@ -112,30 +344,118 @@ namespace
         static size_t ReceiveInitialResponse(char *contents, size_t size, size_t nmemb, void *userp)
         {
             size_t const expectedSize = size * nmemb;
-            std::unique_ptr<RawResponse> *rawResponse = static_cast<std::unique_ptr<RawResponse> *>(userp);
+            auto session = static_cast<CurlSession *>(userp);
+            std::unique_ptr<RawResponse> *rawResponse = &session->m_response;
 
-            // First response
-            if (*rawResponse == nullptr)
+            // Runs on the engine thread, an exception must not unwind through libcurl
+            try
             {
-                // parse header to get init data
-                *rawResponse = CreateHTTPResponse(contents, contents + expectedSize);
+                // First response
+                if (*rawResponse == nullptr)
+                {
+                    // parse header to get init data
+                    *rawResponse = CreateHTTPResponse(contents, contents + expectedSize);
+                }
+                else if (session->m_listener && session->m_headersComplete)
+                {
+                    // Trailers; the listener's owner may already be parsing the headers
+                }
+                else if (expectedSize == 2 && contents[0] == '\r' && contents[1] == '\n')
+                {
+                    // End of headers, react to throttling before the body arrives
+                    session->m_headersComplete = true;
+                    if (session->m_settings.Pacer && IsThrottlingStatus((*rawResponse)->GetStatusCode()))
+                    {
+                        session->ParseHeaders();
+                        session->ReportThrottling();
+                    }
+                    if (session->m_listener)
+                    {
+                        session->m_listener->OnHeaders();
+                    }
+                }
+                else
+                {
+                    // The loop thread only buffers, the waiting caller parses
+                    session->m_headerData.append(contents, expectedSize);
+                }
             }
-            else
+            catch (std::exception const &)
             {
-                StaticSetHeader(*(*rawResponse), contents, contents + expectedSize);
+                // Makes libcurl fail the transfer with CURLE_WRITE_ERROR
+                return 0;
             }
 
             // This callback needs to return the response size or curl will consider it as it failed
             return expectedSize;
         }
 
+        // The statuses ThrottlePacer::IsThrottlingResponse may accept, before the error code is known
+        static bool IsThrottlingStatus(HttpStatusCode statusCode)
+        {
+            auto const status = static_cast<int>(statusCode);
+            return status == 429 || status == 500 || status == 503;
+        }
+
+        void ParseHeaders()
+        {
+            if (m_headersParsed)
+            {
+                return;
+            }
+            m_headersParsed = true;
+
+            auto const last = m_headerData.data() + m_headerData.size();
+            for (auto start = m_headerData.data(); start < last;)
+            {
+                // Every line libcurl hands over ends with `\n`
+                auto end = std::find(start, last, '\n');
+                end = end == last ? last : end + 1;
+                try
+                {
+                    StaticSetHeader(*m_response, start, end);
+                }
+                catch (std::invalid_argument const &error)
+                {
+                    throw Azure::Core::Http::TransportException(std::string("Invalid response. ") + error.what());
+                }
+                start = end;
+            }
+        }
+
+        void ReportThrottling()
+        {
+            if (!m_settings.Pacer)
+            {
+                return;
+            }
+
+            auto const &headers = m_response->GetHeaders();
+            auto const errorCode = headers.find("x-ms-error-code");
+            if (!ThrottlePacer::IsThrottlingResponse(
+                    static_cast<int>(m_response->GetStatusCode()),
+                    errorCode == headers.end() ? std::string() : errorCode->second))
+            {
+                return;
+            }
+
+            auto const retryAfter = headers.find("retry-after");
+            m_settings.Pacer->OnThrottled(
+                m_host,
+                retryAfter == headers.end() ? std::chrono::milliseconds(0) : ThrottlePacer::ParseRetryAfter(retryAfter->second));
+        }
+
         static size_t ReceiveData(void *contents, size_t size, size_t nmemb, void *userp)
         {
             size_t const expectedSize = size * nmemb;
-            std::vector<uint8_t> &rawResponse = *(static_cast<std::vector<uint8_t> *>(userp));
+            auto session = static_cast<CurlSession *>(userp);
             uint8_t *data = static_cast<uint8_t *>(contents);
 
-            rawResponse.insert(rawResponse.end(), data, data + expectedSize);
+            if (session->m_listener)
+            {
+                return session->m_listener->OnData(data, expectedSize) ? expectedSize : CURL_WRITEFUNC_PAUSE;
+            }
+            session->m_responseData.insert(session->m_responseData.end(), data, data + expectedSize);
 
             // This callback needs to return the response size or curl will consider it as it failed
             return expectedSize;
@@ -150,21 +470,31 @@ namespace
             // Terminate the upload if the destination buffer is too small
             if (destSize < 1)
             {
-                throw std::runtime_error("Not enough size to continue to upload data.");
+                return CURL_READFUNC_ABORT;
             }
 
             // Copy as many bytes as possible from the stream to libcurl's destination buffer
-            return uploadStream->Read(static_cast<uint8_t *>(dst), destSize);
+            try
+            {
+                return uploadStream->Read(static_cast<uint8_t *>(dst), destSize);
+            }
+            catch (std::exception const &)
+            {
+                // Runs on the engine thread, an exception must not unwind through libcurl
+                return CURL_READFUNC_ABORT;
+            }
         }
 
     public:
-        CurlSession()
+        explicit CurlSession(HandleSettings settings) : m_settings(std::move(settings))
         {
             m_curlHandle = curl_easy_init();
             if (!m_curlHandle)
             {
                 throw std::runtime_error("Could not create a new libcurl handle");
             }
+
+            ApplyHandleSettings(m_curlHandle, m_settings);
         }
 
         ~CurlSession()
@@ -174,166 +504,283 @@ namespace
             {
                 curl_easy_cleanup(m_curlHandle);
             }
+            curl_slist_free_all(m_resolveHandle);
         }
 
-        std::unique_ptr<RawResponse> Send(Request &request, Context const &context)
+        /**
+         * Configures the handle for @p request, everything short of running the transfer.
+         */
+        void Prepare(Request &request)
         {
-            // optional
-            context.ThrowIfCancelled();
+            // 1.- Parse request into libcurl
+            auto const &url = request.GetUrl();
+            auto port = url.GetPort();
+            m_host = url.GetHost();
 
+            CURLcode operationResult;
+            //url
+            operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_URL, url.GetAbsoluteUrl().data());
+            if (operationResult != CURLE_OK)
             {
-                // 1.- Parse request into libcurl
-                auto const &url = request.GetUrl();
-                auto port = url.GetPort();
-
-                // 2.- Perform network call
-                CURLcode operationResult;
-                //url
-                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_URL, url.GetAbsoluteUrl().data());
-                if (operationResult != CURLE_OK)
+                throw std::runtime_error("Could not set URL for libcurl");
+            }
+            //port
+            operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_PORT, port);
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set Port for libcurl");
+            }
+            // local hosts skip the TCP stack, others use addresses from the transport DNS cache
+            if (!ApplyUnixSocket(m_curlHandle, m_settings, m_host))
+            {
+                m_resolveHandle = ApplyCachedResolve(m_curlHandle, m_settings, url);
+            }
+            // headers
+            auto const &headers = request.GetHeaders();
+            if (headers.size() > 0)
+            {
+                for (auto const &header : headers)
                 {
-                    throw std::runtime_error("Could not set URL for libcurl");
+                    auto newHandle = curl_slist_append(m_headerHandle, (header.first + ":" + header.second).c_str());
+                    if (newHandle == NULL)
+                    {
+                        throw std::runtime_error("Failing creating header list for libcurl");
+                    }
+                    m_headerHandle = newHandle;
                 }
-                //port
-                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_PORT, port);
+                // Add header list to handle
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_HTTPHEADER, m_headerHandle);
                 if (operationResult != CURLE_OK)
                 {
                     throw std::runtime_error("Could not set Port for libcurl");
                 }
-                // headers
-                auto const &headers = request.GetHeaders();
-                if (headers.size() > 0)
+            }
+
+            // libcurl callbacks
+            // Headers
+            operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_HEADERFUNCTION, ReceiveInitialResponse);
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set Header Function for libcurl");
+            }
+            operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_HEADERDATA, static_cast<void *>(this));
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set Header Function Data for libcurl");
+            }
+
+            // Receive data
+            operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_WRITEFUNCTION, ReceiveData);
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set Receive Function for libcurl");
+            }
+            operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_WRITEDATA, static_cast<void *>(this));
+            if (operationResult != CURLE_OK)
+            {
+                throw std::runtime_error("Could not set Receive Function Data for libcurl");
+            }
+
+            // libcurl Http Metod
+            auto const &method = request.GetMethod();
+            if (method == Azure::Core::Http::HttpMethod::Delete)
+            {
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_CUSTOMREQUEST, "DELETE");
+                if (operationResult != CURLE_OK)
                 {
-                    for (auto const &header : headers)
-                    {
-                        auto newHandle = curl_slist_append(m_headerHandle, (header.first + ":" + header.second).c_str());
-                        if (newHandle == NULL)
-                        {
-                            throw std::runtime_error("Failing creating header list for libcurl");
-                        }
-                        m_headerHandle = newHandle;
-                    }
-                    // Add header list to handle
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_HTTPHEADER, m_headerHandle);
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set Port for libcurl");
-                    }
+                    throw std::runtime_error("Could not set Custom DELETE for libcurl");
                 }
-
-                // libcurl callbacks
-                // Headers
-                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_HEADERFUNCTION, ReceiveInitialResponse);
+            }
+            else if (method == Azure::Core::Http::HttpMethod::Patch)
+            {
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_CUSTOMREQUEST, "PATCH");
                 if (operationResult != CURLE_OK)
                 {
-                    throw std::runtime_error("Could not set Header Function for libcurl");
+                    throw std::runtime_error("Could not set Custom PATCH for libcurl");
                 }
-                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_HEADERDATA, static_cast<void *>(&m_response));
+            }
+            else if (method == Azure::Core::Http::HttpMethod::Head)
+            {
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_NOBODY, 1L);
                 if (operationResult != CURLE_OK)
                 {
-                    throw std::runtime_error("Could not set Header Function Data for libcurl");
+                    throw std::runtime_error("Could not set Head NoBody for libcurl");
                 }
+            }
+            else if (method == Azure::Core::Http::HttpMethod::Post)
+            {
+                // Adds special header "Expect:" for libcurl to avoid sending only headers to server and wait
+                // for a 100 Continue response before sending a PUT method
+                auto newHandle = curl_slist_append(m_headerHandle, "Expect:");
+                if (newHandle == NULL)
+                {
+                    throw std::runtime_error("Failing adding Expect header for POST");
+                }
+                m_headerHandle = newHandle;
 
-                // Receive data
-                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_WRITEFUNCTION, ReceiveData);
+                m_sendBuffer = request.GetBodyStream()->ReadToEnd();
+                m_sendBuffer.emplace_back('\0'); // the body is expected to be null terminated
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_POSTFIELDS, reinterpret_cast<char *>(m_sendBuffer.data()));
                 if (operationResult != CURLE_OK)
                 {
-                    throw std::runtime_error("Could not set Receive Function for libcurl");
+                    throw std::runtime_error("Could not set CURLOPT_POSTFIELDS for libcurl");
                 }
-                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_WRITEDATA, static_cast<void *>(&m_responseData));
-                if (operationResult != CURLE_OK)
+            }
+            else if (method == Azure::Core::Http::HttpMethod::Put)
+            {
+                // As of CURL 7.12.1 CURLOPT_PUT is deprecated.  PUT requests should be made using
+                // CURLOPT_UPLOAD
+
+                // Adds special header "Expect:" for libcurl to avoid sending only headers to server and wait
+                // for a 100 Continue response before sending a PUT method
+                auto newHandle = curl_slist_append(m_headerHandle, "Expect:");
+                if (newHandle == NULL)
                 {
-                    throw std::runtime_error("Could not set Receive Function Data for libcurl");
+                    throw Azure::Core::Http::TransportException("Failing adding Expect header for POST");
                 }
+                m_headerHandle = newHandle;
 
-                // libcurl Http Metod
-                auto const &method = request.GetMethod();
-                if (method == Azure::Core::Http::HttpMethod::Delete)
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_UPLOAD, 1L);
+                if (operationResult != CURLE_OK)
                 {
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_CUSTOMREQUEST, "DELETE");
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set Custom DELETE for libcurl");
-                    }
+                    throw std::runtime_error("Could not set CURLOPT_UPLOAD for libcurl");
                 }
-                else if (method == Azure::Core::Http::HttpMethod::Patch)
+
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_READFUNCTION, UploadData);
+                if (operationResult != CURLE_OK)
                 {
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_CUSTOMREQUEST, "PATCH");
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set Custom PATCH for libcurl");
-                    }
+                    throw std::runtime_error("Could not set CURLOPT_READFUNCTION for libcurl");
                 }
-                else if (method == Azure::Core::Http::HttpMethod::Head)
+                auto uploadStream = request.GetBodyStream();
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_READDATA, static_cast<void *>(uploadStream));
+                if (operationResult != CURLE_OK)
                 {
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_NOBODY, 1L);
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set Head NoBody for libcurl");
-                    }
+                    throw std::runtime_error("Could not set CURLOPT_READDATA for libcurl");
                 }
-                else if (method == Azure::Core::Http::HttpMethod::Post)
+
+                operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_INFILESIZE, static_cast<curl_off_t>(uploadStream->Length()));
+                if (operationResult != CURLE_OK)
                 {
-                    // Adds special header "Expect:" for libcurl to avoid sending only headers to server and wait
-                    // for a 100 Continue response before sending a PUT method
-                    auto newHandle = curl_slist_append(m_headerHandle, "Expect:");
-                    if (newHandle == NULL)
-                    {
-                        throw std::runtime_error("Failing adding Expect header for POST");
-                    }
-                    m_headerHandle = newHandle;
+                    throw std::runtime_error("Could not set CURLOPT_INFILESIZE for libcurl");
+                }
+            }
 
-                    m_sendBuffer = request.GetBodyStream()->ReadToEnd();
-                    m_sendBuffer.emplace_back('\0'); // the body is expected to be null terminated
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_POSTFIELDS, reinterpret_cast<char *>(m_sendBuffer.data()));
-                    if (operationResult != CURLE_OK)
+            // What gets recorded once the transfer finishes
+            if (m_settings.Recorder)
+            {
+                m_trace = std::make_unique<TraceRecord>();
+                m_trace->Method = method.ToString();
+                m_trace->Url = MyNameSpace::_detail::RedactUrl(url.GetAbsoluteUrl());
+                for (auto const &header : headers)
+                {
+                    auto value = header.second;
+                    if (MyNameSpace::_detail::RedactHeader(header.first, value))
                     {
-                        throw std::runtime_error("Could not set CURLOPT_POSTFIELDS for libcurl");
+                        m_trace->RequestHeaders.emplace_back(header.first, std::move(value));
                     }
                 }
-                else if (method == Azure::Core::Http::HttpMethod::Put)
-                {
-                    // As of CURL 7.12.1 CURLOPT_PUT is deprecated.  PUT requests should be made using
-                    // CURLOPT_UPLOAD
+                auto const body = request.GetBodyStream();
+                m_trace->RequestBodySize = body ? static_cast<uint64_t>(std::max<int64_t>(body->Length(), 0)) : 0;
+            }
+        }
 
-                    // Adds special header "Expect:" for libcurl to avoid sending only headers to server and wait
-                    // for a 100 Continue response before sending a PUT method
-                    auto newHandle = curl_slist_append(m_headerHandle, "Expect:");
-                    if (newHandle == NULL)
-                    {
-                        throw Azure::Core::Http::TransportException("Failing adding Expect header for POST");
-                    }
-                    m_headerHandle = newHandle;
+        /**
+         * Streams the response to @p listener instead of buffering it for OnRead. Set before the
+         * transfer starts.
+         */
+        void SetListener(TransferListener *listener) { m_listener = listener; }
 
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_UPLOAD, 1L);
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set CURLOPT_UPLOAD for libcurl");
-                    }
+        CURL *GetHandle() const { return m_curlHandle; }
+        HandleSettings const &GetSettings() const { return m_settings; }
+        std::string const &GetHost() const { return m_host; }
 
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_READFUNCTION, UploadData);
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set CURLOPT_READFUNCTION for libcurl");
-                    }
-                    auto uploadStream = request.GetBodyStream();
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_READDATA, static_cast<void *>(uploadStream));
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set CURLOPT_READDATA for libcurl");
-                    }
+        /**
+         * The response without a body stream, once the listener has seen OnHeaders. Parses the headers
+         * on the calling thread.
+         */
+        std::unique_ptr<RawResponse> TakeResponse()
+        {
+            ParseHeaders();
+            return std::move(m_response);
+        }
 
-                    operationResult = curl_easy_setopt(m_curlHandle, CURLOPT_INFILESIZE, static_cast<curl_off_t>(uploadStream->Length()));
-                    if (operationResult != CURLE_OK)
-                    {
-                        throw std::runtime_error("Could not set CURLOPT_INFILESIZE for libcurl");
-                    }
+        std::unique_ptr<RawResponse> Send(Request &request, Context const &context)
+        {
+            // optional
+            context.ThrowIfCancelled();
+
+            Prepare(request);
+
+            // 2.- Perform network call
+            WaitForPacer(context);
+
+            // Perform libcurl transfer on the transport engine
+            auto const performResult = m_settings.Engine->Perform(m_curlHandle, m_host, context, GetTransferAttributes(context));
+            if (auto timing = GetTiming(context))
+            {
+                FillTiming(m_curlHandle, performResult.TcpInfo, *timing);
+            }
+            return Finish(performResult.Code, context);
+        }
+
+        /**
+         * Spreads requests to a throttling account instead of adding to its overload.
+         */
+        void WaitForPacer(Context const &context)
+        {
+            if (m_settings.Pacer)
+            {
+                m_settings.Pacer->Wait(m_host, context);
+            }
+        }
+
+        /**
+         * Hands the finished transfer to the recorder, with the response unless it ended in @p error.
+         */
+        void RecordTrace(std::string error)
+        {
+            if (!m_trace)
+            {
+                return;
+            }
+            auto trace = std::move(m_trace);
+            trace->Error = std::move(error);
+            if (trace->Error.empty())
+            {
+                trace->StatusCode = static_cast<int32_t>(m_response->GetStatusCode());
+                trace->ReasonPhrase = m_response->GetReasonPhrase();
+                for (auto const &header : m_response->GetHeaders())
+                {
+                    trace->ResponseHeaders.emplace_back(header.first, header.second);
                 }
+                trace->Body = m_responseData;
+            }
+            curl_off_t firstByte = 0;
+            curl_off_t total = 0;
+            curl_easy_getinfo(m_curlHandle, CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+            curl_easy_getinfo(m_curlHandle, CURLINFO_TOTAL_TIME_T, &total);
+            trace->FirstByte = std::chrono::microseconds(firstByte);
+            trace->Total = std::chrono::microseconds(total);
+            m_settings.Recorder->Append(*trace);
+        }
 
-                // Perform libcurl transfer
-                auto performResult = curl_easy_perform(m_curlHandle);
+        /**
+         * Builds the response once the transfer has run to @p performResult, on the calling thread.
+         * Throws when the transfer failed.
+         */
+        std::unique_ptr<RawResponse> Finish(CURLcode performResult, Context const &context)
+        {
+            if (performResult != CURLE_OK || m_response == nullptr)
+            {
+                context.ThrowIfCancelled();
+                auto const error = std::string("Error while sending request. ") + curl_easy_strerror(performResult);
+                RecordTrace(error);
+                throw Azure::Core::Http::TransportException(error);
             }
 
+            ParseHeaders();
+            RecordTrace(std::string());
+
             // 3.- Create a Azure body stream for the RawResponse
             m_responseStream = std::make_unique<Azure::Core::IO::MemoryBodyStream>(m_responseData);
 
@@ -352,14 +799,670 @@ namespace
     };
 }
 
+#if defined(MY_TRANSPORT_HAS_COROUTINES)
 namespace MyNameSpace
 {
+    namespace _detail
+    {
+        /**
+         * One SendAsync transfer: the session streaming its response here from the loop thread, and the
+         * coroutine waiting on it. The completion callback keeps it alive until the engine is done.
+         */
+        class AsyncTransfer final : public TransferListener, public std::enable_shared_from_this<AsyncTransfer>
+        {
+        public:
+            AsyncTransfer(
+                HandleSettings settings,
+                TransferAttributes attributes,
+                std::shared_ptr<RequestTiming> timing,
+                std::shared_ptr<CompletionExecutor> executor)
+                : m_session(std::move(settings)), m_attributes(std::move(attributes)), m_timing(std::move(timing)),
+                  m_executor(std::move(executor))
+            {
+                m_session.SetListener(this);
+            }
+
+            void Prepare(Request &request) { m_session.Prepare(request); }
+
+            void Start(std::coroutine_handle<> awaiter)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_awaiter = awaiter;
+                }
+                try
+                {
+                    auto self = shared_from_this();
+                    m_session.GetSettings().Engine->Submit(
+                        m_session.GetHandle(), m_session.GetHost(), [self](TransferResult const &result)
+                        { self->OnCompleted(result); },
+                        m_attributes);
+                }
+                catch (...)
+                {
+                    // Resumes the coroutine with the exception
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_awaiter = nullptr;
+                    throw;
+                }
+            }
+
+            AsyncResponse TakeResponse()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!m_result.Rejection.empty())
+                    {
+                        throw TransportException(m_result.Rejection);
+                    }
+                    if (!m_headersReady)
+                    {
+                        throw TransportException(std::string("Error while sending request. ") + curl_easy_strerror(m_result.Code));
+                    }
+                }
+
+                // The loop thread is done with the headers once they are ready
+                AsyncResponse response;
+                response.Response = m_session.TakeResponse();
+                response.Body = std::make_unique<AsyncBodyStream>(shared_from_this());
+                return response;
+            }
+
+            bool SuspendRead(std::coroutine_handle<> awaiter)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_bodyOffset < m_body.size() || m_done)
+                {
+                    return false;
+                }
+                m_awaiter = awaiter;
+                return true;
+            }
+
+            size_t Read(std::span<uint8_t> buffer)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto const count = std::min(buffer.size(), m_body.size() - m_bodyOffset);
+                std::copy_n(m_body.begin() + m_bodyOffset, count, buffer.begin());
+                m_bodyOffset += count;
+                if (m_bodyOffset == m_body.size())
+                {
+                    m_body.clear();
+                    m_bodyOffset = 0;
+                }
+                if (m_paused && m_body.size() - m_bodyOffset < MaxBufferedBody)
+                {
+                    m_paused = false;
+                    m_session.GetSettings().Engine->Unpause(m_session.GetHandle());
+                }
+
+                if (count == 0 && m_result.Code != CURLE_OK)
+                {
+                    throw TransportException(std::string("Error while receiving response. ") + curl_easy_strerror(m_result.Code));
+                }
+                return count;
+            }
+
+            void Cancel()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_done)
+                {
+                    m_session.GetSettings().Engine->Cancel(m_session.GetHandle());
+                }
+            }
+
+            void OnHeaders() override
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_headersReady = true;
+                Resume(lock);
+            }
+
+            bool OnData(uint8_t const *data, size_t size) override
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_body.size() - m_bodyOffset >= MaxBufferedBody)
+                {
+                    // A slow reader holds the transfer back instead of having it buffered here
+                    m_paused = true;
+                    return false;
+                }
+                if (m_bodyOffset >= m_body.size() / 2)
+                {
+                    // Drops what was read once it outweighs the rest, so the copy stays amortized
+                    m_body.erase(m_body.begin(), m_body.begin() + m_bodyOffset);
+                    m_bodyOffset = 0;
+                }
+                m_body.insert(m_body.end(), data, data + size);
+                Resume(lock);
+                return true;
+            }
+
+        private:
+            CurlSession m_session;
+            TransferAttributes m_attributes;
+            std::shared_ptr<RequestTiming> m_timing;
+            std::shared_ptr<CompletionExecutor> m_executor;
+
+            std::mutex m_mutex;
+            // The coroutine suspended on this transfer, if any
+            std::coroutine_handle<> m_awaiter;
+            bool m_headersReady = false;
+            bool m_done = false;
+            TransferResult m_result{CURLE_OK, std::string()};
+            std::vector<uint8_t> m_body;
+            size_t m_bodyOffset = 0;
+            // Set when OnData refused data, until Read makes room for it
+            bool m_paused = false;
+
+            void OnCompleted(TransferResult const &result)
+            {
+                if (m_timing)
+                {
+                    // Before the coroutine can resume and read it
+                    FillTiming(m_session.GetHandle(), result.TcpInfo, *m_timing);
+                }
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done = true;
+                m_result = result;
+                Resume(lock);
+            }
+
+            void Resume(std::unique_lock<std::mutex> &lock)
+            {
+                auto awaiter = m_awaiter;
+                m_awaiter = nullptr;
+                lock.unlock();
+                if (awaiter)
+                {
+                    // Never on the loop thread, the coroutine may run for a while
+                    m_executor->Post([awaiter]()
+                                     { awaiter.resume(); });
+                }
+            }
+        };
+    }
+
+    AsyncBodyStream::~AsyncBodyStream() { m_transfer->Cancel(); }
+
+    bool AsyncBodyStream::ReadOperation::await_suspend(std::coroutine_handle<> awaiter)
+    {
+        return m_transfer->SuspendRead(awaiter);
+    }
+
+    size_t AsyncBodyStream::ReadOperation::await_resume() { return m_transfer->Read(m_buffer); }
+
+    void MyTransport::SendOperation::await_suspend(std::coroutine_handle<> awaiter)
+    {
+        // The coroutine may resume, and destroy this awaiter, before Start returns
+        auto transfer = m_transfer;
+        transfer->Start(awaiter);
+    }
+
+    AsyncResponse MyTransport::SendOperation::await_resume() { return m_transfer->TakeResponse(); }
+}
+#endif
+
+namespace MyNameSpace
+{
+    MyTransport::MyTransport(MyTransportOptions const &options)
+        : m_options(options),
+          m_metrics(std::make_shared<_detail::MetricsRegistry>()),
+          m_caStore(_detail::CaStore::GetInstance(options.CaBundlePath, options.CaBundleRefreshInterval))
+    {
+        _detail::CurlEngineOptions engineOptions;
+        engineOptions.MaxConnectionsPerHost = static_cast<long>(options.MaxConnectionsPerHost);
+        engineOptions.MaxTotalConnections = static_cast<long>(options.MaxTotalConnections);
+        engineOptions.MaxCachedConnections = static_cast<long>(options.MaxCachedConnections);
+        engineOptions.MaxConnectionIdleTime = options.MaxConnectionIdleTime;
+        engineOptions.MaxConnectionAge = options.MaxConnectionAge;
+        engineOptions.UpkeepInterval = options.ConnectionUpkeepInterval;
+        engineOptions.HealthCheckBeforeReuse = options.ConnectionHealthCheck;
+        engineOptions.Admission.MaxInFlightPerHost = options.MaxRequestsInFlightPerHost;
+        engineOptions.Admission.MaxQueueDepthPerHost = options.MaxQueuedRequestsPerHost;
+        engineOptions.Admission.Adaptive = options.AdaptiveConcurrency;
+        engineOptions.Admission.Limiter.InitialLimit = options.InitialRequestsInFlightPerHost;
+        engineOptions.Breaker.ConsecutiveFailureThreshold = options.CircuitBreakerThreshold;
+        engineOptions.Breaker.OpenDuration = options.CircuitBreakerOpenDuration;
+        engineOptions.Breaker.MaxOpenDuration = std::max(engineOptions.Breaker.MaxOpenDuration, options.CircuitBreakerOpenDuration);
+        engineOptions.BackgroundMaxSendSpeed = static_cast<curl_off_t>(options.BackgroundMaxSendSpeed);
+        if (options.TenantBandwidth > 0 || !options.TenantWeights.empty() || !options.TenantMaxBytesPerSecond.empty())
+        {
+            // Takes a lock shared by every engine, so without limits the engines keep the tenant metrics
+            _detail::BandwidthOptions bandwidthOptions;
+            bandwidthOptions.Capacity = options.TenantBandwidth;
+            bandwidthOptions.Weights = options.TenantWeights;
+            bandwidthOptions.MaxRates = options.TenantMaxBytesPerSecond;
+            engineOptions.Bandwidth = std::make_shared<_detail::BandwidthAllocator>(std::move(bandwidthOptions), m_metrics);
+        }
+        _detail::SocketProfile socketProfile;
+        socketProfile.ReceiveBufferSize = static_cast<int>(options.SocketReceiveBufferSize);
+        socketProfile.SendBufferSize = static_cast<int>(options.SocketSendBufferSize);
+        socketProfile.AutoTuneBuffers = options.SocketBufferAutoTuning;
+        socketProfile.MaxBufferSize = static_cast<int>(options.SocketMaxBufferSize);
+        socketProfile.NoDelay = options.TcpNoDelay;
+        socketProfile.KeepAliveIdle = options.TcpKeepAliveIdle;
+        socketProfile.KeepAliveInterval = options.TcpKeepAliveInterval;
+        socketProfile.KeepAliveProbes = options.TcpKeepAliveProbes;
+        socketProfile.BusyPoll = options.SocketBusyPoll;
+        engineOptions.Sockets = std::make_shared<_detail::SocketTuner>(socketProfile, m_metrics);
+        engineOptions.TcpInfoInterval = options.TcpInfoSampleInterval;
+        if (options.CompletionThreads > 0)
+        {
+            // Shared by every event loop
+            m_completions = _detail::MakeTransportShared<_detail::CompletionExecutor>(options.CompletionThreads, m_metrics);
+            engineOptions.Completions = m_completions;
+        }
+#if defined(MY_TRANSPORT_HAS_COROUTINES)
+        else
+        {
+            // Only resumes coroutines, Submit callbacks stay on the event loops
+            m_completions = _detail::MakeTransportShared<_detail::CompletionExecutor>(1, m_metrics);
+        }
+#endif
+        m_shards = std::make_shared<_detail::EngineShards>(
+            options.EventLoops,
+            engineOptions,
+            options.EventLoopCpus,
+            options.EventLoopRouting == EventLoopRoutingPolicy::LeastLoaded,
+            m_metrics);
+
+        if (options.DnsCacheTtl.count() > 0)
+        {
+            m_dnsCache = std::make_shared<_detail::DnsCache>(options.DnsCacheTtl);
+        }
+
+        if (!options.UnixSocketHosts.empty())
+        {
+            m_unixSockets = std::make_shared<std::map<std::string, std::string> const>(options.UnixSocketHosts);
+        }
+
+        if (!options.RecordPath.empty())
+        {
+            m_recorder = std::make_shared<_detail::TraceWriter>(options.RecordPath);
+        }
+
+        if (options.ThrottlePacing)
+        {
+            m_throttlePacer = std::make_shared<_detail::ThrottlePacer>(m_metrics);
+        }
+
+        if (!options.TlsSessionCachePath.empty())
+        {
+            m_tlsSessionStore = std::make_shared<_detail::TlsSessionStore>(
+                options.TlsSessionCachePath,
+                options.TlsSessionCacheKey,
+                m_shards->GetShares(),
+                options.TlsSessionCacheSaveInterval);
+        }
+    }
+
+    Context MyTransport::WithPriority(Context const &context, RequestPriority priority)
+    {
+        return context.WithValue(PriorityKey, priority);
+    }
+
+    Context MyTransport::WithTenant(Context const &context, std::string tenant)
+    {
+        return context.WithValue(TenantKey, std::move(tenant));
+    }
+
+    Context MyTransport::WithTiming(Context const &context, std::shared_ptr<RequestTiming> timing)
+    {
+        return context.WithValue(TimingKey, std::move(timing));
+    }
+
+    _detail::HandleSettings MyTransport::CreateHandleSettings(_detail::EngineShard const &shard) const
+    {
+        _detail::HandleSettings settings;
+        settings.Share = shard.Share;
+        settings.Engine = shard.Engine;
+        settings.CaCertificates = m_caStore ? m_caStore->GetBundle() : nullptr;
+        settings.Resolver = m_dnsCache;
+        settings.Pacer = m_throttlePacer;
+        settings.UnixSockets = m_unixSockets;
+        settings.Recorder = m_recorder;
+        switch (m_options.Protocol)
+        {
+        case HttpProtocol::Http1:
+            settings.HttpVersion = CURL_HTTP_VERSION_1_1;
+            break;
+        case HttpProtocol::Http2:
+            settings.HttpVersion = CURL_HTTP_VERSION_2TLS;
+            break;
+        default:
+            settings.HttpVersion = CURL_HTTP_VERSION_NONE;
+            break;
+        }
+        settings.WaitForMultiplexing = m_options.Protocol == HttpProtocol::Http2;
+        settings.MaxConnectionIdleSeconds = static_cast<long>(m_options.MaxConnectionIdleTime.count());
+        settings.MaxConnectionAgeSeconds = static_cast<long>(m_options.MaxConnectionAge.count());
+        return settings;
+    }
+
+    size_t MyTransport::Prewarm(
+        std::vector<Azure::Core::Url> const &endpoints,
+        size_t connectionsPerHost,
+        Context const &context)
+    {
+        struct Prewarming
+        {
+            std::mutex Mutex;
+            std::condition_variable Condition;
+            size_t Pending = 0;
+            size_t Warmed = 0;
+        };
+        auto prewarming = std::make_shared<Prewarming>();
+
+        std::vector<CURL *> easyHandles;
+        // The engine each handle runs on
+        std::vector<std::shared_ptr<_detail::CurlEngine>> handleEngines;
+        std::vector<struct curl_slist *> resolveHandles;
+        auto cleanup = [&]()
+        {
+            for (auto handle : easyHandles)
+            {
+                curl_easy_cleanup(handle);
+            }
+            for (auto resolveHandle : resolveHandles)
+            {
+                curl_slist_free_all(resolveHandle);
+            }
+        };
+
+        try
+        {
+            for (auto const &endpoint : endpoints)
+            {
+                auto origin = endpoint.GetScheme() + "://" + endpoint.GetHost();
+                if (endpoint.GetPort() != 0)
+                {
+                    origin += ":" + std::to_string(endpoint.GetPort());
+                }
+                origin += "/";
+
+                // Connections are spread over every loop the host's requests can be routed to
+                auto const shards = m_shards->GetCandidates(endpoint.GetHost());
+                for (size_t i = 0; i < connectionsPerHost; ++i)
+                {
+                    auto const settings = CreateHandleSettings(*shards[i % shards.size()]);
+                    auto handle = curl_easy_init();
+                    if (!handle)
+                    {
+                        throw std::runtime_error("Could not create a new libcurl handle");
+                    }
+                    easyHandles.push_back(handle);
+                    handleEngines.push_back(settings.Engine);
+                    ApplyHandleSettings(handle, settings);
+
+                    // A connect-only transfer leaves a connection libcurl never hands to regular
+                    // transfers, so a HEAD to the origin is what parks a reusable keep-alive socket
+                    // in the shared cache. The response status does not matter.
+                    curl_easy_setopt(handle, CURLOPT_URL, origin.c_str());
+                    curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+                    // Also warms the DNS cache for the endpoint, unless it is reached over a Unix socket
+                    if (!ApplyUnixSocket(handle, settings, endpoint.GetHost()))
+                    {
+                        if (auto resolveHandle = ApplyCachedResolve(handle, settings, endpoint))
+                        {
+                            resolveHandles.push_back(resolveHandle);
+                        }
+                    }
+                }
+            }
+
+            // Running all of them at once makes libcurl open one connection per concurrent transfer
+            size_t handleIndex = 0;
+            for (auto const &endpoint : endpoints)
+            {
+                for (size_t i = 0; i < connectionsPerHost; ++i)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(prewarming->Mutex);
+                        ++prewarming->Pending;
+                    }
+                    // Queues behind regular requests when the host is at its in-flight limit. A host
+                    // that is failing fast or has a full queue completes it straight away, unwarmed.
+                    auto const index = handleIndex++;
+                    handleEngines[index]->Submit(
+                        easyHandles[index], endpoint.GetHost(), [prewarming](_detail::TransferResult const &result)
+                        {
+                            std::lock_guard<std::mutex> lock(prewarming->Mutex);
+                            --prewarming->Pending;
+                            if (result.Code == CURLE_OK)
+                            {
+                                ++prewarming->Warmed;
+                            }
+                            prewarming->Condition.notify_all(); },
+                        _detail::TransferAttributes{_detail::TransferPriority{static_cast<int>(RequestPriority::Background)}, std::string()});
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(prewarming->Mutex);
+            bool cancelRequested = false;
+            while (!prewarming->Condition.wait_for(lock, std::chrono::milliseconds(100), [&prewarming]()
+                                                   { return prewarming->Pending == 0; }))
+            {
+                if (!cancelRequested && context.IsCancelled())
+                {
+                    for (size_t i = 0; i < easyHandles.size(); ++i)
+                    {
+                        handleEngines[i]->Cancel(easyHandles[i]);
+                    }
+                    cancelRequested = true;
+                }
+            }
+        }
+        catch (...)
+        {
+            // Handles already submitted must be detached before they are cleaned up
+            for (size_t i = 0; i < handleEngines.size(); ++i)
+            {
+                handleEngines[i]->Cancel(easyHandles[i]);
+            }
+            std::unique_lock<std::mutex> lock(prewarming->Mutex);
+            prewarming->Condition.wait(lock, [&prewarming]()
+                                       { return prewarming->Pending == 0; });
+            lock.unlock();
+            cleanup();
+            throw;
+        }
+        cleanup();
+
+        context.ThrowIfCancelled();
+        return prewarming->Warmed;
+    }
+
+    std::map<std::string, double> MyTransport::GetMetrics() const { return m_metrics->Snapshot(); }
+
     std::unique_ptr<RawResponse> MyTransport::Send(Request &request, Context const &context)
     {
         // Set up.
-        auto session = std::make_unique<CurlSession>();
+        auto session = std::make_unique<CurlSession>(CreateHandleSettings(m_shards->Route(request.GetUrl().GetHost())));
         auto response = session->Send(request, context);
         response->SetBodyStream(std::move(session));
         return response;
     }
-}
\ No newline at end of file
+
+    void MyTransport::SendMany(
+        std::vector<Request *> const &requests,
+        std::function<void(SendManyResult)> const &onResult,
+        Context const &context)
+    {
+        // Completions are handed back to the calling thread, which builds the responses
+        struct Batch
+        {
+            std::mutex Mutex;
+            std::condition_variable Condition;
+            std::vector<std::pair<size_t, _detail::TransferResult>> Completed;
+        };
+        auto batch = std::make_shared<Batch>();
+
+        std::vector<std::unique_ptr<CurlSession>> sessions(requests.size());
+        // The sessions must outlive their transfers, so a throwing callback is only rethrown at the end
+        std::exception_ptr callbackError;
+        auto deliver = [&onResult, &callbackError](SendManyResult result)
+        {
+            try
+            {
+                onResult(std::move(result));
+            }
+            catch (...)
+            {
+                if (!callbackError)
+                {
+                    callbackError = std::current_exception();
+                }
+            }
+        };
+        auto fail = [&deliver](size_t index, std::exception_ptr error)
+        {
+            SendManyResult result;
+            result.Index = index;
+            result.Error = std::move(error);
+            deliver(std::move(result));
+        };
+
+        auto const attributes = GetTransferAttributes(context);
+        size_t pending = 0;
+        for (size_t index = 0; index < requests.size(); ++index)
+        {
+            try
+            {
+                context.ThrowIfCancelled();
+                auto &request = *requests[index];
+                auto session = std::make_unique<CurlSession>(CreateHandleSettings(m_shards->Route(request.GetUrl().GetHost())));
+                session->Prepare(request);
+                session->WaitForPacer(context);
+
+                auto const &settings = session->GetSettings();
+                settings.Engine->Submit(
+                    session->GetHandle(), session->GetHost(), [batch, index](_detail::TransferResult const &result)
+                    {
+                        std::lock_guard<std::mutex> lock(batch->Mutex);
+                        batch->Completed.emplace_back(index, result);
+                        batch->Condition.notify_one(); },
+                    attributes);
+                sessions[index] = std::move(session);
+                ++pending;
+            }
+            catch (...)
+            {
+                fail(index, std::current_exception());
+            }
+        }
+
+        std::vector<std::pair<size_t, _detail::TransferResult>> completed;
+        bool cancelRequested = false;
+        while (pending > 0)
+        {
+            {
+                std::unique_lock<std::mutex> lock(batch->Mutex);
+                batch->Condition.wait_for(lock, CancellationPollInterval, [&batch]()
+                                          { return !batch->Completed.empty(); });
+                completed.swap(batch->Completed);
+            }
+
+            if (!cancelRequested && context.IsCancelled())
+            {
+                // Every handle stays owned here until its callback has run
+                for (auto const &session : sessions)
+                {
+                    if (session)
+                    {
+                        session->GetSettings().Engine->Cancel(session->GetHandle());
+                    }
+                }
+                cancelRequested = true;
+            }
+
+            for (auto &completion : completed)
+            {
+                --pending;
+                auto const index = completion.first;
+                auto session = std::move(sessions[index]);
+                auto const &transferResult = completion.second;
+                SendManyResult result;
+                result.Index = index;
+                try
+                {
+                    if (!transferResult.Rejection.empty())
+                    {
+                        throw TransportException(transferResult.Rejection);
+                    }
+                    result.Response = session->Finish(transferResult.Code, context);
+                    result.Response->SetBodyStream(std::move(session));
+                }
+                catch (...)
+                {
+                    result.Error = std::current_exception();
+                }
+                deliver(std::move(result));
+            }
+            completed.clear();
+        }
+
+        if (callbackError)
+        {
+            std::rethrow_exception(callbackError);
+        }
+    }
+
+    std::vector<SendManyResult> MyTransport::SendMany(std::vector<Request *> const &requests, Context const &context)
+    {
+        std::vector<SendManyResult> results(requests.size());
+        SendMany(
+            requests, [&results](SendManyResult result)
+            { results[result.Index] = std::move(result); },
+            context);
+        return results;
+    }
+
+    void MyTransport::Submit(Request &request, std::function<void(SendManyResult)> onComplete, Context const &context)
+    {
+        context.ThrowIfCancelled();
+
+        // Owned by the completion callback from here on; the engine copies callbacks, so it is shared
+        auto session = std::make_shared<std::unique_ptr<CurlSession>>(
+            std::make_unique<CurlSession>(CreateHandleSettings(m_shards->Route(request.GetUrl().GetHost()))));
+        (*session)->Prepare(request);
+
+        auto const &settings = (*session)->GetSettings();
+        settings.Engine->Submit(
+            (*session)->GetHandle(), (*session)->GetHost(), [session, onComplete, context](_detail::TransferResult const &transferResult)
+            {
+                SendManyResult result;
+                try
+                {
+                    if (!transferResult.Rejection.empty())
+                    {
+                        throw TransportException(transferResult.Rejection);
+                    }
+                    result.Response = (*session)->Finish(transferResult.Code, context);
+                    result.Response->SetBodyStream(std::move(*session));
+                }
+                catch (...)
+                {
+                    result.Error = std::current_exception();
+                }
+                session->reset();
+                onComplete(std::move(result)); },
+            GetTransferAttributes(context));
+    }
+
+#if defined(MY_TRANSPORT_HAS_COROUTINES)
+    MyTransport::SendOperation MyTransport::SendAsync(Request &request, Context const &context)
+    {
+        context.ThrowIfCancelled();
+
+        auto transfer = std::make_shared<_detail::AsyncTransfer>(
+            CreateHandleSettings(m_shards->Route(request.GetUrl().GetHost())),
+            GetTransferAttributes(context),
+            GetTiming(context),
+            m_completions);
+        transfer->Prepare(request);
+        return SendOperation(std::move(transfer));
+    }
+#endif
+}
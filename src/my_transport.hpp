@@ -4,11 +4,596 @@
 
 #include <azure/core/http/transport.hpp>
 
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(MY_TRANSPORT_HAS_COROUTINES)
+#include <coroutine>
+#include <span>
+#endif
+
 namespace MyNameSpace
 {
+    namespace _detail
+    {
+#if defined(MY_TRANSPORT_HAS_COROUTINES)
+        class AsyncTransfer;
+#endif
+        class CaStore;
+        class CompletionExecutor;
+        class DnsCache;
+        struct EngineShard;
+        class EngineShards;
+        class MetricsRegistry;
+        struct HandleSettings;
+        class ThrottlePacer;
+        class TlsSessionStore;
+        class TraceWriter;
+    }
+
+    /**
+     * How requests are spread over the transport's event loops
+     */
+    enum class EventLoopRoutingPolicy
+    {
+        /**
+         * Every request to a host goes to the same loop, which keeps its connections and limits in
+         * one place.
+         */
+        HostHash,
+
+        /**
+         * Each request goes to the loop with the fewest outstanding transfers.
+         */
+        LeastLoaded,
+    };
+
+    /**
+     * Scheduling class of a request, set on its context with MyTransport::WithPriority
+     */
+    enum class RequestPriority
+    {
+        /**
+         * Bulk work such as large uploads. Runs after everything else queued for its host, and its
+         * uploads are slowed down while interactive requests are outstanding.
+         */
+        Background = -1,
+
+        /**
+         * The default for requests without a priority.
+         */
+        Normal = 0,
+
+        /**
+         * Latency sensitive requests, which run ahead of everything else queued for their host.
+         */
+        Interactive = 1,
+    };
+
+    /**
+     * HTTP version the transport speaks, set with MyTransportOptions::Protocol
+     */
+    enum class HttpProtocol
+    {
+        /**
+         * libcurl's default: HTTP/2 over TLS when the server offers it, HTTP/1.1 otherwise.
+         */
+        Automatic,
+
+        /**
+         * HTTP/1.1 only, one request per connection at a time. For endpoints whose HTTP/2 support is
+         * missing or slower.
+         */
+        Http1,
+
+        /**
+         * HTTP/2 over TLS when the server offers it, with concurrent requests waiting for an existing
+         * connection to multiplex on rather than each opening its own.
+         */
+        Http2,
+    };
+
+    /**
+     * Options to tune the behavior of #MyTransport
+     */
+    struct MyTransportOptions
+    {
+        /**
+         * Path to the PEM CA bundle loaded once and shared by every handle. When empty, the system
+         * bundle is located automatically.
+         */
+        std::string CaBundlePath;
+
+        /**
+         * How often the CA bundle file is checked for changes. Zero disables background refresh.
+         */
+        std::chrono::seconds CaBundleRefreshInterval = std::chrono::seconds(60);
+
+        /**
+         * When set, TLS session tickets are persisted to this file and preloaded on construction so a
+         * restarted process can resume sessions instead of doing full handshakes. Requires libcurl
+         * 8.12.0 or newer built with SSL session export support.
+         */
+        std::string TlsSessionCachePath;
+
+        /**
+         * 32 byte AES-256-GCM key used to encrypt the TLS session cache at rest.
+         */
+        std::vector<uint8_t> TlsSessionCacheKey;
+
+        /**
+         * How often the TLS session cache is written to disk. It is always written on destruction.
+         */
+        std::chrono::seconds TlsSessionCacheSaveInterval = std::chrono::seconds(300);
+
+        /**
+         * Maximum number of idle connections kept in the shared connection cache for reuse.
+         */
+        size_t MaxCachedConnections = 64;
+
+        /**
+         * Maximum number of simultaneous connections to a single host. Transfers beyond it wait for a
+         * connection to free up. Zero means unlimited.
+         */
+        size_t MaxConnectionsPerHost = 0;
+
+        /**
+         * Maximum number of simultaneous connections across all hosts. Zero means unlimited.
+         */
+        size_t MaxTotalConnections = 0;
+
+        /**
+         * Pooled connections idle for longer than this are closed by a background reaper. Keep it below
+         * the server's idle timeout so the server never closes a socket a request is about to use.
+         * Zero keeps the libcurl default and disables reaping by idle time.
+         */
+        std::chrono::seconds MaxConnectionIdleTime = std::chrono::seconds(50);
+
+        /**
+         * Connections open for longer than this are not reused and are closed once idle. Zero means
+         * connections never expire by age.
+         */
+        std::chrono::seconds MaxConnectionAge = std::chrono::seconds(0);
+
+        /**
+         * When true, idle connections to a host are checked with a non-blocking peek before a request
+         * to that host starts, and the ones the server already closed are discarded.
+         */
+        bool ConnectionHealthCheck = true;
+
+        /**
+         * How often idle connections get protocol-level upkeep (HTTP/2 PING frames). Zero disables it.
+         */
+        std::chrono::seconds ConnectionUpkeepInterval = std::chrono::seconds(30);
+
+        /**
+         * HTTP version negotiated with servers.
+         */
+        HttpProtocol Protocol = HttpProtocol::Automatic;
+
+        /**
+         * Lifetime of the transport's resolver cache entries. Records are refreshed in the background
+         * before they expire and pinned into every handle, so requests do not wait on DNS. Zero leaves
+         * name resolution to libcurl.
+         */
+        std::chrono::seconds DnsCacheTtl = std::chrono::seconds(60);
+
+        /**
+         * Hosts reached over a Unix domain socket instead of TCP, mapped to the socket's path; a path
+         * starting with `@` names a socket in Linux's abstract namespace. For a local caching proxy or
+         * the Azurite emulator. Requests keep their URL, Host header and TLS, and get the same
+         * connection pooling, limits and metrics as TCP hosts.
+         */
+        std::map<std::string, std::string> UnixSocketHosts;
+
+        /**
+         * When set, every request sent with Send, SendMany or Submit is recorded to this file with its
+         * response headers, body and libcurl's timing, for ReplayTransport to serve back without a
+         * network. The file is overwritten. Credential and customer-provided key headers are left out
+         * and SAS signatures redacted, in the URL and in copy or rename source headers. Request bodies
+         * are only recorded by size, and responses stream past SendAsync unrecorded. Meant for
+         * capturing benchmark traffic: every response body is copied into the trace.
+         */
+        std::string RecordPath;
+
+        /**
+         * Maximum number of requests in flight to a single host. Further requests wait in a per-host
+         * queue, higher priority first and then in arrival order. Zero disables admission control.
+         */
+        size_t MaxRequestsInFlightPerHost = 0;
+
+        /**
+         * Maximum number of requests waiting for a slot on a single host. Requests beyond it fail
+         * immediately with a TransportException instead of queueing. Zero means an unbounded queue.
+         */
+        size_t MaxQueuedRequestsPerHost = 0;
+
+        /**
+         * When true, each host's in-flight limit adapts to the load the host can take. It grows while
+         * latency stays near the best observed and is cut multiplicatively when latency rises or the
+         * host answers 503 (ServerBusy). MaxRequestsInFlightPerHost becomes the upper bound, zero
+         * meaning none.
+         */
+        bool AdaptiveConcurrency = false;
+
+        /**
+         * The in-flight limit a host starts at when AdaptiveConcurrency is enabled.
+         */
+        size_t InitialRequestsInFlightPerHost = 16;
+
+        /**
+         * When true, throttling responses (503, or 500 with `x-ms-error-code: ServerBusy`) and their
+         * `Retry-After` make the transport pace every request to that storage account through one
+         * shared token bucket until the account recovers.
+         */
+        bool ThrottlePacing = true;
+
+        /**
+         * Consecutive connection failures to a host after which its circuit opens and requests to it
+         * fail immediately with a TransportException. A transport error rate of 50% or more over at
+         * least 20 requests opens it too. Zero disables the circuit breaker.
+         */
+        size_t CircuitBreakerThreshold = 5;
+
+        /**
+         * How long an open circuit fails requests before a probe request is let through. Doubles, up
+         * to a minute, every time the probe fails.
+         */
+        std::chrono::milliseconds CircuitBreakerOpenDuration = std::chrono::seconds(5);
+
+        /**
+         * Number of independent event loops. Each runs on its own thread with its own connection pool
+         * and TLS session cache, so transport throughput scales with cores. Per-host limits and circuit
+         * breakers apply per loop.
+         */
+        size_t EventLoops = 1;
+
+        /**
+         * CPUs the event loop threads are pinned to, by loop index; a loop without an entry, or with a
+         * negative one, is not pinned.
+         */
+        std::vector<int> EventLoopCpus;
+
+        /**
+         * How requests pick an event loop when there is more than one.
+         */
+        EventLoopRoutingPolicy EventLoopRouting = EventLoopRoutingPolicy::HostHash;
+
+        /**
+         * Threads of the work-stealing pool that runs asynchronous completion callbacks, so the event
+         * loops only do socket I/O. Zero runs the callbacks on the event loops. Blocking requests
+         * always parse their response on the calling thread. Coroutines from SendAsync never resume on
+         * an event loop; with zero threads they get a pool of one.
+         */
+        size_t CompletionThreads = 0;
+
+        /**
+         * Upload speed cap, in bytes per second, for RequestPriority::Background requests while
+         * RequestPriority::Interactive ones are outstanding on the same event loop. Zero never caps
+         * them.
+         */
+        int64_t BackgroundMaxSendSpeed = 0;
+
+        /**
+         * Bandwidth, in bytes per second and per direction, that requests tagged with
+         * MyTransport::WithTenant share. Each tenant with requests in flight gets a part in proportion to
+         * its weight; what a tenant leaves unused goes to the others, so the link does not idle while a
+         * tenant is held back. Zero does not share bandwidth, only TenantMaxBytesPerSecond applies.
+         */
+        int64_t TenantBandwidth = 0;
+
+        /**
+         * Relative bandwidth weights by tenant; tenants not listed, untagged requests included, weigh 1.
+         */
+        std::map<std::string, double> TenantWeights;
+
+        /**
+         * Hard caps, in bytes per second and per direction, on a tenant's requests taken together,
+         * even when the rest of the link is idle.
+         */
+        std::map<std::string, int64_t> TenantMaxBytesPerSecond;
+
+        /**
+         * Socket receive and send buffer sizes (`SO_RCVBUF`/`SO_SNDBUF`) in bytes. Zero leaves them to
+         * the OS, which on Linux keeps its own receive buffer tuning. Cross-region links with a large
+         * bandwidth-delay product need buffers of at least that product to reach full throughput.
+         */
+        size_t SocketReceiveBufferSize = 0;
+        size_t SocketSendBufferSize = 0;
+
+        /**
+         * Sizes each host's socket buffers from the round trip time and throughput its transfers
+         * observed, growing them while transfers are held back by the window, up to
+         * SocketMaxBufferSize. Applies to new connections.
+         */
+        bool SocketBufferAutoTuning = false;
+        size_t SocketMaxBufferSize = 16 * 1024 * 1024;
+
+        /**
+         * Disables Nagle's algorithm so small requests go out without waiting for the previous
+         * segment's acknowledgement.
+         */
+        bool TcpNoDelay = true;
+
+        /**
+         * Idle time before TCP keepalive probes start, the time between probes and how many go
+         * unanswered before the connection is dropped. Zero idle time leaves keepalive to libcurl.
+         */
+        std::chrono::seconds TcpKeepAliveIdle = std::chrono::seconds(0);
+        std::chrono::seconds TcpKeepAliveInterval = std::chrono::seconds(0);
+        int TcpKeepAliveProbes = 0;
+
+        /**
+         * Linux `SO_BUSY_POLL`: how long a read busy-polls the device queue before sleeping, trading
+         * CPU for latency. Zero leaves it off; values above `net.core.busy_read` need CAP_NET_ADMIN.
+         */
+        std::chrono::microseconds SocketBusyPoll = std::chrono::microseconds(0);
+
+        /**
+         * How often the connections of running requests are sampled for the `tcp_*` metrics. They are
+         * always sampled when a request completes; zero samples them only then.
+         */
+        std::chrono::milliseconds TcpInfoSampleInterval = std::chrono::milliseconds(0);
+    };
+
+    /**
+     * Where a request's time went, filled in once its transfer completes when set on its context with
+     * MyTransport::WithTiming. Phases are measured from the start of the transfer.
+     */
+    struct RequestTiming
+    {
+        std::chrono::microseconds NameLookup{0};
+        std::chrono::microseconds Connect{0};
+        // Zero without TLS
+        std::chrono::microseconds TlsHandshake{0};
+        // About to send the request
+        std::chrono::microseconds PreTransfer{0};
+        std::chrono::microseconds FirstByte{0};
+        std::chrono::microseconds Total{0};
+        // Whether the request opened a connection rather than reusing one
+        bool NewConnection = false;
+
+        /**
+         * The connection at the end of the request, from `TCP_INFO` where the OS has it. Time to first
+         * byte well above the round trip time was spent by the server; retransmits or a small congestion
+         * window point at the network. For uploads, so does time the request body was held back by the
+         * server's receive window.
+         */
+        struct TcpStatistics
+        {
+            bool Available = false;
+            std::chrono::microseconds Rtt{0};
+            std::chrono::microseconds RttVariance{0};
+            std::chrono::microseconds MinRtt{0};
+            // Segments retransmitted during the request
+            uint32_t Retransmits = 0;
+            // In segments
+            uint32_t CongestionWindow = 0;
+            // Bytes per second
+            uint64_t DeliveryRate = 0;
+            // Time during the request that sending was held back by the peer's receive window. Only
+            // says something about request bodies being sent; a download is never held back this way
+            std::chrono::microseconds ReceiveWindowLimited{0};
+        };
+        TcpStatistics Tcp;
+
+        /**
+         * Time to first byte less one round trip, roughly what the server took; zero without TCP
+         * statistics.
+         */
+        std::chrono::microseconds ServerTime{0};
+    };
+
+    /**
+     * Outcome of one request sent by MyTransport::SendMany
+     */
+    struct SendManyResult
+    {
+        /**
+         * Position of the request in the batch.
+         */
+        size_t Index = 0;
+
+        /**
+         * The response, null when the request failed.
+         */
+        std::unique_ptr<Azure::Core::Http::RawResponse> Response;
+
+        /**
+         * What Send would have thrown for the request, null when it succeeded.
+         */
+        std::exception_ptr Error;
+    };
+
+#if defined(MY_TRANSPORT_HAS_COROUTINES)
+    /**
+     * Body of a response from MyTransport::SendAsync, handed out as it arrives
+     */
+    class AsyncBodyStream final
+    {
+    public:
+        class ReadOperation final
+        {
+        public:
+            bool await_ready() const noexcept { return false; }
+            bool await_suspend(std::coroutine_handle<> awaiter);
+            size_t await_resume();
+
+        private:
+            friend class AsyncBodyStream;
+            ReadOperation(std::shared_ptr<_detail::AsyncTransfer> transfer, std::span<uint8_t> buffer)
+                : m_transfer(std::move(transfer)), m_buffer(buffer)
+            {
+            }
+
+            std::shared_ptr<_detail::AsyncTransfer> m_transfer;
+            std::span<uint8_t> m_buffer;
+        };
+
+        explicit AsyncBodyStream(std::shared_ptr<_detail::AsyncTransfer> transfer) : m_transfer(std::move(transfer)) {}
+
+        /**
+         * Aborts the transfer when the body has not been received in full.
+         */
+        ~AsyncBodyStream();
+
+        AsyncBodyStream(AsyncBodyStream const &) = delete;
+        AsyncBodyStream &operator=(AsyncBodyStream const &) = delete;
+
+        /**
+         * Copies up to `buffer.size()` bytes of the body into @p buffer, suspending until some arrive.
+         * Resolves to zero at the end of the body and throws TransportException when the transfer
+         * fails. Only one read may be outstanding at a time. The transfer is paused while a megabyte
+         * of the body is waiting to be read, so a slow reader does not have it buffered in memory.
+         */
+        ReadOperation ReadAsync(std::span<uint8_t> buffer) { return ReadOperation(m_transfer, buffer); }
+
+    private:
+        std::shared_ptr<_detail::AsyncTransfer> m_transfer;
+    };
+
+    struct AsyncResponse
+    {
+        /**
+         * Status and headers; the body is read from #Body instead of the response's body stream.
+         */
+        std::unique_ptr<Azure::Core::Http::RawResponse> Response;
+        std::unique_ptr<AsyncBodyStream> Body;
+    };
+#endif
 
     class MyTransport final : public Azure::Core::Http::HttpTransport
     {
+    public:
+        explicit MyTransport(MyTransportOptions const &options = MyTransportOptions());
+
+        /**
+         * Returns a copy of @p context that makes the transport schedule requests sent with it as
+         * @p priority. Requests waiting for a host's in-flight limit start by priority first and then
+         * by the earliest context deadline, so set MaxRequestsInFlightPerHost to have the transport,
+         * rather than libcurl in arrival order, decide who gets the next free connection.
+         */
+        static Azure::Core::Context WithPriority(Azure::Core::Context const &context, RequestPriority priority);
+
+        /**
+         * Returns a copy of @p context that attributes requests sent with it to @p tenant, for the
+         * tenant bandwidth limits and the per-tenant byte and latency metrics.
+         */
+        static Azure::Core::Context WithTenant(Azure::Core::Context const &context, std::string tenant);
+
+        /**
+         * Returns a copy of @p context that has Send and SendAsync fill in @p timing when the request's
+         * transfer completes. SendMany ignores it.
+         */
+        static Azure::Core::Context WithTiming(Azure::Core::Context const &context, std::shared_ptr<RequestTiming> timing);
+
+        /**
+         * Establishes up to @p connectionsPerHost keep-alive connections to each endpoint and parks them
+         * in the connection caches of the event loops serving it, so the first requests skip DNS, TCP
+         * and TLS setup. Only the scheme, host and port of each endpoint are used.
+         *
+         * @return The number of connections that were successfully established.
+         */
+        size_t Prewarm(
+            std::vector<Azure::Core::Url> const &endpoints,
+            size_t connectionsPerHost,
+            Azure::Core::Context const &context = Azure::Core::Context());
+
+        /**
+         * Returns a snapshot of the transport metrics, keyed as `name{labels}`. Connection pool
+         * occupancy is reported as `connections_open`, `transfers_active` and the
+         * `connections_*_total` counters, overall and per host.
+         */
+        std::map<std::string, double> GetMetrics() const;
+
+        /**
+         * Sends every request of @p requests at once and calls @p onResult, on the calling thread, as
+         * each one completes. Per-host limits still apply: requests over them wait in the engine, so a
+         * batch takes about one round trip per wave of admitted requests. Returns once every request
+         * has completed; cancelling @p context aborts the ones still running.
+         *
+         * A request that cannot be sent is reported through its result rather than thrown, so
+         * the rest of the batch proceeds.
+         */
+        void SendMany(
+            std::vector<Azure::Core::Http::Request *> const &requests,
+            std::function<void(SendManyResult)> const &onResult,
+            Azure::Core::Context const &context = Azure::Core::Context());
+
+        /**
+         * Like the overload above, but returns the results in the order of @p requests.
+         */
+        std::vector<SendManyResult> SendMany(
+            std::vector<Azure::Core::Http::Request *> const &requests,
+            Azure::Core::Context const &context = Azure::Core::Context());
+
+        /**
+         * Sends @p request on the transport's event loops without blocking a thread, and calls
+         * @p onComplete with the response, or what Send would have thrown, once the transfer is done.
+         * The result's index is always zero. @p onComplete runs on the completion executor, or on an
+         * event loop thread without one, and must neither block nor throw.
+         *
+         * @p request must outlive the transfer. @p context is only checked before sending and, as with
+         * SendAsync, requests are not held back by throttle pacing.
+         *
+         * The transport may be destroyed while transfers are outstanding: they still complete, and the
+         * event loops shut down once the last of their responses is released.
+         */
+        void Submit(
+            Azure::Core::Http::Request &request,
+            std::function<void(SendManyResult)> onComplete,
+            Azure::Core::Context const &context = Azure::Core::Context());
+
+#if defined(MY_TRANSPORT_HAS_COROUTINES)
+        class SendOperation final
+        {
+        public:
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> awaiter);
+            AsyncResponse await_resume();
+
+        private:
+            friend class MyTransport;
+            explicit SendOperation(std::shared_ptr<_detail::AsyncTransfer> transfer) : m_transfer(std::move(transfer)) {}
+
+            std::shared_ptr<_detail::AsyncTransfer> m_transfer;
+        };
+
+        /**
+         * Sends @p request on the transport's event loops without blocking a thread. Awaiting the
+         * result suspends the coroutine until the response headers are in, or the transfer fails, and
+         * resumes it on the completion executor. The body is then read with AsyncBodyStream::ReadAsync.
+         *
+         * @p request must outlive the transfer. @p context is only checked before sending, and requests
+         * are not held back by throttle pacing, which would block; throttling responses still slow
+         * down the blocking Send. As with Submit, the transport may be destroyed before the transfer
+         * and its body are done.
+         */
+        SendOperation SendAsync(
+            Azure::Core::Http::Request &request,
+            Azure::Core::Context const &context = Azure::Core::Context());
+#endif
+
+    private:
+        MyTransportOptions m_options;
+        std::shared_ptr<_detail::MetricsRegistry> m_metrics;
+        std::shared_ptr<_detail::CaStore> m_caStore;
+        std::shared_ptr<_detail::EngineShards> m_shards;
+        std::shared_ptr<_detail::CompletionExecutor> m_completions;
+        std::shared_ptr<_detail::DnsCache> m_dnsCache;
+        std::shared_ptr<_detail::ThrottlePacer> m_throttlePacer;
+        std::shared_ptr<std::map<std::string, std::string> const> m_unixSockets;
+        std::shared_ptr<_detail::TraceWriter> m_recorder;
+        std::shared_ptr<_detail::TlsSessionStore> m_tlsSessionStore;
+
+        _detail::HandleSettings CreateHandleSettings(_detail::EngineShard const &shard) const;
+
         std::unique_ptr<Azure::Core::Http::RawResponse> Send(Azure::Core::Http::Request &request, Azure::Core::Context const &context) override;
     };
 }
@@ -0,0 +1,86 @@
+/**
+ * Background thread that runs a callback at a fixed interval until destroyed
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        class PeriodicTask final
+        {
+        public:
+            PeriodicTask() = default;
+
+            /**
+             * Starts calling @p callback every @p interval. A non-positive interval never starts the
+             * thread. Exceptions thrown by the callback are swallowed, the next tick tries again.
+             */
+            template <class Rep, class Period>
+            PeriodicTask(std::chrono::duration<Rep, Period> interval, std::function<void()> callback)
+                : m_interval(std::chrono::duration_cast<std::chrono::milliseconds>(interval)),
+                  m_callback(std::move(callback))
+            {
+                if (m_interval.count() > 0)
+                {
+                    m_thread = std::thread(&PeriodicTask::Run, this);
+                }
+            }
+
+            ~PeriodicTask() { Stop(); }
+
+            PeriodicTask(PeriodicTask const &) = delete;
+            PeriodicTask &operator=(PeriodicTask const &) = delete;
+
+            /**
+             * Stops the thread and waits for a running callback to return. Owners call this first thing
+             * in their destructor so the callback never observes a partially destroyed object.
+             */
+            void Stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_condition.notify_all();
+                if (m_thread.joinable())
+                {
+                    m_thread.join();
+                }
+            }
+
+        private:
+            std::chrono::milliseconds m_interval{0};
+            std::function<void()> m_callback;
+            std::mutex m_mutex;
+            std::condition_variable m_condition;
+            bool m_stop = false;
+            std::thread m_thread;
+
+            void Run()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (!m_condition.wait_for(lock, m_interval, [this]()
+                                             { return m_stop; }))
+                {
+                    lock.unlock();
+                    try
+                    {
+                        m_callback();
+                    }
+                    catch (std::exception const &)
+                    {
+                    }
+                    lock.lock();
+                }
+            }
+        };
+    }
+}
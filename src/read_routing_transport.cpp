@@ -0,0 +1,166 @@
+#include "read_routing_transport.hpp"
+
+#include "endpoint_selector.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <stdexcept>
+
+using Azure::Core::Context;
+using Azure::Core::Http::HttpMethod;
+using Azure::Core::Http::RawResponse;
+using Azure::Core::Http::Request;
+
+namespace
+{
+    constexpr static const char StorageSuffix[] = ".core.windows.net";
+    constexpr static const char SecondarySuffix[] = "-secondary";
+    // Services a read-access geo-redundant account serves from its secondary
+    constexpr static const char *SecondaryServices[] = {"blob", "dfs", "queue", "table"};
+
+    bool EndsWith(std::string const &value, std::string const &suffix)
+    {
+        return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    /**
+     * Puts the request's original host back once it was sent to the other endpoint, so retries start
+     * from the primary again.
+     */
+    class HostRestorer final
+    {
+    public:
+        HostRestorer(Request &request, std::string host) : m_request(request), m_host(std::move(host)) {}
+        ~HostRestorer() { m_request.GetUrl().SetHost(m_host); }
+
+    private:
+        Request &m_request;
+        std::string m_host;
+    };
+}
+
+namespace MyNameSpace
+{
+    ReadRoutingTransport::ReadRoutingTransport(ReadRoutingOptions const &options)
+        : m_options(options), m_metrics(std::make_shared<_detail::MetricsRegistry>())
+    {
+        if (!m_options.Transport)
+        {
+            throw std::runtime_error("Read routing needs a transport to send requests with");
+        }
+
+        _detail::EndpointSelectorOptions selectorOptions;
+        selectorOptions.Smoothing = options.Smoothing;
+        selectorOptions.MaxErrorRate = options.MaxErrorRate;
+        selectorOptions.SecondaryBias = options.SecondaryBias;
+        selectorOptions.ProbeFraction = options.ProbeFraction;
+        m_selector = std::make_unique<_detail::EndpointSelector>(selectorOptions, m_metrics);
+    }
+
+    ReadRoutingTransport::~ReadRoutingTransport() = default;
+
+    std::map<std::string, double> ReadRoutingTransport::GetMetrics() const { return m_metrics->Snapshot(); }
+
+    std::string ReadRoutingTransport::GetSecondaryHost(std::string const &host) const
+    {
+        auto found = m_options.SecondaryHosts.find(host);
+        if (found != m_options.SecondaryHosts.end())
+        {
+            return found->second;
+        }
+        if (m_options.DeriveSecondaryHosts.empty())
+        {
+            return std::string();
+        }
+
+        auto const lower = Azure::Core::_internal::StringExtensions::ToLower(host);
+        auto const accountEnd = lower.find('.');
+        if (!EndsWith(lower, StorageSuffix) || accountEnd == std::string::npos ||
+            m_options.DeriveSecondaryHosts.count(lower.substr(0, accountEnd)) == 0)
+        {
+            return std::string();
+        }
+        auto const service = lower.substr(accountEnd + 1, lower.size() - accountEnd - 1 - (sizeof(StorageSuffix) - 1));
+        if (std::find(std::begin(SecondaryServices), std::end(SecondaryServices), service) == std::end(SecondaryServices))
+        {
+            return std::string();
+        }
+        return lower.substr(0, accountEnd) + SecondarySuffix + lower.substr(accountEnd);
+    }
+
+    std::unique_ptr<RawResponse> ReadRoutingTransport::Send(Request &request, Context const &context)
+    {
+        auto const &method = request.GetMethod();
+        if (method != HttpMethod::Get && method != HttpMethod::Head)
+        {
+            return m_options.Transport->Send(request, context);
+        }
+        auto const primary = request.GetUrl().GetHost();
+        auto const secondary = GetSecondaryHost(primary);
+        if (secondary.empty())
+        {
+            return m_options.Transport->Send(request, context);
+        }
+
+        bool probe = false;
+        auto const useSecondary = m_selector->ChooseSecondary(primary, secondary, probe);
+        HostRestorer restorer(request, primary);
+        if (!probe)
+        {
+            return SendTo(request, useSecondary ? secondary : primary, context);
+        }
+
+        // The probe's failure is the other endpoint's, not the read's: it goes to the chosen one then
+        std::unique_ptr<RawResponse> response;
+        try
+        {
+            response = SendTo(request, useSecondary ? secondary : primary, context);
+        }
+        catch (Azure::Core::OperationCancelledException const &)
+        {
+            throw;
+        }
+        catch (...)
+        {
+        }
+        if (response && static_cast<int>(response->GetStatusCode()) < 500)
+        {
+            return response;
+        }
+        context.ThrowIfCancelled();
+        if (auto body = request.GetBodyStream())
+        {
+            body->Rewind();
+        }
+        return SendTo(request, useSecondary ? primary : secondary, context);
+    }
+
+    std::unique_ptr<RawResponse> ReadRoutingTransport::SendTo(Request &request, std::string const &host, Context const &context)
+    {
+        request.GetUrl().SetHost(host);
+
+        auto const start = std::chrono::steady_clock::now();
+        auto const elapsed = [start]()
+        { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start); };
+        std::unique_ptr<RawResponse> response;
+        try
+        {
+            response = m_options.Transport->Send(request, context);
+        }
+        catch (Azure::Core::OperationCancelledException const &)
+        {
+            // Says nothing about the endpoint
+            throw;
+        }
+        catch (...)
+        {
+            m_selector->OnResult(host, elapsed(), true);
+            throw;
+        }
+
+        m_selector->OnResult(host, elapsed(), static_cast<int>(response->GetStatusCode()) >= 500);
+        return response;
+    }
+}
@@ -0,0 +1,111 @@
+/**
+ * Transport that sends reads to whichever of an account's primary and secondary endpoints is faster
+ */
+
+#pragma once
+
+#include <azure/core/http/transport.hpp>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        class EndpointSelector;
+        class MetricsRegistry;
+    }
+
+    /**
+     * Options to tune the behavior of #ReadRoutingTransport
+     */
+    struct ReadRoutingOptions
+    {
+        /**
+         * Sends every request, to whichever host it ends up addressed to.
+         */
+        std::shared_ptr<Azure::Core::Http::HttpTransport> Transport;
+
+        /**
+         * Primary hosts mapped to the secondary host their reads may go to.
+         */
+        std::map<std::string, std::string> SecondaryHosts;
+
+        /**
+         * Names of read-access geo-redundant accounts whose blob, dfs, queue and table hosts of the
+         * form `<account>.<service>.core.windows.net`, when not in SecondaryHosts, read from
+         * `<account>-secondary.<service>.core.windows.net`. Only RA-GRS and RA-GZRS accounts have a
+         * readable secondary, so none is derived for an account that is not listed.
+         */
+        std::set<std::string> DeriveSecondaryHosts;
+
+        /**
+         * How many times faster the secondary has to be before reads move there.
+         */
+        double SecondaryBias = 1.25;
+
+        /**
+         * Share of reads sent to the endpoint that is not chosen, so a recovered or faster endpoint is
+         * noticed. A probe that fails is sent again to the chosen endpoint. Zero disables probing,
+         * which leaves the secondary unmeasured and unused unless the primary fails.
+         */
+        double ProbeFraction = 0.02;
+
+        /**
+         * Smoothed share of failed reads above which an endpoint is avoided.
+         */
+        double MaxErrorRate = 0.1;
+
+        /**
+         * Weight of the newest read in the smoothed latency and error rate of an endpoint.
+         */
+        double Smoothing = 0.2;
+    };
+
+    /**
+     * For read-access geo-redundant accounts: GET and HEAD requests to a primary host with a
+     * secondary go to whichever of the two currently reads faster without failing, so reads avoid a
+     * region whose front end degrades. Writes, and requests already addressed to a secondary, are
+     * passed through untouched. Only the request's host changes; Shared Key and SAS signatures do not
+     * cover it.
+     *
+     * A read fails when the transport throws or the response is a 5xx. Its time is that of the
+     * transport's Send, which includes the body for transports that buffer it, like MyTransport.
+     *
+     * The secondary is replicated asynchronously, so reads routed there may return data that is
+     * behind the primary, or a 404 for a blob just created. Only route accounts whose readers accept
+     * that.
+     *
+     * Per-endpoint `read_endpoint_*` metrics show the reads, failures, probes and smoothed estimates.
+     */
+    class ReadRoutingTransport final : public Azure::Core::Http::HttpTransport
+    {
+    public:
+        explicit ReadRoutingTransport(ReadRoutingOptions const &options);
+        ~ReadRoutingTransport() override;
+
+        ReadRoutingTransport(ReadRoutingTransport const &) = delete;
+        ReadRoutingTransport &operator=(ReadRoutingTransport const &) = delete;
+
+        /**
+         * Returns a snapshot of the read routing metrics, keyed as `name{labels}`.
+         */
+        std::map<std::string, double> GetMetrics() const;
+
+        std::unique_ptr<Azure::Core::Http::RawResponse> Send(Azure::Core::Http::Request &request, Azure::Core::Context const &context) override;
+
+    private:
+        ReadRoutingOptions m_options;
+        std::shared_ptr<_detail::MetricsRegistry> m_metrics;
+        std::unique_ptr<_detail::EndpointSelector> m_selector;
+
+        std::string GetSecondaryHost(std::string const &host) const;
+        std::unique_ptr<Azure::Core::Http::RawResponse> SendTo(
+            Azure::Core::Http::Request &request,
+            std::string const &host,
+            Azure::Core::Context const &context);
+    };
+}
@@ -0,0 +1,127 @@
+#include "replay_transport.hpp"
+
+#include "metrics.hpp"
+#include "request_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using Azure::Core::Context;
+using Azure::Core::Http::HttpStatusCode;
+using Azure::Core::Http::RawResponse;
+using Azure::Core::Http::Request;
+using Azure::Core::Http::TransportException;
+using MyNameSpace::_detail::TraceRecord;
+
+namespace
+{
+    // How often a replayed transfer checks whether it was cancelled while it waits
+    constexpr static const std::chrono::milliseconds CancellationPollInterval(100);
+
+    std::string GetKey(std::string const &method, std::string const &url) { return method + ' ' + url; }
+
+    /**
+     * Response body read straight from the trace record, which it keeps alive.
+     */
+    class RecordBodyStream final : public Azure::Core::IO::BodyStream
+    {
+    public:
+        explicit RecordBodyStream(std::shared_ptr<TraceRecord const> record)
+            : m_record(std::move(record)), m_stream(m_record->Body.data(), m_record->Body.size())
+        {
+        }
+
+        int64_t Length() const override { return m_stream.Length(); }
+
+        void Rewind() override { m_stream.Rewind(); }
+
+    private:
+        std::shared_ptr<TraceRecord const> m_record;
+        Azure::Core::IO::MemoryBodyStream m_stream;
+
+        size_t OnRead(uint8_t *buffer, size_t count, Context const &context) override
+        {
+            return m_stream.Read(buffer, count, context);
+        }
+    };
+}
+
+namespace MyNameSpace
+{
+    ReplayTransport::ReplayTransport(ReplayTransportOptions const &options)
+        : m_options(options), m_metrics(std::make_shared<_detail::MetricsRegistry>())
+    {
+        for (auto &record : _detail::ReadTrace(options.TracePath))
+        {
+            auto key = GetKey(record.Method, record.Url);
+            m_recordings[key].Records.push_back(std::make_shared<TraceRecord const>(std::move(record)));
+        }
+    }
+
+    ReplayTransport::~ReplayTransport() = default;
+
+    std::map<std::string, double> ReplayTransport::GetMetrics() const { return m_metrics->Snapshot(); }
+
+    std::shared_ptr<TraceRecord const> ReplayTransport::Take(std::string const &key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_recordings.find(key);
+        if (found == m_recordings.end())
+        {
+            return nullptr;
+        }
+        auto &recordings = found->second;
+        if (recordings.Next == recordings.Records.size())
+        {
+            if (!m_options.Loop)
+            {
+                return nullptr;
+            }
+            recordings.Next = 0;
+        }
+        return recordings.Records[recordings.Next++];
+    }
+
+    std::unique_ptr<RawResponse> ReplayTransport::Send(Request &request, Context const &context)
+    {
+        context.ThrowIfCancelled();
+
+        auto const url = _detail::RedactUrl(request.GetUrl().GetAbsoluteUrl());
+        auto record = Take(GetKey(request.GetMethod().ToString(), url));
+        if (!record)
+        {
+            m_metrics->GetCounter("replay_unmatched_total").Add();
+            throw TransportException("No recorded response left for " + request.GetMethod().ToString() + " " + url);
+        }
+        m_metrics->GetCounter("replay_requests_total").Add();
+
+        if (auto body = request.GetBodyStream())
+        {
+            uint8_t buffer[64 * 1024];
+            while (body->Read(buffer, sizeof(buffer), context) > 0)
+            {
+            }
+        }
+
+        auto const deadline = std::chrono::steady_clock::now() +
+                              std::chrono::duration_cast<std::chrono::steady_clock::duration>(record->Total * m_options.TimeScale);
+        for (auto now = std::chrono::steady_clock::now(); now < deadline; now = std::chrono::steady_clock::now())
+        {
+            context.ThrowIfCancelled();
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, CancellationPollInterval));
+        }
+
+        if (!record->Error.empty())
+        {
+            throw TransportException(record->Error);
+        }
+        auto response = std::make_unique<RawResponse>(1, 1, HttpStatusCode(record->StatusCode), record->ReasonPhrase);
+        for (auto const &header : record->ResponseHeaders)
+        {
+            response->SetHeader(header.first, header.second);
+        }
+        response->SetBodyStream(std::make_unique<RecordBodyStream>(std::move(record)));
+        return response;
+    }
+}
@@ -0,0 +1,92 @@
+/**
+ * Transport that answers requests from a trace recorded by MyTransport, without a network
+ */
+
+#pragma once
+
+#include <azure/core/http/transport.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        class MetricsRegistry;
+        struct TraceRecord;
+    }
+
+    /**
+     * Options to tune the behavior of #ReplayTransport
+     */
+    struct ReplayTransportOptions
+    {
+        /**
+         * Trace written by MyTransport with MyTransportOptions::RecordPath.
+         */
+        std::string TracePath;
+
+        /**
+         * Multiplies the recorded transfer times: 1 answers as fast as the network did, 0.5 twice as
+         * fast, 0 immediately.
+         */
+        double TimeScale = 1.0;
+
+        /**
+         * When true, a request whose recorded responses are used up gets them again from the first.
+         * Otherwise it fails with a TransportException.
+         */
+        bool Loop = true;
+    };
+
+    /**
+     * Serves the responses of a recorded trace back, so benchmarks of the code above the transport
+     * run repeatably on the traffic they were recorded with. A request gets the responses recorded
+     * for its method and URL, SAS signature aside, in the order they were recorded; a transfer that
+     * failed when recorded fails again with the same TransportException. Each answer waits for the
+     * recorded transfer time, scaled by TimeScale, and consumes the request body as a transfer would.
+     * Requests that were never recorded fail with a TransportException.
+     *
+     * Metrics `replay_requests_total` and `replay_unmatched_total` count the requests answered and
+     * the ones without a recording.
+     */
+    class ReplayTransport final : public Azure::Core::Http::HttpTransport
+    {
+    public:
+        /**
+         * Loads the whole trace. Throws when it cannot be read.
+         */
+        explicit ReplayTransport(ReplayTransportOptions const &options);
+        ~ReplayTransport() override;
+
+        ReplayTransport(ReplayTransport const &) = delete;
+        ReplayTransport &operator=(ReplayTransport const &) = delete;
+
+        /**
+         * Returns a snapshot of the replay metrics, keyed as `name{labels}`.
+         */
+        std::map<std::string, double> GetMetrics() const;
+
+        std::unique_ptr<Azure::Core::Http::RawResponse> Send(Azure::Core::Http::Request &request, Azure::Core::Context const &context) override;
+
+    private:
+        struct Recordings
+        {
+            std::vector<std::shared_ptr<_detail::TraceRecord const>> Records;
+            size_t Next = 0;
+        };
+
+        ReplayTransportOptions m_options;
+        std::shared_ptr<_detail::MetricsRegistry> m_metrics;
+        std::mutex m_mutex;
+        // By method and redacted URL
+        std::unordered_map<std::string, Recordings> m_recordings;
+
+        std::shared_ptr<_detail::TraceRecord const> Take(std::string const &key);
+    };
+}
@@ -0,0 +1,272 @@
+#include "request_trace.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+    constexpr static const char FileMagic[] = {'M', 'T', 'R', 'T', '\x01'};
+    constexpr static const size_t FileMagicLen = sizeof(FileMagic);
+
+    constexpr static const char RedactedSignature[] = "REDACTED";
+
+    using MyNameSpace::_detail::TraceRecord;
+    using Headers = std::vector<std::pair<std::string, std::string>>;
+
+    /**
+     * Appends fields as variable-length integers and length-prefixed bytes, which keeps the small
+     * numbers most fields hold to a byte or two.
+     */
+    class FieldWriter final
+    {
+    public:
+        void PutInteger(uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                m_data.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            m_data.push_back(static_cast<char>(value));
+        }
+
+        void PutBytes(char const *data, size_t size)
+        {
+            PutInteger(size);
+            m_data.append(data, size);
+        }
+
+        void PutString(std::string const &value) { PutBytes(value.data(), value.size()); }
+
+        void PutHeaders(Headers const &headers)
+        {
+            PutInteger(headers.size());
+            for (auto const &header : headers)
+            {
+                PutString(header.first);
+                PutString(header.second);
+            }
+        }
+
+        std::string const &GetData() const { return m_data; }
+
+    private:
+        std::string m_data;
+    };
+
+    /**
+     * Reads fields back in the order they were put. Returns false once the data runs out.
+     */
+    class FieldReader final
+    {
+    public:
+        FieldReader(char const *data, size_t size) : m_data(data), m_size(size) {}
+
+        bool GetInteger(uint64_t &value)
+        {
+            value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (m_offset == m_size)
+                {
+                    return false;
+                }
+                auto const byte = static_cast<uint8_t>(m_data[m_offset++]);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool GetBytes(char const *&data, size_t &size)
+        {
+            uint64_t length;
+            if (!GetInteger(length) || length > m_size - m_offset)
+            {
+                return false;
+            }
+            data = m_data + m_offset;
+            size = static_cast<size_t>(length);
+            m_offset += size;
+            return true;
+        }
+
+        bool GetString(std::string &value)
+        {
+            char const *data;
+            size_t size;
+            if (!GetBytes(data, size))
+            {
+                return false;
+            }
+            value.assign(data, size);
+            return true;
+        }
+
+        bool GetHeaders(Headers &headers)
+        {
+            uint64_t count;
+            if (!GetInteger(count))
+            {
+                return false;
+            }
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                std::string name;
+                std::string value;
+                if (!GetString(name) || !GetString(value))
+                {
+                    return false;
+                }
+                headers.emplace_back(std::move(name), std::move(value));
+            }
+            return true;
+        }
+
+        size_t GetOffset() const { return m_offset; }
+
+    private:
+        char const *m_data;
+        size_t m_size;
+        size_t m_offset = 0;
+    };
+
+    bool ReadRecord(FieldReader &reader, TraceRecord &record)
+    {
+        uint64_t requestBodySize;
+        uint64_t statusCode;
+        uint64_t firstByte;
+        uint64_t total;
+        char const *body;
+        size_t bodySize;
+        if (!reader.GetString(record.Method) || !reader.GetString(record.Url) || !reader.GetHeaders(record.RequestHeaders) ||
+            !reader.GetInteger(requestBodySize) || !reader.GetString(record.Error) || !reader.GetInteger(statusCode) ||
+            !reader.GetString(record.ReasonPhrase) || !reader.GetHeaders(record.ResponseHeaders) || !reader.GetBytes(body, bodySize) ||
+            !reader.GetInteger(firstByte) || !reader.GetInteger(total))
+        {
+            return false;
+        }
+        record.RequestBodySize = requestBodySize;
+        record.StatusCode = static_cast<int32_t>(statusCode);
+        record.Body.assign(body, body + bodySize);
+        record.FirstByte = std::chrono::microseconds(firstByte);
+        record.Total = std::chrono::microseconds(total);
+        return true;
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        std::string RedactUrl(std::string const &url)
+        {
+            auto position = url.find('?');
+            if (position == std::string::npos)
+            {
+                return url;
+            }
+
+            auto redacted = url;
+            while (position != std::string::npos)
+            {
+                // At the '?' or '&' before a parameter
+                ++position;
+                if (redacted.compare(position, 4, "sig=") == 0)
+                {
+                    auto const valueStart = position + 4;
+                    auto const valueEnd = std::min(redacted.find('&', valueStart), redacted.find('#', valueStart));
+                    redacted.replace(valueStart, valueEnd == std::string::npos ? std::string::npos : valueEnd - valueStart, RedactedSignature);
+                    position = valueStart + sizeof(RedactedSignature) - 1;
+                }
+                position = redacted.find('&', position);
+            }
+            return redacted;
+        }
+
+        bool RedactHeader(std::string const &name, std::string &value)
+        {
+            auto lower = name;
+            std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c)
+                           { return static_cast<char>(std::tolower(c)); });
+            if (lower == "authorization" || lower == "proxy-authorization" || lower == "x-ms-copy-source-authorization" ||
+                lower == "x-ms-encryption-key" || lower == "x-ms-source-encryption-key")
+            {
+                return false;
+            }
+            if (lower == "x-ms-copy-source" || lower == "x-ms-rename-source")
+            {
+                value = RedactUrl(value);
+            }
+            return true;
+        }
+
+        TraceWriter::TraceWriter(std::string const &path) : m_file(path, std::ios::binary | std::ios::trunc)
+        {
+            if (!m_file || !m_file.write(FileMagic, FileMagicLen))
+            {
+                throw std::runtime_error("Could not create request trace " + path);
+            }
+        }
+
+        void TraceWriter::Append(TraceRecord const &record)
+        {
+            FieldWriter writer;
+            writer.PutString(record.Method);
+            writer.PutString(record.Url);
+            writer.PutHeaders(record.RequestHeaders);
+            writer.PutInteger(record.RequestBodySize);
+            writer.PutString(record.Error);
+            writer.PutInteger(static_cast<uint64_t>(record.StatusCode));
+            writer.PutString(record.ReasonPhrase);
+            writer.PutHeaders(record.ResponseHeaders);
+            writer.PutBytes(reinterpret_cast<char const *>(record.Body.data()), record.Body.size());
+            writer.PutInteger(static_cast<uint64_t>(record.FirstByte.count()));
+            writer.PutInteger(static_cast<uint64_t>(record.Total.count()));
+
+            // Each record is prefixed with its size, so a reader can tell a truncated one
+            auto const &data = writer.GetData();
+            FieldWriter size;
+            size.PutInteger(data.size());
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_file.write(size.GetData().data(), static_cast<std::streamsize>(size.GetData().size()));
+            m_file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+
+        std::vector<TraceRecord> ReadTrace(std::string const &path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                throw std::runtime_error("Could not open request trace " + path);
+            }
+            std::string const data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (data.size() < FileMagicLen || !std::equal(FileMagic, FileMagic + FileMagicLen, data.begin()))
+            {
+                throw std::runtime_error(path + " is not a request trace");
+            }
+
+            std::vector<TraceRecord> records;
+            FieldReader frames(data.data() + FileMagicLen, data.size() - FileMagicLen);
+            char const *frame;
+            size_t frameSize;
+            while (frames.GetBytes(frame, frameSize))
+            {
+                FieldReader reader(frame, frameSize);
+                TraceRecord record;
+                if (!ReadRecord(reader, record) || reader.GetOffset() != frameSize)
+                {
+                    throw std::runtime_error("Malformed record in request trace " + path);
+                }
+                records.push_back(std::move(record));
+            }
+            return records;
+        }
+    }
+}
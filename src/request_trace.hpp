@@ -0,0 +1,77 @@
+/**
+ * Binary trace files of requests and their responses, written by MyTransport and read by ReplayTransport
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * One transfer: the request as sent, and the response or the error it ended with.
+         */
+        struct TraceRecord
+        {
+            std::string Method;
+            // Absolute URL, with the signature of a SAS token redacted
+            std::string Url;
+            // Without credentials, see RedactHeader
+            std::vector<std::pair<std::string, std::string>> RequestHeaders;
+            uint64_t RequestBodySize = 0;
+            // Why the transfer failed, empty when it got a response
+            std::string Error;
+            int32_t StatusCode = 0;
+            std::string ReasonPhrase;
+            std::vector<std::pair<std::string, std::string>> ResponseHeaders;
+            std::vector<uint8_t> Body;
+            // From the start of the transfer, as libcurl measured it
+            std::chrono::microseconds FirstByte{0};
+            std::chrono::microseconds Total{0};
+        };
+
+        /**
+         * Returns @p url with the `sig` query parameter's value replaced, so traces hold no usable
+         * SAS token. Requests are matched against a trace by their redacted URL.
+         */
+        std::string RedactUrl(std::string const &url);
+
+        /**
+         * Prepares a request header for a trace. Returns false for headers that carry credentials or
+         * customer-provided encryption keys, which are left out. Headers naming a source URL, which
+         * can hold a SAS token, get its signature redacted in @p value.
+         */
+        bool RedactHeader(std::string const &name, std::string &value);
+
+        /**
+         * Appends records to a trace file, from any thread. The file is truncated on construction;
+         * records are buffered and reach the file when the buffer fills and on destruction, so a
+         * crashed process loses the tail of its trace but leaves the rest readable.
+         */
+        class TraceWriter final
+        {
+        public:
+            explicit TraceWriter(std::string const &path);
+
+            void Append(TraceRecord const &record);
+
+        private:
+            std::mutex m_mutex;
+            std::ofstream m_file;
+        };
+
+        /**
+         * Reads every record of the trace file at @p path, in the order they were written. A
+         * truncated last record is dropped. Throws when the file cannot be read or is not a trace.
+         */
+        std::vector<TraceRecord> ReadTrace(std::string const &path);
+    }
+}
@@ -0,0 +1,161 @@
+#include "routing_transport.hpp"
+
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+using Azure::Core::Context;
+using Azure::Core::Http::RawResponse;
+using Azure::Core::Http::Request;
+using Azure::Core::Http::TransportException;
+
+namespace
+{
+    std::string TrimSlashes(std::string const &path)
+    {
+        auto const first = path.find_first_not_of('/');
+        if (first == std::string::npos)
+        {
+            return std::string();
+        }
+        return path.substr(first, path.find_last_not_of('/') - first + 1);
+    }
+}
+
+namespace MyNameSpace
+{
+    struct RoutingTransport::Route
+    {
+        std::shared_ptr<Azure::Core::Http::HttpTransport> Transport;
+        _detail::Counter &Requests;
+        _detail::Counter &Failures;
+        _detail::Gauge &InFlight;
+        _detail::Histogram &Duration;
+    };
+
+    RoutingTransport::RoutingTransport(RoutingTransportOptions const &options)
+        : m_metrics(std::make_shared<_detail::MetricsRegistry>())
+    {
+        for (auto const &route : options.Routes)
+        {
+            if (!route.Transport)
+            {
+                throw std::runtime_error("Transport route " + route.Name + " has no transport");
+            }
+
+            auto const match = TrimSlashes(route.Match);
+            auto const slash = match.find('/');
+            auto &host = m_hosts[Azure::Core::_internal::StringExtensions::ToLower(match.substr(0, slash))];
+            auto &added = AddRoute(route.Name, route.Transport);
+            if (slash == std::string::npos)
+            {
+                if (host.HostRoute)
+                {
+                    throw std::runtime_error("Duplicate transport route for " + route.Match);
+                }
+                host.HostRoute = &added;
+                continue;
+            }
+
+            auto const prefix = TrimSlashes(match.substr(slash));
+            if (!host.Prefixes.emplace(prefix, &added).second)
+            {
+                throw std::runtime_error("Duplicate transport route for " + route.Match);
+            }
+            auto const depth = static_cast<size_t>(std::count(prefix.begin(), prefix.end(), '/')) + 1;
+            if (std::find(host.Depths.begin(), host.Depths.end(), depth) == host.Depths.end())
+            {
+                host.Depths.push_back(depth);
+                std::sort(host.Depths.begin(), host.Depths.end(), std::greater<size_t>());
+            }
+        }
+
+        if (options.DefaultTransport)
+        {
+            m_defaultRoute = &AddRoute("default", options.DefaultTransport);
+        }
+    }
+
+    RoutingTransport::~RoutingTransport() = default;
+
+    std::map<std::string, double> RoutingTransport::GetMetrics() const { return m_metrics->Snapshot(); }
+
+    RoutingTransport::Route &RoutingTransport::AddRoute(std::string const &name, std::shared_ptr<Azure::Core::Http::HttpTransport> transport)
+    {
+        auto const labels = _detail::MetricsRegistry::Label("route", name);
+        m_routes.push_back(std::unique_ptr<Route>(new Route{
+            std::move(transport),
+            m_metrics->GetCounter("route_requests_total", labels),
+            m_metrics->GetCounter("route_failures_total", labels),
+            m_metrics->GetGauge("route_requests_in_flight", labels),
+            m_metrics->GetHistogram("route_request_duration_ms", _detail::MetricsRegistry::LatencyBoundsMs(), labels)}));
+        return *m_routes.back();
+    }
+
+    RoutingTransport::Route &RoutingTransport::Resolve(Azure::Core::Url const &url)
+    {
+        auto found = m_hosts.find(Azure::Core::_internal::StringExtensions::ToLower(url.GetHost()));
+        if (found != m_hosts.end())
+        {
+            auto const &host = found->second;
+            if (!host.Depths.empty())
+            {
+                // Where each of the path's leading segments ends
+                auto const path = TrimSlashes(url.GetPath());
+                std::vector<size_t> ends;
+                for (size_t position = 0; position <= path.size() && ends.size() < host.Depths.front();)
+                {
+                    auto const end = std::min(path.find('/', position), path.size());
+                    ends.push_back(end);
+                    position = end + 1;
+                }
+                for (auto depth : host.Depths)
+                {
+                    if (depth > ends.size())
+                    {
+                        continue;
+                    }
+                    auto prefix = host.Prefixes.find(path.substr(0, ends[depth - 1]));
+                    if (prefix != host.Prefixes.end())
+                    {
+                        return *prefix->second;
+                    }
+                }
+            }
+            if (host.HostRoute)
+            {
+                return *host.HostRoute;
+            }
+        }
+
+        if (!m_defaultRoute)
+        {
+            m_metrics->GetCounter("route_unmatched_total").Add();
+            throw TransportException("No transport route for " + url.GetHost());
+        }
+        return *m_defaultRoute;
+    }
+
+    std::unique_ptr<RawResponse> RoutingTransport::Send(Request &request, Context const &context)
+    {
+        auto &route = Resolve(request.GetUrl());
+        route.Requests.Add();
+        route.InFlight.Add(1);
+        auto const start = std::chrono::steady_clock::now();
+        try
+        {
+            auto response = route.Transport->Send(request, context);
+            route.InFlight.Add(-1);
+            route.Duration.Record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            return response;
+        }
+        catch (...)
+        {
+            route.InFlight.Add(-1);
+            route.Failures.Add();
+            throw;
+        }
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * Transport that sends each request through the backend transport configured for its destination
+ */
+
+#pragma once
+
+#include <azure/core/http/transport.hpp>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        class MetricsRegistry;
+    }
+
+    /**
+     * One destination of a #RoutingTransport
+     */
+    struct TransportRoute
+    {
+        /**
+         * Labels the route's metrics; routes sharing a name share their metrics.
+         */
+        std::string Name;
+
+        /**
+         * A host, such as `account.blob.core.windows.net`, or a host followed by a path prefix made
+         * of whole segments, such as `account.blob.core.windows.net/logs`. Hosts match case
+         * insensitively and ports are not considered; paths match case sensitively.
+         */
+        std::string Match;
+
+        /**
+         * Sends the requests the route matches.
+         */
+        std::shared_ptr<Azure::Core::Http::HttpTransport> Transport;
+    };
+
+    /**
+     * Options to tune the behavior of #RoutingTransport
+     */
+    struct RoutingTransportOptions
+    {
+        std::vector<TransportRoute> Routes;
+
+        /**
+         * Sends the requests no route matches, labelled `default`. Without one they fail with
+         * TransportException.
+         */
+        std::shared_ptr<Azure::Core::Http::HttpTransport> DefaultTransport;
+    };
+
+    /**
+     * Picks a backend transport per request, so one client can reach the primary account over a
+     * MyTransport tuned for HTTP/2, a local cache over a Unix socket and a legacy endpoint over plain
+     * HTTP/1.1 without separate clients.
+     *
+     * Routes are indexed by host, and each host's path prefixes by their number of segments, so
+     * picking one costs a hash lookup per distinct prefix depth of the request's host, however many
+     * routes there are. The longest matching prefix wins over a shorter one and over the bare host.
+     *
+     * Each route counts its requests, failures and time in `route_*` metrics labelled with its name.
+     */
+    class RoutingTransport final : public Azure::Core::Http::HttpTransport
+    {
+    public:
+        /**
+         * Throws when a route has no transport or two routes have the same match.
+         */
+        explicit RoutingTransport(RoutingTransportOptions const &options);
+        ~RoutingTransport() override;
+
+        RoutingTransport(RoutingTransport const &) = delete;
+        RoutingTransport &operator=(RoutingTransport const &) = delete;
+
+        /**
+         * Returns a snapshot of the routing metrics, keyed as `name{labels}`. The backends keep their
+         * own metrics.
+         */
+        std::map<std::string, double> GetMetrics() const;
+
+        std::unique_ptr<Azure::Core::Http::RawResponse> Send(Azure::Core::Http::Request &request, Azure::Core::Context const &context) override;
+
+    private:
+        struct Route;
+
+        struct HostRoutes
+        {
+            // Serves the host's requests no prefix matches, null when there is none
+            Route *HostRoute = nullptr;
+            // Keyed by the prefix without the host
+            std::unordered_map<std::string, Route *> Prefixes;
+            // Segment counts of the prefixes, longest first
+            std::vector<size_t> Depths;
+        };
+
+        std::shared_ptr<_detail::MetricsRegistry> m_metrics;
+        std::vector<std::unique_ptr<Route>> m_routes;
+        std::unordered_map<std::string, HostRoutes> m_hosts;
+        // Null when requests without a route fail
+        Route *m_defaultRoute = nullptr;
+
+        Route &AddRoute(std::string const &name, std::shared_ptr<Azure::Core::Http::HttpTransport> transport);
+        Route &Resolve(Azure::Core::Url const &url);
+    };
+}
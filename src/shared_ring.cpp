@@ -0,0 +1,193 @@
+#include "shared_ring.hpp"
+
+#if defined(MY_TRANSPORT_HAS_SHARED_MEMORY)
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace
+{
+    constexpr static const size_t LengthSize = sizeof(uint32_t);
+
+    void Signal(int fd)
+    {
+        uint64_t const one = 1;
+        // A full counter already wakes the other side
+        auto const written = write(fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    void Drain(int fd)
+    {
+        uint64_t value;
+        while (read(fd, &value, sizeof(value)) > 0)
+        {
+        }
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        // Shared by both processes, so only address-free atomics; each position on its own cache line
+        struct SharedRing::Header
+        {
+            // Bytes ever written, moved by the writer
+            alignas(64) std::atomic<uint64_t> Head;
+            // Bytes ever read, moved by the reader
+            alignas(64) std::atomic<uint64_t> Tail;
+            alignas(64) std::atomic<uint32_t> ReaderWaiting;
+            std::atomic<uint32_t> WriterWaiting;
+        };
+
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "The shared ring needs lock-free atomics");
+
+        size_t SharedRing::GetRegionSize(size_t capacity) { return sizeof(Header) + capacity; }
+
+        SharedRing::SharedRing(void *region, size_t capacity, int readableFd, int writableFd, bool reset)
+            : m_header(static_cast<Header *>(region)), m_data(static_cast<uint8_t *>(region) + sizeof(Header)),
+              m_capacity(capacity), m_readableFd(readableFd), m_writableFd(writableFd)
+        {
+            if (capacity < 1024 || (capacity & (capacity - 1)) != 0)
+            {
+                throw std::runtime_error("Shared ring capacity must be a power of two of at least 1 KiB");
+            }
+            if (reset)
+            {
+                m_header = new (region) Header();
+                m_header->Head = 0;
+                m_header->Tail = 0;
+                m_header->ReaderWaiting = 0;
+                m_header->WriterWaiting = 0;
+            }
+        }
+
+        bool SharedRing::TryWrite(uint8_t const *header, size_t headerSize, uint8_t const *data, size_t size)
+        {
+            auto const recordSize = headerSize + size;
+            if (recordSize > GetMaxRecordSize())
+            {
+                throw std::runtime_error("Record does not fit in the shared ring");
+            }
+
+            auto const head = m_header->Head.load();
+            auto const used = head - m_header->Tail.load();
+            if (used > m_capacity)
+            {
+                throw std::runtime_error("Shared ring is corrupted");
+            }
+            if (m_capacity - used < LengthSize + recordSize)
+            {
+                return false;
+            }
+
+            auto const length = static_cast<uint32_t>(recordSize);
+            CopyIn(head, reinterpret_cast<uint8_t const *>(&length), LengthSize);
+            CopyIn(head + LengthSize, header, headerSize);
+            CopyIn(head + LengthSize + headerSize, data, size);
+            m_header->Head = head + LengthSize + recordSize;
+
+            if (m_header->ReaderWaiting.load())
+            {
+                Signal(m_readableFd);
+            }
+            return true;
+        }
+
+        bool SharedRing::TryRead(std::vector<uint8_t> &record)
+        {
+            auto const tail = m_header->Tail.load();
+            auto const used = m_header->Head.load() - tail;
+            if (used == 0)
+            {
+                return false;
+            }
+
+            uint32_t length = 0;
+            if (used > m_capacity || used < LengthSize)
+            {
+                throw std::runtime_error("Shared ring is corrupted");
+            }
+            CopyOut(tail, reinterpret_cast<uint8_t *>(&length), LengthSize);
+            if (length > GetMaxRecordSize() || LengthSize + length > used)
+            {
+                throw std::runtime_error("Shared ring is corrupted");
+            }
+
+            record.resize(length);
+            CopyOut(tail + LengthSize, record.data(), length);
+            m_header->Tail = tail + LengthSize + length;
+
+            if (m_header->WriterWaiting.load())
+            {
+                Signal(m_writableFd);
+            }
+            return true;
+        }
+
+        bool SharedRing::ArmReadable()
+        {
+            m_header->ReaderWaiting = 1;
+            if (m_header->Head.load() != m_header->Tail.load())
+            {
+                m_header->ReaderWaiting = 0;
+                return false;
+            }
+            return true;
+        }
+
+        void SharedRing::DisarmReadable()
+        {
+            m_header->ReaderWaiting = 0;
+            Drain(m_readableFd);
+        }
+
+        bool SharedRing::ArmWritable(size_t size)
+        {
+            m_header->WriterWaiting = 1;
+            if (m_capacity - (m_header->Head.load() - m_header->Tail.load()) >= LengthSize + size)
+            {
+                m_header->WriterWaiting = 0;
+                return false;
+            }
+            return true;
+        }
+
+        void SharedRing::DisarmWritable()
+        {
+            m_header->WriterWaiting = 0;
+            Drain(m_writableFd);
+        }
+
+        void SharedRing::CopyIn(uint64_t position, uint8_t const *source, size_t size)
+        {
+            if (size == 0)
+            {
+                return;
+            }
+            auto const offset = static_cast<size_t>(position & (m_capacity - 1));
+            auto const first = std::min(size, m_capacity - offset);
+            std::memcpy(m_data + offset, source, first);
+            std::memcpy(m_data, source + first, size - first);
+        }
+
+        void SharedRing::CopyOut(uint64_t position, uint8_t *destination, size_t size) const
+        {
+            if (size == 0)
+            {
+                return;
+            }
+            auto const offset = static_cast<size_t>(position & (m_capacity - 1));
+            auto const first = std::min(size, m_capacity - offset);
+            std::memcpy(destination, m_data + offset, first);
+            std::memcpy(destination + first, m_data, size - first);
+        }
+    }
+}
+
+#endif
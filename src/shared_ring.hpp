@@ -0,0 +1,109 @@
+/**
+ * Single-producer, single-consumer record ring in memory shared between two processes
+ */
+
+#pragma once
+
+#if defined(__linux__)
+#define MY_TRANSPORT_HAS_SHARED_MEMORY 1
+#endif
+
+#if defined(MY_TRANSPORT_HAS_SHARED_MEMORY)
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Length-prefixed records in a power-of-two byte ring that lives in a shared mapping, with the
+         * read and write positions next to it. Each side gets an eventfd the other signals: the reader
+         * when records were written, the writer when space was freed.
+         *
+         * Signals are only sent to a side that announced it is about to sleep, with the same handshake
+         * the engine uses for its submission queue: the sleeper sets its flag and then checks the ring
+         * again, the other side moves its position and then checks the flag. A busy pair of processes
+         * therefore exchanges records without a system call.
+         *
+         * The memory may be written by a process that is not trusted to keep it consistent, so reads
+         * validate every position and length and throw on corruption.
+         */
+        class SharedRing final
+        {
+        public:
+            /**
+             * Bytes of shared memory a ring of @p capacity bytes, a power of two, needs.
+             */
+            static size_t GetRegionSize(size_t capacity);
+
+            /**
+             * Attaches to a ring in @p region, which must stay mapped for the lifetime of the ring.
+             * Only the process that creates the ring passes @p reset, before sharing the region.
+             */
+            SharedRing(void *region, size_t capacity, int readableFd, int writableFd, bool reset);
+
+            SharedRing(SharedRing const &) = delete;
+            SharedRing &operator=(SharedRing const &) = delete;
+
+            size_t GetCapacity() const { return m_capacity; }
+
+            /**
+             * Largest record the ring accepts, a quarter of its capacity so that a few are in flight.
+             */
+            size_t GetMaxRecordSize() const { return m_capacity / 4; }
+
+            /**
+             * Appends one record made of @p header followed by @p data, unless there is not enough free
+             * space. Writer only.
+             */
+            bool TryWrite(uint8_t const *header, size_t headerSize, uint8_t const *data, size_t size);
+
+            /**
+             * Moves the oldest record into @p record, unless the ring is empty. Reader only.
+             */
+            bool TryRead(std::vector<uint8_t> &record);
+
+            /**
+             * Asks the writer to signal the readable eventfd on its next record. Returns false, without
+             * asking, when a record arrived in the meantime. Reader only.
+             */
+            bool ArmReadable();
+
+            /**
+             * Withdraws ArmReadable once the reader is awake and drains the eventfd.
+             */
+            void DisarmReadable();
+
+            /**
+             * Asks the reader to signal the writable eventfd once a record of @p size bytes fits.
+             * Returns false, without asking, when it already fits. Writer only.
+             */
+            bool ArmWritable(size_t size);
+
+            /**
+             * Withdraws ArmWritable once the writer is awake and drains the eventfd.
+             */
+            void DisarmWritable();
+
+            int GetReadableFd() const { return m_readableFd; }
+            int GetWritableFd() const { return m_writableFd; }
+
+        private:
+            struct Header;
+
+            Header *m_header;
+            uint8_t *m_data;
+            size_t m_capacity;
+            int m_readableFd;
+            int m_writableFd;
+
+            void CopyIn(uint64_t position, uint8_t const *source, size_t size);
+            void CopyOut(uint64_t position, uint8_t *destination, size_t size) const;
+        };
+    }
+}
+
+#endif
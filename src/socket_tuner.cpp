@@ -0,0 +1,229 @@
+#include "socket_tuner.hpp"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#include <algorithm>
+
+namespace
+{
+    // Smaller transfers end before the window opens up and say little about the path
+    constexpr static const int64_t MinSampleBytes = 256 * 1024;
+    // Never tuned below this, whatever the path
+    constexpr static const int MinBufferSize = 64 * 1024;
+    // Weight of the newest transfer in the smoothed estimates
+    constexpr static const double Smoothing = 0.3;
+    // A transfer that moved this much of its buffer per round trip was held back by the window
+    constexpr static const double WindowLimitedRatio = 0.8;
+
+    int GetBufferSize(curl_socket_t socket, int name)
+    {
+        int value = 0;
+        socklen_t length = sizeof(value);
+#if defined(_WIN32)
+        auto const result = getsockopt(socket, SOL_SOCKET, name, reinterpret_cast<char *>(&value), &length);
+#else
+        auto const result = getsockopt(socket, SOL_SOCKET, name, &value, &length);
+#endif
+        if (result != 0)
+        {
+            return 0;
+        }
+#if defined(__linux__)
+        // Linux reports twice the size that was set, the other half covering its bookkeeping
+        value /= 2;
+#endif
+        return value;
+    }
+
+    // Hosts mapped to a Unix domain socket get those, which have no TCP options to set
+    bool IsUnixSocket(curl_socket_t socket)
+    {
+        sockaddr_storage address{};
+        socklen_t length = sizeof(address);
+        if (getsockname(socket, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+        {
+            return false;
+        }
+        return address.ss_family == AF_UNIX;
+    }
+
+    double Smooth(double previous, double sample)
+    {
+        return previous > 0 ? Smoothing * sample + (1 - Smoothing) * previous : sample;
+    }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        SocketTuner::SocketTuner(SocketProfile const &profile, std::shared_ptr<MetricsRegistry> metrics)
+            : m_profile(profile), m_metrics(std::move(metrics)),
+              m_optionFailures(m_metrics->GetCounter("socket_option_failures_total"))
+        {
+        }
+
+        void SocketTuner::Configure(curl_socket_t socket, std::string const &host)
+        {
+            auto receiveBuffer = m_profile.ReceiveBufferSize;
+            auto sendBuffer = m_profile.SendBufferSize;
+            if (m_profile.AutoTuneBuffers)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto found = m_paths.find(host);
+                if (found != m_paths.end())
+                {
+                    receiveBuffer = found->second.Receive.Buffer > 0 ? found->second.Receive.Buffer : receiveBuffer;
+                    sendBuffer = found->second.Send.Buffer > 0 ? found->second.Send.Buffer : sendBuffer;
+                }
+            }
+
+            // Before the connection is made, so the window scale offered in the SYN fits the buffer
+            if (receiveBuffer > 0)
+            {
+                SetOption(socket, SOL_SOCKET, SO_RCVBUF, receiveBuffer);
+            }
+            if (sendBuffer > 0)
+            {
+                SetOption(socket, SOL_SOCKET, SO_SNDBUF, sendBuffer);
+            }
+            if (IsUnixSocket(socket))
+            {
+                return;
+            }
+            SetOption(socket, IPPROTO_TCP, TCP_NODELAY, m_profile.NoDelay ? 1 : 0);
+
+            if (m_profile.KeepAliveIdle.count() > 0)
+            {
+                SetOption(socket, SOL_SOCKET, SO_KEEPALIVE, 1);
+                auto const idle = static_cast<int>(m_profile.KeepAliveIdle.count());
+#if defined(TCP_KEEPIDLE)
+                SetOption(socket, IPPROTO_TCP, TCP_KEEPIDLE, idle);
+#elif defined(TCP_KEEPALIVE)
+                // macOS names the idle time after the feature
+                SetOption(socket, IPPROTO_TCP, TCP_KEEPALIVE, idle);
+#endif
+#if defined(TCP_KEEPINTVL)
+                if (m_profile.KeepAliveInterval.count() > 0)
+                {
+                    SetOption(socket, IPPROTO_TCP, TCP_KEEPINTVL, static_cast<int>(m_profile.KeepAliveInterval.count()));
+                }
+#endif
+#if defined(TCP_KEEPCNT)
+                if (m_profile.KeepAliveProbes > 0)
+                {
+                    SetOption(socket, IPPROTO_TCP, TCP_KEEPCNT, m_profile.KeepAliveProbes);
+                }
+#endif
+                (void)idle;
+            }
+
+#if defined(SO_BUSY_POLL)
+            if (m_profile.BusyPoll.count() > 0)
+            {
+                // Raising it above net.core.busy_read needs CAP_NET_ADMIN
+                SetOption(socket, SOL_SOCKET, SO_BUSY_POLL, static_cast<int>(m_profile.BusyPoll.count()));
+            }
+#endif
+        }
+
+        void SocketTuner::OnTransferDone(std::string const &host, curl_socket_t socket, PathSample const &sample)
+        {
+            // A local socket has no path to learn and the kernel sizes it as it goes
+            if (!m_profile.AutoTuneBuffers || (socket != CURL_SOCKET_BAD && IsUnixSocket(socket)))
+            {
+                return;
+            }
+
+            // What the connection actually ran with, whether tuned here or by the OS
+            auto const receiveBuffer = socket != CURL_SOCKET_BAD ? GetBufferSize(socket, SO_RCVBUF) : 0;
+            auto const sendBuffer = socket != CURL_SOCKET_BAD ? GetBufferSize(socket, SO_SNDBUF) : 0;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &path = GetPath(host);
+            if (sample.Rtt.count() > 0)
+            {
+                path.Rtt = Smooth(path.Rtt, std::chrono::duration<double>(sample.Rtt).count());
+            }
+            if (path.Rtt <= 0)
+            {
+                return;
+            }
+            Tune(path.Receive, path.Rtt, sample.ReceivedBytes, sample.ReceiveTime, receiveBuffer);
+            Tune(path.Send, path.Rtt, sample.SentBytes, sample.SendTime, sendBuffer);
+        }
+
+        SocketTuner::Path &SocketTuner::GetPath(std::string const &host)
+        {
+            auto found = m_paths.find(host);
+            if (found != m_paths.end())
+            {
+                return found->second;
+            }
+
+            auto const labels = MetricsRegistry::Label("host", host);
+            Path path;
+            path.Receive.Configured = m_profile.ReceiveBufferSize;
+            path.Receive.BufferGauge = &m_metrics->GetGauge("socket_receive_buffer_bytes", labels);
+            path.Send.Configured = m_profile.SendBufferSize;
+            path.Send.BufferGauge = &m_metrics->GetGauge("socket_send_buffer_bytes", labels);
+            return m_paths.emplace(host, path).first->second;
+        }
+
+        void SocketTuner::Tune(Direction &state, double rtt, int64_t bytes, std::chrono::microseconds time, int currentBuffer)
+        {
+            if (bytes < MinSampleBytes || time.count() <= 0)
+            {
+                return;
+            }
+            auto const throughput = static_cast<double>(bytes) / std::chrono::duration<double>(time).count();
+            state.Throughput = Smooth(state.Throughput, throughput);
+            auto const bandwidthDelay = state.Throughput * rtt;
+
+            auto const floor = std::max(state.Configured, MinBufferSize);
+            double target;
+            if (currentBuffer > 0 && throughput * rtt >= WindowLimitedRatio * currentBuffer)
+            {
+                // The window, not the path, was the limit; how far the path goes is only known once it is not
+                target = std::max(2.0 * currentBuffer, 2.0 * bandwidthDelay);
+            }
+            else if (state.Buffer > 0)
+            {
+                // Tuned before, follows the path back down to what it needs
+                target = 2.0 * bandwidthDelay;
+            }
+            else
+            {
+                // The default buffers keep up
+                return;
+            }
+
+            auto const size = static_cast<int>(std::min(target, static_cast<double>(m_profile.MaxBufferSize)));
+            // Below the floor the profile's sizes, or the OS with its own tuning, do as well
+            state.Buffer = size > floor ? size : 0;
+            state.BufferGauge->Set(state.Buffer > 0 ? state.Buffer : state.Configured);
+        }
+
+        bool SocketTuner::SetOption(curl_socket_t socket, int level, int name, int value)
+        {
+#if defined(_WIN32)
+            auto const result = setsockopt(socket, level, name, reinterpret_cast<char const *>(&value), sizeof(value));
+#else
+            auto const result = setsockopt(socket, level, name, &value, sizeof(value));
+#endif
+            if (result != 0)
+            {
+                m_optionFailures.Add();
+                return false;
+            }
+            return true;
+        }
+    }
+}
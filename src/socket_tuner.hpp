@@ -0,0 +1,120 @@
+/**
+ * Socket options applied to every connection the transport opens
+ */
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        struct SocketProfile
+        {
+            // SO_RCVBUF and SO_SNDBUF in bytes, zero leaves them to the OS
+            int ReceiveBufferSize = 0;
+            int SendBufferSize = 0;
+            bool NoDelay = true;
+            // Zero leaves TCP keepalive as libcurl configured it
+            std::chrono::seconds KeepAliveIdle{0};
+            std::chrono::seconds KeepAliveInterval{0};
+            int KeepAliveProbes = 0;
+            // SO_BUSY_POLL, zero leaves it off
+            std::chrono::microseconds BusyPoll{0};
+            // Sizes the buffers of each host's new connections from its observed bandwidth-delay product
+            bool AutoTuneBuffers = false;
+            int MaxBufferSize = 16 * 1024 * 1024;
+        };
+
+        /**
+         * What a completed transfer observed of its connection's path
+         */
+        struct PathSample
+        {
+            // Round trip time, zero when unknown
+            std::chrono::microseconds Rtt{0};
+            int64_t ReceivedBytes = 0;
+            // Time spent receiving the response body
+            std::chrono::microseconds ReceiveTime{0};
+            int64_t SentBytes = 0;
+            // Time spent sending the request body
+            std::chrono::microseconds SendTime{0};
+        };
+
+        /**
+         * Applies a SocketProfile to sockets as libcurl creates them, from the engine's
+         * `CURLOPT_SOCKOPTFUNCTION`. Options the platform lacks or refuses are skipped; the connection
+         * still goes ahead with the OS defaults.
+         *
+         * With buffer auto-tuning, completed transfers report their path and each host's buffers are
+         * sized to twice the bandwidth-delay product of what its connections delivered. A transfer that
+         * moved a full buffer per round trip was held back by the window rather than by the path, so
+         * that host's buffers double for the next connection instead, up to the maximum. Only new
+         * connections pick the sizes up. Setting the sizes turns off Linux's own receive buffer
+         * tuning for those sockets, which is the point on high-BDP links where its ceiling is too low.
+         *
+         * Thread safe; shared by every engine of the transport.
+         */
+        class SocketTuner final
+        {
+        public:
+            SocketTuner(SocketProfile const &profile, std::shared_ptr<MetricsRegistry> metrics);
+
+            SocketTuner(SocketTuner const &) = delete;
+            SocketTuner &operator=(SocketTuner const &) = delete;
+
+            bool IsAutoTuning() const { return m_profile.AutoTuneBuffers; }
+
+            /**
+             * Applies the profile, with the buffer sizes tuned for @p host, to a new @p socket. Unix
+             * domain sockets only get the buffer sizes.
+             */
+            void Configure(curl_socket_t socket, std::string const &host);
+
+            /**
+             * Feeds the auto-tuner with a transfer to @p host that ran on @p socket.
+             */
+            void OnTransferDone(std::string const &host, curl_socket_t socket, PathSample const &sample);
+
+        private:
+            struct Direction
+            {
+                // Bytes per second, smoothed
+                double Throughput = 0;
+                // What the tuner sets on new sockets, zero for the profile's size
+                int Buffer = 0;
+                // The profile's size
+                int Configured = 0;
+                Gauge *BufferGauge;
+            };
+
+            struct Path
+            {
+                // Smoothed, in seconds
+                double Rtt = 0;
+                Direction Receive;
+                Direction Send;
+            };
+
+            SocketProfile m_profile;
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            Counter &m_optionFailures;
+            std::mutex m_mutex;
+            std::unordered_map<std::string, Path> m_paths;
+
+            Path &GetPath(std::string const &host);
+            void Tune(Direction &state, double rtt, int64_t bytes, std::chrono::microseconds time, int currentBuffer);
+            bool SetOption(curl_socket_t socket, int level, int name, int value);
+        };
+    }
+}
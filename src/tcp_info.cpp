@@ -0,0 +1,69 @@
+#include "tcp_info.hpp"
+
+#if defined(__linux__)
+// The glibc declaration stops at the fields of older kernels
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        TcpInfoSample SampleTcpInfo(curl_socket_t socket)
+        {
+            TcpInfoSample sample;
+#if defined(__linux__)
+            struct tcp_info info = {};
+            socklen_t length = sizeof(info);
+            if (socket == CURL_SOCKET_BAD || getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+            {
+                return sample;
+            }
+
+            // Older kernels fill in a prefix of the structure
+            auto const reports = [length](size_t offset, size_t size)
+            { return offset + size <= length; };
+
+            sample.Available = true;
+            sample.Rtt = std::chrono::microseconds(info.tcpi_rtt);
+            sample.RttVariance = std::chrono::microseconds(info.tcpi_rttvar);
+            sample.Retransmits = info.tcpi_total_retrans;
+            sample.CongestionWindow = info.tcpi_snd_cwnd;
+            sample.ReceiveSpace = info.tcpi_rcv_space;
+            if (reports(offsetof(struct tcp_info, tcpi_min_rtt), sizeof(info.tcpi_min_rtt)))
+            {
+                sample.MinRtt = std::chrono::microseconds(info.tcpi_min_rtt);
+            }
+            if (reports(offsetof(struct tcp_info, tcpi_delivery_rate), sizeof(info.tcpi_delivery_rate)))
+            {
+                sample.DeliveryRate = info.tcpi_delivery_rate;
+            }
+            if (reports(offsetof(struct tcp_info, tcpi_rwnd_limited), sizeof(info.tcpi_rwnd_limited)))
+            {
+                sample.ReceiveWindowLimited = std::chrono::microseconds(info.tcpi_rwnd_limited);
+            }
+#else
+            (void)socket;
+#endif
+            return sample;
+        }
+
+        std::chrono::microseconds EstimateServerTime(CURL *handle, TcpInfoSample const &sample)
+        {
+            curl_off_t preTransfer = 0;
+            curl_off_t startTransfer = 0;
+            if (!sample.Available || curl_easy_getinfo(handle, CURLINFO_PRETRANSFER_TIME_T, &preTransfer) != CURLE_OK ||
+                curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &startTransfer) != CURLE_OK)
+            {
+                return std::chrono::microseconds(0);
+            }
+            auto const firstByte = std::chrono::microseconds(startTransfer - preTransfer);
+            return std::max(firstByte - sample.Rtt, std::chrono::microseconds(0));
+        }
+    }
+}
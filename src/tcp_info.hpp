@@ -0,0 +1,51 @@
+/**
+ * Kernel statistics of a TCP connection
+ */
+
+#pragma once
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <cstdint>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * What `getsockopt(TCP_INFO)` reports for a connection. Counters cover the connection's
+         * lifetime; the engine turns them into per-transfer deltas.
+         */
+        struct TcpInfoSample
+        {
+            // False where TCP_INFO is not supported, every other field is then zero
+            bool Available = false;
+            // Smoothed by the kernel
+            std::chrono::microseconds Rtt{0};
+            std::chrono::microseconds RttVariance{0};
+            std::chrono::microseconds MinRtt{0};
+            // Segments retransmitted
+            uint32_t Retransmits = 0;
+            // In segments
+            uint32_t CongestionWindow = 0;
+            // Most recent estimate, in bytes per second
+            uint64_t DeliveryRate = 0;
+            // Time sending was held back by the peer's receive window
+            std::chrono::microseconds ReceiveWindowLimited{0};
+            // Receive buffer space the kernel has tuned the connection to, in bytes
+            uint32_t ReceiveSpace = 0;
+        };
+
+        /**
+         * Samples @p socket. Fields the running kernel does not report are left at zero.
+         */
+        TcpInfoSample SampleTcpInfo(curl_socket_t socket);
+
+        /**
+         * The part of @p handle's time to first byte that was not the request and response crossing the
+         * network, once, at the round trip time in @p sample. Zero without one.
+         */
+        std::chrono::microseconds EstimateServerTime(CURL *handle, TcpInfoSample const &sample);
+    }
+}
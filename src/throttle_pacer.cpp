@@ -0,0 +1,191 @@
+#include "throttle_pacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // How often a paced caller checks its context; Azure contexts have no cancellation callback
+    constexpr static const std::chrono::milliseconds CancellationPollInterval(100);
+
+    constexpr static const std::chrono::seconds RateWindow(1);
+    constexpr static const std::chrono::seconds UnpaceAfter(30);
+    // Retry-After values beyond this are treated as this; the SDK retry policy still applies its own
+    constexpr static const std::chrono::seconds MaxPause(30);
+
+    constexpr static const double MinRate = 1;
+    constexpr static const double Backoff = 0.5;
+    constexpr static const double RecoveryPerSecond = 1.1;
+
+    double ToSeconds(Clock::duration duration) { return std::chrono::duration<double>(duration).count(); }
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        ThrottlePacer::ThrottlePacer(std::shared_ptr<MetricsRegistry> metrics) : m_metrics(std::move(metrics)) {}
+
+        std::string ThrottlePacer::GetAccountName(std::string const &host)
+        {
+            // <account>[-secondary].<service>.core.windows.net and the other clouds' equivalents; all
+            // services and both locations of an account share its scalability targets
+            auto const firstDot = host.find('.');
+            if (firstDot == std::string::npos || host.find(".core.") == std::string::npos)
+            {
+                return host;
+            }
+            auto account = host.substr(0, firstDot);
+            static std::string const SecondarySuffix = "-secondary";
+            if (account.size() > SecondarySuffix.size() && account.compare(account.size() - SecondarySuffix.size(), SecondarySuffix.size(), SecondarySuffix) == 0)
+            {
+                account.resize(account.size() - SecondarySuffix.size());
+            }
+            return account;
+        }
+
+        ThrottlePacer::Account &ThrottlePacer::GetAccount(std::string const &host)
+        {
+            auto const name = GetAccountName(host);
+            auto found = m_accounts.find(name);
+            if (found != m_accounts.end())
+            {
+                return found->second;
+            }
+
+            auto const labels = MetricsRegistry::Label("account", name);
+            Account account;
+            account.LastRefill = account.WindowStart = Clock::now();
+            account.RateGauge = &m_metrics->GetGauge("pacing_rate", labels);
+            account.Delay = &m_metrics->GetHistogram("pacing_delay_ms", MetricsRegistry::LatencyBoundsMs(), labels);
+            account.Throttled = &m_metrics->GetCounter("throttled_responses_total", labels);
+            return m_accounts.emplace(name, std::move(account)).first->second;
+        }
+
+        Clock::duration ThrottlePacer::Acquire(Account &account, Clock::time_point now)
+        {
+            if (now < account.PausedUntil)
+            {
+                return account.PausedUntil - now;
+            }
+
+            if (account.Rate > 0 && now - account.LastThrottled >= UnpaceAfter)
+            {
+                account.Rate = 0;
+                account.RateGauge->Set(0);
+            }
+            if (account.Rate > 0)
+            {
+                auto const elapsed = ToSeconds(now - account.LastRefill);
+                if (now - account.LastThrottled >= RateWindow)
+                {
+                    account.Rate *= std::pow(RecoveryPerSecond, elapsed);
+                }
+                // A tenth of a second worth of burst keeps the stream smooth
+                auto const burst = std::max(1.0, account.Rate / 10);
+                account.Tokens = std::min(burst, account.Tokens + elapsed * account.Rate);
+                account.RateGauge->Set(static_cast<int64_t>(account.Rate));
+                if (account.Tokens < 1)
+                {
+                    account.LastRefill = now;
+                    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((1 - account.Tokens) / account.Rate));
+                }
+                account.Tokens -= 1;
+            }
+            account.LastRefill = now;
+
+            if (now - account.WindowStart >= RateWindow)
+            {
+                // A gap of more than a window means nothing was sent during the last one
+                account.SentInLastWindow = now - account.WindowStart < 2 * RateWindow ? account.SentInWindow : 0;
+                account.SentInWindow = 0;
+                account.WindowStart = now;
+            }
+            ++account.SentInWindow;
+            return Clock::duration::zero();
+        }
+
+        void ThrottlePacer::Wait(std::string const &host, Azure::Core::Context const &context)
+        {
+            auto const start = Clock::now();
+            while (true)
+            {
+                context.ThrowIfCancelled();
+
+                Clock::duration wait;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    auto &account = GetAccount(host);
+                    auto const now = Clock::now();
+                    wait = Acquire(account, now);
+                    if (wait == Clock::duration::zero())
+                    {
+                        account.Delay->Record(std::chrono::duration<double, std::milli>(now - start).count());
+                        return;
+                    }
+                }
+                std::this_thread::sleep_for(std::min<Clock::duration>(wait, CancellationPollInterval));
+            }
+        }
+
+        void ThrottlePacer::OnThrottled(std::string const &host, std::chrono::milliseconds retryAfter)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto &account = GetAccount(host);
+            auto const now = Clock::now();
+            account.Throttled->Add();
+            account.LastThrottled = now;
+
+            // Responses to requests already in flight carry the same signal, only the first one counts
+            if (account.Rate == 0 || now - account.LastDecrease >= RateWindow)
+            {
+                auto rate = account.Rate;
+                if (rate == 0)
+                {
+                    auto const sent = std::max(account.SentInLastWindow, account.SentInWindow);
+                    rate = std::max(static_cast<double>(sent), 2 * MinRate);
+                }
+                account.Rate = std::max(MinRate, rate * Backoff);
+                account.Tokens = 0;
+                account.LastRefill = now;
+                account.LastDecrease = now;
+                account.RateGauge->Set(static_cast<int64_t>(account.Rate));
+            }
+
+            if (retryAfter.count() > 0)
+            {
+                account.PausedUntil = std::max(account.PausedUntil, now + std::min<Clock::duration>(retryAfter, MaxPause));
+            }
+        }
+
+        bool ThrottlePacer::IsThrottlingResponse(int statusCode, std::string const &errorCode)
+        {
+            if (statusCode == 503 || statusCode == 429)
+            {
+                return true;
+            }
+            return statusCode == 500 && (errorCode == "ServerBusy" || errorCode == "OperationTimedOut");
+        }
+
+        std::chrono::milliseconds ThrottlePacer::ParseRetryAfter(std::string const &value)
+        {
+            auto const first = value.find_first_not_of(" \t");
+            auto const last = value.find_last_not_of(" \t");
+            if (first == std::string::npos || value.find_first_not_of("0123456789", first) <= last)
+            {
+                return std::chrono::milliseconds(0);
+            }
+            try
+            {
+                return std::chrono::seconds(std::stoll(value.substr(first, last - first + 1)));
+            }
+            catch (std::exception const &)
+            {
+                return std::chrono::milliseconds(0);
+            }
+        }
+    }
+}
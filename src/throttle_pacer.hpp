@@ -0,0 +1,90 @@
+/**
+ * Client-side pacing of requests to storage accounts that are throttling
+ */
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <azure/core/context.hpp>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * One token bucket per storage account, shared by every request the transport sends to it.
+         *
+         * An account is unpaced until it throttles (503, or 500 with `ServerBusy`). The first signal caps
+         * its request rate at half of what was being sent, and every further signal halves it again, at
+         * most once a second. A `Retry-After` pauses the account for that long. Each quiet second
+         * raises the rate by a tenth, and pacing is dropped once the account has been quiet for
+         * half a minute.
+         *
+         * Pacing every thread through one bucket turns a throttled account's retry storm into a steady
+         * stream just under its limit, instead of each caller backing off on its own.
+         */
+        class ThrottlePacer final
+        {
+        public:
+            explicit ThrottlePacer(std::shared_ptr<MetricsRegistry> metrics);
+
+            ThrottlePacer(ThrottlePacer const &) = delete;
+            ThrottlePacer &operator=(ThrottlePacer const &) = delete;
+
+            /**
+             * Blocks until a request to @p host may be sent. Throws when @p context is cancelled first.
+             */
+            void Wait(std::string const &host, Azure::Core::Context const &context);
+
+            /**
+             * Reports a throttling response from @p host. A zero @p retryAfter means none was given.
+             */
+            void OnThrottled(std::string const &host, std::chrono::milliseconds retryAfter);
+
+            /**
+             * Whether a response with these status and `x-ms-error-code` values is a throttling signal.
+             */
+            static bool IsThrottlingResponse(int statusCode, std::string const &errorCode);
+
+            /**
+             * Parses a `Retry-After` value in delta-seconds, the form Azure Storage sends. Returns zero
+             * for anything else.
+             */
+            static std::chrono::milliseconds ParseRetryAfter(std::string const &value);
+
+        private:
+            struct Account
+            {
+                // Requests per second, zero while unpaced
+                double Rate = 0;
+                double Tokens = 0;
+                std::chrono::steady_clock::time_point LastRefill;
+                std::chrono::steady_clock::time_point PausedUntil;
+                std::chrono::steady_clock::time_point LastThrottled;
+                std::chrono::steady_clock::time_point LastDecrease;
+                // Requests sent during the current and the last one-second window
+                size_t SentInWindow = 0;
+                size_t SentInLastWindow = 0;
+                std::chrono::steady_clock::time_point WindowStart;
+                Gauge *RateGauge;
+                Histogram *Delay;
+                Counter *Throttled;
+            };
+
+            std::shared_ptr<MetricsRegistry> m_metrics;
+            std::mutex m_mutex;
+            std::unordered_map<std::string, Account> m_accounts;
+
+            Account &GetAccount(std::string const &host);
+            static std::string GetAccountName(std::string const &host);
+            static std::chrono::steady_clock::duration Acquire(Account &account, std::chrono::steady_clock::time_point now);
+        };
+    }
+}
@@ -0,0 +1,349 @@
+#include "tls_session_store.hpp"
+
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#endif
+
+namespace
+{
+    // File layout: magic | nonce | AES-256-GCM(records) | tag
+    // Record layout: u32 key length | key | u32 shmac length | shmac | u32 data length | data | i64 valid until
+    constexpr static const char FileMagic[] = {'M', 'T', 'T', 'S', '\x01'};
+    constexpr static const size_t FileMagicLen = sizeof(FileMagic);
+    constexpr static const size_t KeyLen = 32;
+    constexpr static const size_t NonceLen = 12;
+    constexpr static const size_t TagLen = 16;
+
+    struct CurlHandleDeleter
+    {
+        void operator()(CURL *handle) const { curl_easy_cleanup(handle); }
+    };
+    using UniqueCurlHandle = std::unique_ptr<CURL, CurlHandleDeleter>;
+
+    UniqueCurlHandle CreateSharedHandle(MyNameSpace::_detail::CurlShare const &share)
+    {
+        UniqueCurlHandle handle(curl_easy_init());
+        if (!handle)
+        {
+            throw std::runtime_error("Could not create a new libcurl handle");
+        }
+        share.ApplyTo(handle.get());
+        return handle;
+    }
+
+    void AppendU32(std::vector<uint8_t> &out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void AppendI64(std::vector<uint8_t> &out, int64_t value)
+    {
+        auto const unsignedValue = static_cast<uint64_t>(value);
+        for (int i = 0; i < 8; ++i)
+        {
+            out.push_back(static_cast<uint8_t>(unsignedValue >> (8 * i)));
+        }
+    }
+
+    void AppendBytes(std::vector<uint8_t> &out, void const *data, size_t length)
+    {
+        AppendU32(out, static_cast<uint32_t>(length));
+        auto bytes = static_cast<uint8_t const *>(data);
+        out.insert(out.end(), bytes, bytes + length);
+    }
+
+    // Bounds-checked cursor over a decrypted record buffer
+    class RecordReader final
+    {
+    public:
+        RecordReader(uint8_t const *begin, uint8_t const *end) : m_current(begin), m_end(end) {}
+
+        bool AtEnd() const { return m_current == m_end; }
+
+        bool ReadU32(uint32_t &value)
+        {
+            uint64_t wide;
+            if (!ReadLittleEndian(4, wide))
+            {
+                return false;
+            }
+            value = static_cast<uint32_t>(wide);
+            return true;
+        }
+
+        bool ReadI64(int64_t &value)
+        {
+            uint64_t wide;
+            if (!ReadLittleEndian(8, wide))
+            {
+                return false;
+            }
+            value = static_cast<int64_t>(wide);
+            return true;
+        }
+
+        bool ReadBytes(uint8_t const *&data, size_t &length)
+        {
+            uint32_t declared;
+            if (!ReadU32(declared) || static_cast<size_t>(m_end - m_current) < declared)
+            {
+                return false;
+            }
+            data = m_current;
+            length = declared;
+            m_current += declared;
+            return true;
+        }
+
+    private:
+        uint8_t const *m_current;
+        uint8_t const *m_end;
+
+        bool ReadLittleEndian(size_t width, uint64_t &value)
+        {
+            if (static_cast<size_t>(m_end - m_current) < width)
+            {
+                return false;
+            }
+            value = 0;
+            for (size_t i = 0; i < width; ++i)
+            {
+                value |= static_cast<uint64_t>(m_current[i]) << (8 * i);
+            }
+            m_current += width;
+            return true;
+        }
+    };
+
+#if defined(MY_TRANSPORT_HAS_OPENSSL)
+    struct CipherContextDeleter
+    {
+        void operator()(EVP_CIPHER_CTX *context) const { EVP_CIPHER_CTX_free(context); }
+    };
+    using UniqueCipherContext = std::unique_ptr<EVP_CIPHER_CTX, CipherContextDeleter>;
+
+    std::vector<uint8_t> Encrypt(std::vector<uint8_t> const &key, std::vector<uint8_t> const &plain)
+    {
+        std::vector<uint8_t> sealed(FileMagic, FileMagic + FileMagicLen);
+        sealed.resize(FileMagicLen + NonceLen + plain.size() + TagLen);
+        auto nonce = sealed.data() + FileMagicLen;
+        auto cipherText = nonce + NonceLen;
+        if (RAND_bytes(nonce, static_cast<int>(NonceLen)) != 1)
+        {
+            throw std::runtime_error("Could not generate a nonce for the TLS session cache");
+        }
+
+        UniqueCipherContext context(EVP_CIPHER_CTX_new());
+        int written = 0;
+        int finalWritten = 0;
+        auto const failed = !context ||
+                            EVP_EncryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, key.data(), nonce) != 1 ||
+                            // The header is authenticated so a file from another format version never decrypts
+                            EVP_EncryptUpdate(context.get(), nullptr, &written, sealed.data(), static_cast<int>(FileMagicLen)) != 1 ||
+                            EVP_EncryptUpdate(context.get(), cipherText, &written, plain.data(), static_cast<int>(plain.size())) != 1 ||
+                            EVP_EncryptFinal_ex(context.get(), cipherText + written, &finalWritten) != 1 ||
+                            EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_GET_TAG, static_cast<int>(TagLen), cipherText + plain.size()) != 1;
+        if (failed)
+        {
+            throw std::runtime_error("Could not encrypt the TLS session cache");
+        }
+        return sealed;
+    }
+
+    bool Decrypt(std::vector<uint8_t> const &key, std::vector<uint8_t> const &sealed, std::vector<uint8_t> &plain)
+    {
+        if (sealed.size() < FileMagicLen + NonceLen + TagLen || !std::equal(FileMagic, FileMagic + FileMagicLen, sealed.begin()))
+        {
+            return false;
+        }
+        auto nonce = sealed.data() + FileMagicLen;
+        auto cipherText = nonce + NonceLen;
+        auto const cipherTextLen = sealed.size() - FileMagicLen - NonceLen - TagLen;
+        plain.resize(cipherTextLen);
+
+        UniqueCipherContext context(EVP_CIPHER_CTX_new());
+        int written = 0;
+        int finalWritten = 0;
+        return context &&
+               EVP_DecryptInit_ex(context.get(), EVP_aes_256_gcm(), nullptr, key.data(), nonce) == 1 &&
+               EVP_DecryptUpdate(context.get(), nullptr, &written, sealed.data(), static_cast<int>(FileMagicLen)) == 1 &&
+               EVP_DecryptUpdate(context.get(), plain.data(), &written, cipherText, static_cast<int>(cipherTextLen)) == 1 &&
+               EVP_CIPHER_CTX_ctrl(context.get(), EVP_CTRL_GCM_SET_TAG, static_cast<int>(TagLen), const_cast<uint8_t *>(cipherText + cipherTextLen)) == 1 &&
+               EVP_DecryptFinal_ex(context.get(), plain.data() + written, &finalWritten) == 1;
+    }
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    CURLcode ExportSession(
+        CURL *,
+        void *userp,
+        char const *sessionKey,
+        unsigned char const *shmac,
+        size_t shmacLen,
+        unsigned char const *sessionData,
+        size_t sessionDataLen,
+        curl_off_t validUntil,
+        int,
+        char const *,
+        size_t)
+    {
+        auto &records = *static_cast<std::vector<uint8_t> *>(userp);
+        AppendBytes(records, sessionKey, std::char_traits<char>::length(sessionKey));
+        AppendBytes(records, shmac, shmacLen);
+        AppendBytes(records, sessionData, sessionDataLen);
+        AppendI64(records, static_cast<int64_t>(validUntil));
+        return CURLE_OK;
+    }
+#endif
+}
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        TlsSessionStore::TlsSessionStore(
+            std::string path,
+            std::vector<uint8_t> key,
+            std::vector<std::shared_ptr<CurlShare>> shares,
+            std::chrono::seconds saveInterval)
+            : m_path(std::move(path)), m_key(std::move(key)), m_shares(std::move(shares))
+        {
+#if !defined(MY_TRANSPORT_HAS_OPENSSL)
+            throw std::runtime_error("The TLS session cache requires building with OpenSSL");
+#elif LIBCURL_VERSION_NUM < 0x080c00
+            throw std::runtime_error("The TLS session cache requires libcurl 8.12.0 or newer");
+#endif
+            if (m_key.size() != KeyLen)
+            {
+                throw std::invalid_argument("The TLS session cache key must be 32 bytes long");
+            }
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+            // Export is an optional libcurl build feature, find out now rather than on the first save
+            auto probe = CreateSharedHandle(*m_shares.front());
+            if (curl_easy_ssls_export(probe.get(), ExportSession, nullptr) == CURLE_NOT_BUILT_IN)
+            {
+                throw std::runtime_error("The TLS session cache requires libcurl built with SSL session export");
+            }
+#endif
+
+            Load();
+            m_saveTask = std::make_unique<PeriodicTask>(saveInterval, [this]()
+                                                        { Save(); });
+        }
+
+        TlsSessionStore::~TlsSessionStore()
+        {
+            m_saveTask->Stop();
+            try
+            {
+                Save();
+            }
+            catch (std::exception const &)
+            {
+                // Losing the cache only costs full handshakes on the next start
+            }
+        }
+
+        void TlsSessionStore::Load()
+        {
+#if defined(MY_TRANSPORT_HAS_OPENSSL) && LIBCURL_VERSION_NUM >= 0x080c00
+            std::ifstream file(m_path, std::ios::binary);
+            if (!file)
+            {
+                return;
+            }
+            std::vector<uint8_t> sealed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            std::vector<uint8_t> records;
+            if (!Decrypt(m_key, sealed, records))
+            {
+                return;
+            }
+
+            std::vector<UniqueCurlHandle> handles;
+            for (auto const &share : m_shares)
+            {
+                handles.push_back(CreateSharedHandle(*share));
+            }
+            auto const now = static_cast<int64_t>(std::time(nullptr));
+            RecordReader reader(records.data(), records.data() + records.size());
+            while (!reader.AtEnd())
+            {
+                uint8_t const *sessionKey, *shmac, *sessionData;
+                size_t sessionKeyLen, shmacLen, sessionDataLen;
+                int64_t validUntil;
+                auto const complete = reader.ReadBytes(sessionKey, sessionKeyLen) &&
+                                      reader.ReadBytes(shmac, shmacLen) &&
+                                      reader.ReadBytes(sessionData, sessionDataLen) &&
+                                      reader.ReadI64(validUntil);
+                if (!complete)
+                {
+                    // Records are only ever appended whole, anything else is corruption
+                    return;
+                }
+                if (validUntil > 0 && validUntil <= now)
+                {
+                    continue;
+                }
+
+                // Every shard may end up talking to the session's host
+                std::string const sessionKeyString(reinterpret_cast<char const *>(sessionKey), sessionKeyLen);
+                auto imported = false;
+                for (auto const &handle : handles)
+                {
+                    imported = curl_easy_ssls_import(handle.get(), sessionKeyString.c_str(), shmac, shmacLen, sessionData, sessionDataLen) == CURLE_OK || imported;
+                }
+                if (imported)
+                {
+                    ++m_loadedCount;
+                }
+            }
+#endif
+        }
+
+        void TlsSessionStore::Save()
+        {
+#if defined(MY_TRANSPORT_HAS_OPENSSL) && LIBCURL_VERSION_NUM >= 0x080c00
+            std::lock_guard<std::mutex> lock(m_saveMutex);
+
+            std::vector<uint8_t> records;
+            for (auto const &share : m_shares)
+            {
+                auto handle = CreateSharedHandle(*share);
+                auto operationResult = curl_easy_ssls_export(handle.get(), ExportSession, static_cast<void *>(&records));
+                if (operationResult != CURLE_OK)
+                {
+                    throw std::runtime_error("Could not export TLS sessions from libcurl");
+                }
+            }
+
+            auto const sealed = Encrypt(m_key, records);
+            auto const temporaryPath = m_path + ".tmp";
+            {
+                std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<char const *>(sealed.data()), static_cast<std::streamsize>(sealed.size()));
+                if (!file)
+                {
+                    throw std::runtime_error("Could not write TLS session cache " + temporaryPath);
+                }
+            }
+            // Readers only ever see a complete file
+            if (std::rename(temporaryPath.c_str(), m_path.c_str()) != 0)
+            {
+                std::remove(temporaryPath.c_str());
+                throw std::runtime_error("Could not replace TLS session cache " + m_path);
+            }
+#endif
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * Persists TLS session tickets to disk so fresh processes can resume sessions instead of doing full
+ * handshakes
+ */
+
+#pragma once
+
+#include "curl_share.hpp"
+#include "periodic_task.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Imports the tickets found in @p path into every share on construction and writes the tickets
+         * of all shares back periodically and on destruction.
+         *
+         * The file is encrypted and authenticated with AES-256-GCM using the caller-provided key. A file
+         * that cannot be decrypted (key rotated, truncated write) is treated as an empty cache.
+         */
+        class TlsSessionStore final
+        {
+        public:
+            TlsSessionStore(
+                std::string path,
+                std::vector<uint8_t> key,
+                std::vector<std::shared_ptr<CurlShare>> shares,
+                std::chrono::seconds saveInterval);
+            ~TlsSessionStore();
+
+            TlsSessionStore(TlsSessionStore const &) = delete;
+            TlsSessionStore &operator=(TlsSessionStore const &) = delete;
+
+            /**
+             * Number of sessions imported from disk when the store was created.
+             */
+            size_t GetLoadedCount() const { return m_loadedCount; }
+
+            void Save();
+
+        private:
+            std::string m_path;
+            std::vector<uint8_t> m_key;
+            std::vector<std::shared_ptr<CurlShare>> m_shares;
+            size_t m_loadedCount = 0;
+            std::mutex m_saveMutex;
+            std::unique_ptr<PeriodicTask> m_saveTask;
+
+            void Load();
+        };
+    }
+}
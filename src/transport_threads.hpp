@@ -0,0 +1,53 @@
+/**
+ * Ownership of objects that run threads of their own, safe to release from those threads
+ */
+
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace MyNameSpace
+{
+    namespace _detail
+    {
+        /**
+         * Whether the calling thread is an engine's event loop or a completion executor worker. Those
+         * threads mark themselves when they start.
+         */
+        inline bool &IsTransportThread()
+        {
+            thread_local bool transportThread = false;
+            return transportThread;
+        }
+
+        /**
+         * Deletes objects whose destructor joins threads of their own. Sessions of outstanding
+         * transfers keep them alive past the MyTransport, so the last reference can go away in a
+         * completion callback, on one of those threads, which cannot join itself. There the object is
+         * deleted on a detached thread instead.
+         */
+        template <class T>
+        struct TransportThreadsDeleter
+        {
+            void operator()(T *object) const
+            {
+                if (!IsTransportThread())
+                {
+                    delete object;
+                    return;
+                }
+                std::thread([object]()
+                            { delete object; })
+                    .detach();
+            }
+        };
+
+        template <class T, class... Args>
+        std::shared_ptr<T> MakeTransportShared(Args &&...args)
+        {
+            return std::shared_ptr<T>(new T(std::forward<Args>(args)...), TransportThreadsDeleter<T>());
+        }
+    }
+}